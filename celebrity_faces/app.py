@@ -77,11 +77,21 @@ def compute_embeddings(photos):
 
 
 def get_neighbors(embeddings, K, ef):
+    """
+    Nearest image of each of the K nearest celebrities and the celebrity identities, or the K
+    nearest images without identities when the index was built without groups.
+    """
     knn_req = {'query': embeddings, 'K': K, 'ef': ef}
-    knn = requests.get('http://localhost:5000/knn', json=knn_req)
-    neighbors = knn.json()
-    log.info('Neighbors recieved: {}'.format(neighbors))
-    return neighbors
+    knn = requests.get('http://localhost:5000/knn/groups', json=knn_req)
+    if knn.status_code == 400:
+        log.info('Index has no groups, searching plain neighbors: {}'.format(knn.text))
+        neighbors = requests.get('http://localhost:5000/knn', json=knn_req).json()
+        log.info('Neighbors recieved: {}'.format(neighbors))
+        return neighbors, [[None] * len(n) for n in neighbors]
+
+    found = knn.json()
+    log.info('Neighbors recieved: {}'.format(found))
+    return [f['neighbors'] for f in found], [f['groups'] for f in found]
 
 
 def copy_neighbors_to_static(neighbors):
@@ -132,7 +142,8 @@ def index():
     static_faces = move_to_static(photos_path)
 
     embeddings = compute_embeddings(photos)
-    neighbors = get_neighbors(embeddings, K=5, ef=100)
+    # with CelebA identities as groups of the index the 5 neighbors are 5 different people
+    neighbors, identities = get_neighbors(embeddings, K=5, ef=100)
 
     neighbors_static = copy_neighbors_to_static(neighbors)
 
@@ -145,7 +156,10 @@ def index():
             {
                 'name': os.path.basename(face_path),
                 'path': '/{}'.format(face_path),
-                'neighbors': [neighbors_static[n] for n in neighbors[idx]],
+                'neighbors': [
+                    {'path': neighbors_static[n], 'identity': identity}
+                    for n, identity in zip(neighbors[idx], identities[idx])
+                ],
                 'gan': static_gans[idx],
             }
             for idx, face_path in enumerate(static_faces)
@@ -1,5 +1,9 @@
 from flask import Flask, request, jsonify
 import logging
+import os
+import threading
+import time
+import numpy as np
 import pyhnsw
 from flasgger import Swagger
 
@@ -7,9 +11,91 @@ from flasgger import Swagger
 logging.basicConfig(level=logging.INFO)
 log = logging.getLogger(__name__)
 
+# binary snapshot is preferred, text dumps are used when it does not exist
+INDEX_SNAPSHOT = os.environ.get('INDEX_SNAPSHOT', 'index_data/index.snapshot')
+INDEX_STORAGE = os.environ.get('INDEX_STORAGE', 'index_data/storage.dump')
+INDEX_PARAMS = os.environ.get('INDEX_PARAMS', 'index_data/params.dump')
+# seconds between snapshot mtime checks, 0 disables the watch
+INDEX_WATCH_INTERVAL = float(os.environ.get('INDEX_WATCH_INTERVAL', '10'))
+# memory budget of the query result cache, 0 disables it
+QUERY_CACHE_BYTES = int(os.environ.get('QUERY_CACHE_BYTES', str(64 << 20)))
+# concurrent /knn requests wait up to this long to be searched as one batch, 0 turns batching off
+# and searches on the request's thread
+QUERY_BATCH_WINDOW_US = int(os.environ.get('QUERY_BATCH_WINDOW_US', '0'))
+QUERY_BATCH_SIZE = int(os.environ.get('QUERY_BATCH_SIZE', '64'))
+# none, replicate (a copy of every index per NUMA node) or interleave
+QUERY_NUMA_PLACEMENT = os.environ.get('QUERY_NUMA_PLACEMENT', 'none')
+# more named indexes, 'name=snapshot' or 'name=storage:params' separated by ';', loaded on first
+# request; the index above is named 'default', all of them are searched on one shared pool
+INDEXES = os.environ.get('INDEXES', '')
+# bytes of loaded indexes, least recently used ones are unloaded past it, 0 for unlimited
+INDEX_MEMORY_BUDGET = int(os.environ.get('INDEX_MEMORY_BUDGET', '0'))
+DEFAULT_INDEX = 'default'
+
+
+def index_files():
+    if os.path.exists(INDEX_SNAPSHOT):
+        return INDEX_SNAPSHOT.encode(), b''
+    return INDEX_STORAGE.encode(), INDEX_PARAMS.encode()
+
+
+def snapshot_mtime():
+    try:
+        return os.stat(INDEX_SNAPSHOT).st_mtime_ns
+    except OSError:
+        return None
+
+
+def reload_default():
+    """Loads the configured files of the default index aside and swaps them in."""
+    # the watcher and /admin/reload both land here, one reload at a time
+    with app.reload_lock:
+        files = index_files()
+        if files != app.default_files:
+            app.registry.register(DEFAULT_INDEX.encode(), *files)
+            app.default_files = files
+        app.registry.reload(DEFAULT_INDEX.encode())
+
+
+def watch_snapshot():
+    """Reloads the default index whenever the snapshot file is replaced, old index keeps serving on failure."""
+    last_mtime = snapshot_mtime()
+    while True:
+        time.sleep(INDEX_WATCH_INTERVAL)
+        mtime = snapshot_mtime()
+        if mtime is None or mtime == last_mtime:
+            continue
+        last_mtime = mtime
+        try:
+            reload_default()
+            log.info('Reloaded {}, {} points'.format(INDEX_SNAPSHOT, app.registry.size(DEFAULT_INDEX.encode())))
+        except Exception:
+            log.exception('Failed to reload {}'.format(INDEX_SNAPSHOT))
+
+
+def register_indexes(registry):
+    for entry in filter(None, INDEXES.split(';')):
+        name, files = entry.split('=', 1)
+        registry.register(name.strip().encode(), *[f.strip().encode() for f in files.split(':', 1)])
+
+
+def unknown_index(name):
+    return jsonify({'error': 'unknown index {}'.format(name)}), 404
+
+
 app = Flask(__name__)
 Swagger(app)
-app.hnsw = pyhnsw.PyHNSW(b'index_data/storage.dump', b'index_data/params.dump')
+app.registry = pyhnsw.PyIndexRegistry(INDEX_MEMORY_BUDGET, QUERY_CACHE_BYTES, QUERY_BATCH_WINDOW_US,
+                                      QUERY_BATCH_SIZE, numa=QUERY_NUMA_PLACEMENT.encode())
+register_indexes(app.registry)
+app.reload_lock = threading.Lock()
+app.default_files = index_files()
+app.registry.register(DEFAULT_INDEX.encode(), *app.default_files)
+# the default index loads at start, a broken one fails here rather than on the first request
+app.registry.reload(DEFAULT_INDEX.encode())
+# started on import so WSGI servers, which never run __main__, reload snapshots too
+if INDEX_WATCH_INTERVAL > 0:
+    threading.Thread(target=watch_snapshot, daemon=True).start()
 
 
 @app.route('/knn', methods=['GET'])
@@ -78,22 +164,259 @@ def index():
             type: integer
             format: int32
             description: Number of neighbors during search.
+
+          index:
+            type: string
+            description: Name of the index to search, one of INDEXES or 'default'.
+    """
+    data = request.json
+    q = data['query']
+    K = data['K']
+    ef = data['ef']
+    name = data.get('index', DEFAULT_INDEX)
+
+    log.info('Args: {} embeddings, K={}, ef={}, index={}'.format(len(q), K, ef, name))
+    if not q:
+        return jsonify([])
+
+    # one call for the whole batch, the search itself runs without the GIL
+    try:
+        neighbors = app.registry.knn_search(name.encode(), np.asarray(q, dtype=np.float32), K, ef)
+    except IndexError:
+        return unknown_index(name)
+    return jsonify([[int(p) for p in row if p >= 0] for row in neighbors])
+
+
+@app.route('/knn/groups', methods=['GET'])
+def groups():
+    """
+    HNSW indexer API, one neighbor per group
+    ---
+    tags:
+      - Find k approximate neighbors
+
+    description: Like /knn, but returns the best hit of each of the K nearest groups (e.g. K
+      distinct identities instead of K images of one). ef counts groups. The index must be built
+      with groups.
+
+    parameters:
+      - name: query
+        in: body
+        schema:
+          $ref: '#/definitions/kNNRequest'
+
+    consumes:
+      - application/json
+
+    produces:
+      - application/json
+
+    responses:
+      200:
+        description: Best neighbor of each group and the group ids, for each embedding.
+        schema:
+          $ref: '#/definitions/GroupsResponse'
+      400:
+        description: The index has no groups, use /knn.
+      404:
+        description: There is no index of that name.
+
+      default:
+        description: Unexpected error.
+
+    definitions:
+      GroupNeighbors:
+        type: object
+        properties:
+          neighbors:
+            $ref: '#/definitions/Neighbors'
+          groups:
+            type: array
+            items:
+              type: integer
+            description: Group of every neighbor.
+
+      GroupsResponse:
+        type: array
+        items:
+          $ref: '#/definitions/GroupNeighbors'
+    """
+    data = request.json
+    q = data['query']
+    K = data['K']
+    ef = data['ef']
+    name = data.get('index', DEFAULT_INDEX)
+
+    log.info('Args: {} embeddings, K={} groups, ef={}, index={}'.format(len(q), K, ef, name))
+    try:
+        if not app.registry.has_groups(name.encode()):
+            return jsonify({'error': 'index {} has no groups'.format(name)}), 400
+        if not q:
+            return jsonify([])
+        found = app.registry.knn_search_groups(name.encode(), np.asarray(q, dtype=np.float32), K, ef)
+    except IndexError:
+        return unknown_index(name)
+    results = []
+    for neighbors, groups in zip(found['neighbors'], found['groups']):
+        results.append({
+            'neighbors': [int(p) for p in neighbors if p >= 0],
+            'groups': [int(g) for g in groups if g >= 0],
+        })
+
+    return jsonify(results)
+
+
+@app.route('/knn/adaptive', methods=['GET'])
+def adaptive():
+    """
+    HNSW indexer API with early termination
+    ---
+    tags:
+      - Find k approximate neighbors
+
+    description: Like /knn, but layer-0 search stops on a termination criterion or a hard budget.
+
+    parameters:
+      - name: query
+        in: body
+        schema:
+          $ref: '#/definitions/AdaptiveKNNRequest'
+
+    consumes:
+      - application/json
+
+    produces:
+      - application/json
+
+    responses:
+      200:
+        description: Neighbors and termination flags for each embedding.
+        schema:
+          $ref: '#/definitions/AdaptiveKNNResponse'
+
+      default:
+        description: Unexpected error.
+
+    definitions:
+      AdaptiveNeighbors:
+        type: object
+        properties:
+          neighbors:
+            $ref: '#/definitions/Neighbors'
+          cut_short:
+            type: boolean
+            description: Distance budget or deadline was hit, neighbors may be incomplete.
+          early_stopped:
+            type: boolean
+            description: Patience or distance ratio criterion fired.
+          distance_evals:
+            type: integer
+          hops:
+            type: integer
+
+      AdaptiveKNNResponse:
+        type: array
+        items:
+          $ref: '#/definitions/AdaptiveNeighbors'
+
+      AdaptiveKNNRequest:
+        allOf:
+          - $ref: '#/definitions/kNNRequest'
+          - type: object
+            properties:
+              patience:
+                type: integer
+                description: Stop after this many hops without top-K improvement, 0 disables.
+              distance_ratio:
+                type: number
+                description: Stop when next candidate is farther than ratio * K-th best, 0 disables.
+              max_distance_evals:
+                type: integer
+                description: Hard budget on distance evaluations per embedding, 0 disables.
+              deadline_us:
+                type: integer
+                description: Hard budget on search time per embedding in microseconds, 0 disables.
     """
     data = request.json
     q = data['query']
     K = data['K']
     ef = data['ef']
+    limits = {
+        'patience': data.get('patience', 0),
+        'distance_ratio': data.get('distance_ratio', 0),
+        'max_distance_evals': data.get('max_distance_evals', 0),
+        'deadline_us': data.get('deadline_us', 0),
+    }
+
+    name = data.get('index', DEFAULT_INDEX)
+
+    log.info('Args: {} embeddings, K={}, ef={}, limits={}, index={}'.format(len(q), K, ef, limits, name))
+    if not q:
+        return jsonify([])
+
+    try:
+        found = app.registry.adaptive_knn_search(name.encode(), np.asarray(q, dtype=np.float32), K, ef, **limits)
+    except IndexError:
+        return unknown_index(name)
+    results = []
+    for i in range(len(q)):
+        results.append({
+            'neighbors': [int(p) for p in found['neighbors'][i] if p >= 0],
+            'cut_short': bool(found['cut_short'][i]),
+            'early_stopped': bool(found['early_stopped'][i]),
+            'distance_evals': int(found['distance_evals'][i]),
+            'hops': int(found['hops'][i]),
+        })
 
-    log.info('Args: q={}, K={}, ef={}'.format(q, K, ef))
-    neighbors = []
-    for emb in q:
-        log.info('Processing embedding: {}'.format(emb))
-        emb_neighbors = app.hnsw.knn_search(emb, K, ef)
-        log.info('Embedding neighbors: {}'.format(emb_neighbors))
-        neighbors.append(emb_neighbors)
+    return jsonify(results)
+
+
+@app.route('/admin/reload', methods=['POST'])
+def reload():
+    """
+    Reload the index without downtime
+    ---
+    tags:
+      - Admin
+
+    description: Loads the index again from its configured files (INDEX_SNAPSHOT, or INDEX_STORAGE and
+      INDEX_PARAMS, for the default index) next to the serving one and swaps it in atomically. Requests
+      already running finish on the old index, which is freed afterwards.
+
+    parameters:
+      - name: index
+        in: body
+        required: false
+        schema:
+          type: object
+          properties:
+            index:
+              type: string
+              description: Named index to reload from its registered files, defaults to 'default'.
+
+    responses:
+      200:
+        description: Index was swapped.
+      500:
+        description: Loading failed, the previous index keeps serving.
+    """
+    data = request.get_json(silent=True) or {}
+    name = data.get('index', DEFAULT_INDEX)
+    log.info('Reloading index {}'.format(name))
+    # only the configured files, the request never names paths to load
+    try:
+        if name == DEFAULT_INDEX:
+            reload_default()
+        else:
+            app.registry.reload(name.encode())
+    except IndexError:
+        return unknown_index(name)
+    except Exception as e:
+        log.exception('Failed to reload index {}'.format(name))
+        return jsonify({'error': str(e)}), 500
 
-    return jsonify(neighbors)
+    return jsonify({'index': name, 'size': app.registry.size(name.encode()), 'registry': app.registry.stats()})
 
 
 if __name__ == '__main__':
-    app.run(debug=False, host='0.0.0.0', port=5000)
+    app.run(debug=False, host='0.0.0.0', port=5000, threaded=True)
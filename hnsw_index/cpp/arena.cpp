@@ -0,0 +1,127 @@
+#include <cstdint>
+#include <new>
+#include <sys/mman.h>
+#include "arena.h"
+
+
+static bool huge_pages_enabled = false;
+
+void SetArenaHugePages(bool enabled) {
+    huge_pages_enabled = enabled;
+}
+
+
+ArenaResource::BlockResource::BlockResource(bool huge_pages) : huge_pages(huge_pages) {}
+
+ArenaResource::BlockResource::~BlockResource() {
+    for (const auto &block : blocks) {
+        munmap(block.first, block.second);
+    }
+    for (const auto &region : large) {
+        munmap(region.first, region.second);
+    }
+}
+
+void *ArenaResource::BlockResource::do_allocate(size_t bytes, size_t alignment) {
+    // big bucket arrays get their own mapping so a rehash gives the old one back to the OS
+    if (bytes > kBlockSize / 2) {
+        size_t size = (bytes + 4095) & ~static_cast<size_t>(4095);
+        char *region = MapRegion(size);
+        large[region] = size;
+        return region;
+    }
+
+    auto aligned = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(cursor) + alignment - 1) & ~(alignment - 1));
+    if (cursor == nullptr || aligned + bytes > end) {
+        cursor = MapRegion(kBlockSize);
+        end = cursor + kBlockSize;
+        blocks.emplace_back(cursor, kBlockSize);
+        aligned = cursor;
+    }
+
+    cursor = aligned + bytes;
+    return aligned;
+}
+
+void ArenaResource::BlockResource::do_deallocate(void *p, size_t, size_t) {
+    // small chunks are only released with the whole arena, the pool above reuses them
+    auto region = large.find(p);
+    if (region != large.end()) {
+        munmap(region->first, region->second);
+        reserved -= region->second;
+        large.erase(region);
+    }
+}
+
+bool ArenaResource::BlockResource::do_is_equal(const std::pmr::memory_resource &other) const noexcept {
+    return this == &other;
+}
+
+char *ArenaResource::BlockResource::MapRegion(size_t bytes) {
+    // over-map and trim so blocks start on a 2MB boundary and can be backed by huge pages
+    size_t mapped = bytes + kBlockSize;
+    void *raw = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+
+    char *start = static_cast<char*>(raw);
+    auto aligned = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(start) + kBlockSize - 1) & ~(kBlockSize - 1));
+    if (aligned > start) {
+        munmap(start, aligned - start);
+    }
+    char *tail = aligned + bytes;
+    if (start + mapped > tail) {
+        munmap(tail, start + mapped - tail);
+    }
+
+#ifdef MADV_HUGEPAGE
+    if (huge_pages) {
+        madvise(aligned, bytes, MADV_HUGEPAGE);
+    }
+#endif
+
+    reserved += bytes;
+    return aligned;
+}
+
+
+ArenaResource::ArenaResource() :
+    blocks(huge_pages_enabled),
+    pool(std::pmr::pool_options{0, kBlockSize / 2}, &blocks) {}
+
+size_t ArenaResource::Reserved() const {
+    return blocks.reserved;
+}
+
+size_t ArenaResource::Used() const {
+    return used;
+}
+
+void *ArenaResource::do_allocate(size_t bytes, size_t alignment) {
+    void *p = pool.allocate(bytes, alignment);
+    used += bytes;
+    return p;
+}
+
+void ArenaResource::do_deallocate(void *p, size_t bytes, size_t alignment) {
+    pool.deallocate(p, bytes, alignment);
+    used -= bytes;
+}
+
+bool ArenaResource::do_is_equal(const std::pmr::memory_resource &other) const noexcept {
+    return this == &other;
+}
+
+
+ArenaHandle::ArenaHandle() : arena(new ArenaResource()) {}
+
+ArenaHandle::ArenaHandle(const ArenaHandle&) : arena(new ArenaResource()) {}
+
+ArenaHandle& ArenaHandle::operator=(const ArenaHandle&) {
+    return *this;
+}
+
+ArenaResource *ArenaHandle::get() const {
+    return arena.get();
+}
@@ -0,0 +1,92 @@
+#ifndef HNSW_ARENA
+#define HNSW_ARENA
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+
+
+// Arenas created after this call back their blocks with transparent 2MB huge pages
+void SetArenaHugePages(bool enabled);
+
+
+// Memory resource for index structures: hash map nodes and buckets are pooled by size
+// inside large blocks instead of going to malloc one by one. Not thread-safe, like the
+// rest of the index it must not be modified concurrently.
+class ArenaResource : public std::pmr::memory_resource {
+    class BlockResource : public std::pmr::memory_resource {
+        bool huge_pages;
+        std::vector<std::pair<char*, size_t>> blocks;
+        std::unordered_map<void*, size_t> large;
+        char *cursor = nullptr;
+        char *end = nullptr;
+
+    public:
+        size_t reserved = 0;
+
+        explicit BlockResource(bool huge_pages);
+
+        ~BlockResource() override;
+
+    private:
+        void *do_allocate(size_t bytes, size_t alignment) override;
+
+        void do_deallocate(void *p, size_t bytes, size_t alignment) override;
+
+        bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+
+        char *MapRegion(size_t bytes);
+    };
+
+    BlockResource blocks;
+    std::pmr::unsynchronized_pool_resource pool;
+    size_t used = 0;
+
+public:
+    static constexpr size_t kBlockSize = 2 << 20;
+
+    ArenaResource();
+
+    ArenaResource(const ArenaResource&) = delete;
+
+    ArenaResource& operator=(const ArenaResource&) = delete;
+
+    // bytes mapped from the OS
+    size_t Reserved() const;
+
+    // bytes currently handed out to containers
+    size_t Used() const;
+
+private:
+    void *do_allocate(size_t bytes, size_t alignment) override;
+
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override;
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+};
+
+
+// Owning handle which keeps the arena in place when the owner is copied or assigned:
+// copies get a fresh arena, copy assignments keep their own one and the containers copy
+// their elements over, moving construction transfers the arena. There is no move assignment,
+// containers cannot follow an arena into an existing owner, see HNSW::operator=(HNSW&&).
+class ArenaHandle {
+    std::unique_ptr<ArenaResource> arena;
+
+public:
+    ArenaHandle();
+
+    ArenaHandle(const ArenaHandle&);
+
+    ArenaHandle(ArenaHandle&&) noexcept = default;
+
+    ArenaHandle& operator=(const ArenaHandle&);
+
+    ArenaHandle& operator=(ArenaHandle&&) = delete;
+
+    ArenaResource *get() const;
+};
+
+#endif // HNSW_ARENA
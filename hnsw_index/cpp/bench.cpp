@@ -0,0 +1,878 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <thread>
+#include <tuple>
+#include <unordered_set>
+
+#include <benchmark/benchmark.h>
+
+#include "hnsw.h"
+#include "dumps.h"
+#include "disk_index.h"
+#include "kernels.h"
+#include "graph_stats.h"
+#include "merge.h"
+#include "index_holder.h"
+#include "index_registry.h"
+#include "numa_replicas.h"
+#include "query_scheduler.h"
+#include "tests.h"
+
+
+// Microbenchmarks of the core kernels and index operations. Inputs come from fixed seeds, so
+// runs on different commits measure the same work; compare them through the JSON output:
+//   hnsw_bench --benchmark_out=bench.json --benchmark_out_format=json
+
+static const unsigned kSeed = 42;
+static const int kIndexSize = 10000;
+static const int kQueries = 256;
+
+
+// Uniform: points in a cube. Faces: unit vectors in clusters of 20, like FaceNet embeddings
+// with several images per identity.
+enum class Shape { Uniform, Faces };
+
+static const char *ShapeName(Shape shape) {
+    return shape == Shape::Uniform ? "uniform" : "faces";
+}
+
+static Storage GenerateData(Shape shape, int N, int dim, unsigned seed) {
+    SeedTestData(seed);
+    if (shape == Shape::Uniform) {
+        return GenerateNRandomVectors(N, dim, 0, 1, true);
+    }
+
+    std::vector<int> groups;
+    Storage vectors = GenerateGroupedVectors((N + 19) / 20, 20, dim, 0.3, groups);
+    vectors.resize(static_cast<size_t>(N));
+    for (Coords &coords : vectors) {
+        float norm = 0;
+        for (float v : coords) {
+            norm += v * v;
+        }
+        for (float &v : coords) {
+            v /= std::sqrt(norm);
+        }
+    }
+    return vectors;
+}
+
+// identity of every point of GenerateData(Shape::Faces, N, ...)
+static std::vector<int> FaceGroups(int N) {
+    std::vector<int> groups;
+    for (int i = 0; i < N; ++i) {
+        groups.push_back(i % ((N + 19) / 20));
+    }
+    return groups;
+}
+
+static HNSW BuildIndex(const Storage &data) {
+    HNSW hnsw(16, 32, 100, 0.5);
+    hnsw.SetSeed(kSeed);
+    hnsw.InsertBatch(data);
+    return hnsw;
+}
+
+// built once per shape and dimension, benchmarks only read them
+static HNSW& CachedIndex(Shape shape, int dim) {
+    static std::map<std::tuple<Shape, int>, HNSW> indexes;
+    auto key = std::make_tuple(shape, dim);
+    auto found = indexes.find(key);
+    if (found == indexes.end()) {
+        found = indexes.emplace(key, BuildIndex(GenerateData(shape, kIndexSize, dim, kSeed))).first;
+    }
+    return found->second;
+}
+
+static const Storage& CachedQueries(Shape shape, int dim) {
+    static std::map<std::tuple<Shape, int>, Storage> queries;
+    auto key = std::make_tuple(shape, dim);
+    auto found = queries.find(key);
+    if (found == queries.end()) {
+        found = queries.emplace(key, GenerateData(shape, kQueries, dim, kSeed + 1)).first;
+    }
+    return found->second;
+}
+
+// share of the exact K nearest neighbors of the cached queries that search(query) finds, for counters
+template<class Search>
+static double Recall(Shape shape, int K, Search search) {
+    static std::map<std::tuple<Shape, int>, std::vector<Points>> ground_truths;
+    const Storage &queries = CachedQueries(shape, 128);
+    auto key = std::make_tuple(shape, K);
+    auto truth = ground_truths.find(key);
+    if (truth == ground_truths.end()) {
+        std::vector<Points> exact;
+        for (const Coords &query : queries) {
+            exact.push_back(BruteForceKNN(CachedIndex(shape, 128).GetStorage(), query, K));
+        }
+        truth = ground_truths.emplace(key, std::move(exact)).first;
+    }
+
+    size_t found = 0;
+    for (size_t q = 0; q < queries.size(); ++q) {
+        for (Point p : search(queries[q])) {
+            found += std::count(truth->second[q].begin(), truth->second[q].end(), p);
+        }
+    }
+    return static_cast<double>(found) / (queries.size() * K);
+}
+
+
+struct BenchmarkAccess {
+    static LessDistanceQueue SearchLevel(const HNSW &hnsw, const float *query, const PointsSet &entry_points_set,
+                                         int ef, int level) {
+        return hnsw.SearchLevel(query, entry_points_set, ef, level);
+    }
+
+    // greedy descent to level 0, what KNNSearch does before the expansion loop
+    static PointsSet LevelZeroEntry(const HNSW &hnsw, const float *query) {
+        PointsSet entry_points_set{hnsw.entry_point};
+        for (int level = hnsw.max_level; level > 0; --level) {
+            entry_points_set = {hnsw.SearchLevel(query, entry_points_set, 1, level).top().id};
+        }
+        return entry_points_set;
+    }
+
+    static PointsSet SelectBestNeighbors(HNSW &hnsw, LessDistanceQueue &candidates, Point point, int M) {
+        return hnsw.SelectBestNeighbors(candidates, point, M, 0);
+    }
+};
+
+
+// Distance kernels: args are the dimension. Generic kernels take any length, the selected ones
+// are what an index of that dimension runs, unrolled for 128/256/512.
+template<ElementType type, bool selected>
+static void BM_L2Sqr(benchmark::State &state) {
+    auto dim = static_cast<size_t>(state.range(0));
+    const size_t vectors_num = 4096;
+    SeedTestData(kSeed);
+    Coords query = GenerateRandomVector(static_cast<int>(dim), 0, 1, true);
+    std::vector<float> floats;
+    std::vector<uint16_t> codes;
+    for (const Coords &coords : GenerateNRandomVectors(vectors_num, static_cast<int>(dim), 0, 1, true)) {
+        for (float v : coords) {
+            floats.push_back(v);
+            codes.push_back(type == ElementType::BFloat16 ? FloatToBFloat16(v) : FloatToHalf(v));
+        }
+    }
+
+    DistanceKernels kernels = selected ? SelectDistanceKernels(dim) : DistanceKernels();
+    size_t i = 0;
+    for (auto _ : state) {
+        size_t offset = (i++ % vectors_num) * dim;
+        float dist;
+        switch (type) {
+            case ElementType::Float16:
+                dist = kernels.float16(query.data(), codes.data() + offset, dim);
+                break;
+            case ElementType::BFloat16:
+                dist = kernels.bfloat16(query.data(), codes.data() + offset, dim);
+                break;
+            default:
+                dist = kernels.float32(query.data(), floats.data() + offset, dim);
+                break;
+        }
+        benchmark::DoNotOptimize(dist);
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * dim * (type == ElementType::Float32 ? 4 : 2));
+}
+
+#define DIMS ->Arg(64)->Arg(100)->Arg(128)->Arg(256)->Arg(512)->Arg(960)
+BENCHMARK_TEMPLATE(BM_L2Sqr, ElementType::Float32, false) DIMS;
+BENCHMARK_TEMPLATE(BM_L2Sqr, ElementType::Float32, true) DIMS;
+BENCHMARK_TEMPLATE(BM_L2Sqr, ElementType::Float16, false) DIMS;
+BENCHMARK_TEMPLATE(BM_L2Sqr, ElementType::Float16, true) DIMS;
+BENCHMARK_TEMPLATE(BM_L2Sqr, ElementType::BFloat16, false) DIMS;
+BENCHMARK_TEMPLATE(BM_L2Sqr, ElementType::BFloat16, true) DIMS;
+
+
+static void BM_ComputeDistance(benchmark::State &state) {
+    auto dim = static_cast<int>(state.range(0));
+    SeedTestData(kSeed);
+    Storage vectors = GenerateNRandomVectors(2, dim, 0, 1, true);
+    Distance distance(0, 0);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(distance.ComputeDistance(vectors[0], vectors[1]));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ComputeDistance) DIMS;
+
+
+// Layer-0 expansion loop alone, args are ef
+template<Shape shape>
+static void BM_SearchLevel(benchmark::State &state) {
+    const HNSW &hnsw = CachedIndex(shape, 128);
+    const Storage &queries = CachedQueries(shape, 128);
+    std::vector<PointsSet> entries;
+    for (const Coords &query : queries) {
+        entries.push_back(BenchmarkAccess::LevelZeroEntry(hnsw, query.data()));
+    }
+
+    auto ef = static_cast<int>(state.range(0));
+    size_t q = 0;
+    for (auto _ : state) {
+        size_t i = q++ % queries.size();
+        benchmark::DoNotOptimize(BenchmarkAccess::SearchLevel(hnsw, queries[i].data(), entries[i], ef, 0));
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(ShapeName(shape));
+}
+BENCHMARK_TEMPLATE(BM_SearchLevel, Shape::Uniform)->Arg(10)->Arg(50)->Arg(200);
+BENCHMARK_TEMPLATE(BM_SearchLevel, Shape::Faces)->Arg(10)->Arg(50)->Arg(200);
+
+
+// Neighbor selection heuristic over ef_construction candidates of an indexed point, args are M
+static void BM_SelectBestNeighbors(benchmark::State &state) {
+    HNSW &hnsw = CachedIndex(Shape::Faces, 128);
+    std::vector<LessDistanceQueue> candidates;
+    for (Point p = 0; p < kQueries; ++p) {
+        Coords coords = hnsw.DecodeCoords(p);
+        PointsSet entry = BenchmarkAccess::LevelZeroEntry(hnsw, coords.data());
+        candidates.push_back(BenchmarkAccess::SearchLevel(hnsw, coords.data(), entry, hnsw.GetEfConstruction(), 0));
+    }
+
+    auto M = static_cast<int>(state.range(0));
+    size_t q = 0;
+    for (auto _ : state) {
+        size_t i = q++ % candidates.size();
+        LessDistanceQueue queue = candidates[i];  // consumed by the selection, the copy is small next to it
+        benchmark::DoNotOptimize(BenchmarkAccess::SelectBestNeighbors(hnsw, queue, static_cast<Point>(i), M));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SelectBestNeighbors)->Arg(16)->Arg(32);
+
+
+// Full search of one query, args are K and ef
+template<Shape shape>
+static void BM_KNNSearch(benchmark::State &state) {
+    const HNSW &hnsw = CachedIndex(shape, 128);
+    const Storage &queries = CachedQueries(shape, 128);
+    auto K = static_cast<int>(state.range(0));
+    auto ef = static_cast<int>(state.range(1));
+    size_t q = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(hnsw.KNNSearch(queries[q++ % queries.size()], K, ef));
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(ShapeName(shape));
+}
+BENCHMARK_TEMPLATE(BM_KNNSearch, Shape::Uniform)->Args({1, 10})->Args({10, 10})->Args({10, 50})->Args({10, 200});
+BENCHMARK_TEMPLATE(BM_KNNSearch, Shape::Faces)->Args({1, 10})->Args({10, 10})->Args({10, 50})->Args({10, 200});
+
+
+// BM_KNNSearch of faces indexes built with other level seeds, args are the seed; the spread of
+// the results over seeds is the noise floor of comparisons between builds
+static void BM_KNNSearchSeeded(benchmark::State &state) {
+    HNSW hnsw(16, 32, 100, 0.5);
+    hnsw.SetSeed(static_cast<uint64_t>(state.range(0)));
+    hnsw.InsertBatch(GenerateData(Shape::Faces, kIndexSize, 128, kSeed));
+    const Storage &queries = CachedQueries(Shape::Faces, 128);
+    size_t q = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(hnsw.KNNSearch(queries[q++ % queries.size()], 10, 50));
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["recall"] = Recall(Shape::Faces, 10, [&](const Coords &query) { return hnsw.KNNSearch(query, 10, 50); });
+    state.counters["max_level"] = hnsw.GetMaxLevel();
+}
+BENCHMARK(BM_KNNSearchSeeded)->DenseRange(1, 3);
+
+
+// BM_KNNSearch on a copy storing vectors as type, args are K and ef; counters are the recall and
+// the bytes per point, measured and as estimated before a build
+template<ElementType type>
+static void BM_KNNSearchElementType(benchmark::State &state) {
+    static HNSW hnsw = [] {
+        HNSW converted = CachedIndex(Shape::Faces, 128);
+        converted.SetElementType(type);
+        return converted;
+    }();
+    const Storage &queries = CachedQueries(Shape::Faces, 128);
+    auto K = static_cast<int>(state.range(0));
+    auto ef = static_cast<int>(state.range(1));
+    size_t q = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(hnsw.KNNSearch(queries[q++ % queries.size()], K, ef));
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(ElementTypeToString(type));
+    state.counters["recall"] = Recall(Shape::Faces, K, [&](const Coords &query) { return hnsw.KNNSearch(query, K, ef); });
+    state.counters["vector_bytes_per_point"] = static_cast<double>(hnsw.MemoryUsage().storage) / hnsw.Size();
+    state.counters["bytes_per_point"] = static_cast<double>(hnsw.MemoryUsage().Total()) / hnsw.Size();
+    state.counters["estimated_bytes_per_point"] =
+        static_cast<double>(HNSW::EstimateMemoryUsage(hnsw.Size(), 128, 16, 32, 0.5, type).Total()) / hnsw.Size();
+}
+BENCHMARK_TEMPLATE(BM_KNNSearchElementType, ElementType::Float32)->Args({10, 50});
+BENCHMARK_TEMPLATE(BM_KNNSearchElementType, ElementType::Float16)->Args({10, 50});
+BENCHMARK_TEMPLATE(BM_KNNSearchElementType, ElementType::BFloat16)->Args({10, 50});
+
+
+// BM_KNNSearch on a copy with the compressed level 0, counters are the graph bytes per point
+template<Shape shape>
+static void BM_KNNSearchCompressed(benchmark::State &state) {
+    static HNSW hnsw = [] {
+        HNSW compressed = CachedIndex(shape, 128);
+        compressed.CompressGraph();
+        return compressed;
+    }();
+    const Storage &queries = CachedQueries(shape, 128);
+    auto K = static_cast<int>(state.range(0));
+    auto ef = static_cast<int>(state.range(1));
+    size_t q = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(hnsw.KNNSearch(queries[q++ % queries.size()], K, ef));
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(ShapeName(shape));
+    state.counters["level0_bytes_per_point"] = static_cast<double>(hnsw.MemoryUsage().graph_level_0) / hnsw.Size();
+    state.counters["hash_bytes_per_point"] =
+        static_cast<double>(CachedIndex(shape, 128).MemoryUsage().graph_level_0) / hnsw.Size();
+}
+BENCHMARK_TEMPLATE(BM_KNNSearchCompressed, Shape::Uniform)->Args({10, 10})->Args({10, 50})->Args({10, 200});
+BENCHMARK_TEMPLATE(BM_KNNSearchCompressed, Shape::Faces)->Args({10, 10})->Args({10, 50})->Args({10, 200});
+
+
+// CompressedGraph::Decode of every level 0 list of the faces index; items are decoded edges
+static void BM_CompressedGraphDecode(benchmark::State &state) {
+    static const CompressedGraph compressed(CachedIndex(Shape::Faces, 128).GetGraph().at(0), kIndexSize);
+    Points decoded;
+    size_t edges = 0;
+    for (auto _ : state) {
+        for (Point p = 0; p < kIndexSize; ++p) {
+            compressed.Decode(p, decoded);
+            edges += decoded.size();
+            benchmark::DoNotOptimize(decoded.data());
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(edges));
+    state.counters["bytes_per_point"] = static_cast<double>(compressed.Bytes()) / kIndexSize;
+}
+BENCHMARK(BM_CompressedGraphDecode);
+
+
+// BM_KNNSearch starting layer 0 from a routing table, args are K, ef and the number of probes;
+// counters are the recall and per query averages of AdaptiveKNNSearch without limits
+template<Shape shape>
+static void BM_KNNSearchRouted(benchmark::State &state) {
+    static HNSW hnsw = [] {
+        HNSW routed = CachedIndex(shape, 128);
+        routed.TrainRouting(64);
+        return routed;
+    }();
+    const Storage &queries = CachedQueries(shape, 128);
+    auto K = static_cast<int>(state.range(0));
+    auto ef = static_cast<int>(state.range(1));
+    hnsw.SetRoutingTable(RoutingTable(128, hnsw.GetRoutingTable().GetCentroids(), hnsw.GetRoutingTable().GetEntries(),
+                                      static_cast<int>(state.range(2))));
+    size_t q = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(hnsw.KNNSearch(queries[q++ % queries.size()], K, ef));
+    }
+
+    double hops = 0, distance_evals = 0;
+    for (const Coords &query : queries) {
+        SearchResult result = hnsw.AdaptiveKNNSearch(query, K, ef, SearchLimits());
+        hops += result.hops;
+        distance_evals += static_cast<double>(result.distance_evals);
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(ShapeName(shape));
+    state.counters["recall"] = Recall(shape, K, [&](const Coords &query) { return hnsw.KNNSearch(query, K, ef); });
+    state.counters["hops"] = hops / queries.size();
+    state.counters["distance_evals"] = distance_evals / queries.size();
+}
+BENCHMARK_TEMPLATE(BM_KNNSearchRouted, Shape::Uniform)->Args({10, 50, 1})->Args({10, 50, 4})->Args({10, 50, 8});
+BENCHMARK_TEMPLATE(BM_KNNSearchRouted, Shape::Faces)->Args({10, 50, 1})->Args({10, 50, 4})->Args({10, 50, 8});
+
+
+// TrainRouting on a copy of the faces index, args are the number of centroids
+static void BM_TrainRouting(benchmark::State &state) {
+    HNSW hnsw = CachedIndex(Shape::Faces, 128);
+    for (auto _ : state) {
+        hnsw.TrainRouting(static_cast<size_t>(state.range(0)));
+    }
+}
+BENCHMARK(BM_TrainRouting)->Arg(64)->Arg(256)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+
+// BM_KNNSearch on a copy with the query cache, args are K and ef. Hits search queries already
+// cached, misses clear the cache before each pass so every search runs and is stored.
+template<bool hit>
+static void BM_KNNSearchCached(benchmark::State &state) {
+    static HNSW hnsw = CachedIndex(Shape::Faces, 128);
+    const Storage &queries = CachedQueries(Shape::Faces, 128);
+    auto K = static_cast<int>(state.range(0));
+    auto ef = static_cast<int>(state.range(1));
+    hnsw.SetQueryCache(64 << 20);
+    if (hit) {
+        for (const Coords &query : queries) {
+            hnsw.KNNSearch(query, K, ef);
+        }
+    }
+    size_t q = 0;
+    for (auto _ : state) {
+        if (!hit && q % queries.size() == 0) {
+            state.PauseTiming();
+            hnsw.SetQueryCache(64 << 20);
+            state.ResumeTiming();
+        }
+        benchmark::DoNotOptimize(hnsw.KNNSearch(queries[q++ % queries.size()], K, ef));
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(hit ? "hit" : "miss");
+    state.counters["cache_bytes"] = static_cast<double>(hnsw.GetQueryCache().Bytes());
+}
+BENCHMARK_TEMPLATE(BM_KNNSearchCached, false)->Args({10, 50});
+BENCHMARK_TEMPLATE(BM_KNNSearchCached, true)->Args({10, 50});
+
+
+// BM_KNNSearch over 128-dimensional points near a rank 16 subspace, indexed as they are or in the
+// space of a PCA keeping 95% of the variance, optionally re-ranked exactly; args are K and ef,
+// counters are the recall and the vector bytes per point
+template<bool project, bool rerank>
+static void BM_KNNSearchProjected(benchmark::State &state) {
+    // one draw for points and queries, the subspace is random
+    static const Storage all = [] {
+        SeedTestData(kSeed);
+        return GenerateLowRankVectors(kIndexSize + kQueries, 128, 16, 0.05f);
+    }();
+    static const Storage data(all.begin(), all.begin() + kIndexSize);
+    static const Storage queries(all.begin() + kIndexSize, all.end());
+    static const HNSW hnsw = [] {
+        HNSW index(16, 32, 100, 0.5);
+        index.SetSeed(kSeed);
+        if (project) {
+            index.SetProjection(Projection::TrainPCA(data, 0.95f), rerank);
+        }
+        index.InsertBatch(data);
+        return index;
+    }();
+    auto K = static_cast<int>(state.range(0));
+    auto ef = static_cast<int>(state.range(1));
+    size_t q = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(hnsw.KNNSearch(queries[q++ % queries.size()], K, ef));
+    }
+
+    size_t found = 0;
+    for (const Coords &query : queries) {
+        Points exact = BruteForceKNN(data, query, K);
+        for (Point p : hnsw.KNNSearch(query, K, ef)) {
+            found += std::count(exact.begin(), exact.end(), p);
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(!project ? "full" : rerank ? "pca+rerank" : "pca");
+    state.counters["recall"] = static_cast<double>(found) / (queries.size() * K);
+    state.counters["dim"] = static_cast<double>(hnsw.GetDim());
+    state.counters["vector_bytes_per_point"] = static_cast<double>(hnsw.MemoryUsage().storage) / hnsw.Size();
+}
+BENCHMARK_TEMPLATE(BM_KNNSearchProjected, false, false)->Args({10, 50});
+BENCHMARK_TEMPLATE(BM_KNNSearchProjected, true, false)->Args({10, 50});
+BENCHMARK_TEMPLATE(BM_KNNSearchProjected, true, true)->Args({10, 50});
+
+
+// K distinct identities of the faces, args are K and ef. Grouped runs GroupedKNNSearch, where ef
+// counts groups; otherwise a plain search over-fetches ef points and keeps the first K groups.
+// The counter is the share of the exact K nearest groups found.
+template<bool grouped>
+static void BM_KNNSearchGroups(benchmark::State &state) {
+    static const std::vector<int> groups = FaceGroups(kIndexSize);
+    static HNSW hnsw = [] {
+        HNSW index = CachedIndex(Shape::Faces, 128);
+        index.SetGroups(groups);
+        return index;
+    }();
+    const Storage &queries = CachedQueries(Shape::Faces, 128);
+    auto K = static_cast<int>(state.range(0));
+    auto ef = static_cast<int>(state.range(1));
+    auto search = [&](const Coords &query) {
+        if (grouped) {
+            return hnsw.GroupedKNNSearch(query, K, ef);
+        }
+        Points best;
+        std::unordered_set<int> seen;
+        for (Point p : hnsw.KNNSearch(query, ef, ef)) {
+            if (best.size() < static_cast<size_t>(K) && seen.insert(groups[p]).second) {
+                best.push_back(p);
+            }
+        }
+        return best;
+    };
+    size_t q = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(search(queries[q++ % queries.size()]));
+    }
+
+    size_t matched = 0;
+    for (const Coords &query : queries) {
+        std::unordered_set<int> found_groups;
+        for (Point p : search(query)) {
+            found_groups.insert(groups[p]);
+        }
+        for (Point p : BruteForceGroupedKNN(hnsw.GetStorage(), groups, query, K)) {
+            matched += found_groups.count(groups[p]);
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(grouped ? "grouped" : "over-fetch");
+    state.counters["group_recall"] = static_cast<double>(matched) / (queries.size() * K);
+}
+BENCHMARK_TEMPLATE(BM_KNNSearchGroups, false)->Args({10, 50})->Args({10, 200});
+BENCHMARK_TEMPLATE(BM_KNNSearchGroups, true)->Args({10, 20})->Args({10, 50});
+
+
+// Batch of queries spread over threads like a batched service request, args are the thread
+// count (0 for every core); items are queries
+static void BM_KNNSearchBatch(benchmark::State &state) {
+    const HNSW &hnsw = CachedIndex(Shape::Faces, 128);
+    const Storage &queries = CachedQueries(Shape::Faces, 128);
+    auto threads_num = static_cast<int>(state.range(0));
+    std::vector<Points> results(queries.size());
+    for (auto _ : state) {
+        ParallelFor(queries.size(), threads_num, [&](size_t begin, size_t end) {
+            for (size_t q = begin; q < end; ++q) {
+                results[q] = hnsw.KNNSearch(queries[q], 10, 50);
+            }
+        });
+        benchmark::DoNotOptimize(results.data());
+    }
+    state.SetItemsProcessed(state.iterations() * queries.size());
+}
+BENCHMARK(BM_KNNSearchBatch)->Arg(1)->Arg(0)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+
+// The same queries through HNSW::BatchKNNSearch in chunks, args are the chunk size; items are queries
+static void BM_BatchKNNSearch(benchmark::State &state) {
+    const HNSW &hnsw = CachedIndex(Shape::Faces, 128);
+    const Storage &queries = CachedQueries(Shape::Faces, 128);
+    auto chunk = static_cast<size_t>(state.range(0));
+    std::vector<BatchQuery> batch;
+    for (auto _ : state) {
+        for (size_t begin = 0; begin < queries.size(); begin += chunk) {
+            batch.clear();
+            for (size_t q = begin; q < std::min(queries.size(), begin + chunk); ++q) {
+                batch.push_back({queries[q].data(), 10, 50});
+            }
+            benchmark::DoNotOptimize(hnsw.BatchKNNSearch(batch));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * queries.size());
+}
+BENCHMARK(BM_BatchKNNSearch)->Arg(1)->Arg(16)->Arg(64)->Unit(benchmark::kMillisecond);
+
+
+// AnalyzeGraph of the whole index, args are the thread count (0 for every core); items are points,
+// counters are level 0 shares of reachable points and of edges without a reverse edge
+static void BM_AnalyzeGraph(benchmark::State &state) {
+    const HNSW &hnsw = CachedIndex(Shape::Faces, 128);
+    auto threads_num = static_cast<int>(state.range(0));
+    std::vector<LevelStats> report;
+    for (auto _ : state) {
+        report = AnalyzeGraph(hnsw, threads_num);
+        benchmark::DoNotOptimize(report.data());
+    }
+    state.SetItemsProcessed(state.iterations() * hnsw.Size());
+    state.counters["reachable"] = static_cast<double>(report[0].reachable) / hnsw.Size();
+    state.counters["asymmetric_edges"] = static_cast<double>(report[0].asymmetric_edges) / report[0].edges;
+}
+BENCHMARK(BM_AnalyzeGraph)->Arg(1)->Arg(0)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+
+// Clients sending one query at a time and waiting for it, each thread is a client. Args are the
+// batching window of a QueryScheduler in microseconds, -1 searches the holder's index directly,
+// and how many distinct queries the clients send: all cached ones, or a hot set that repeats
+// within a batch, as popular lookups of a service do, and is searched once per batch. Items are
+// queries, the counter is the batch size the scheduler reached.
+static void BM_QueryScheduler(benchmark::State &state) {
+    static std::unique_ptr<IndexHolder> holder;
+    static std::unique_ptr<QueryScheduler> scheduler;
+    const Storage &queries = CachedQueries(Shape::Faces, 128);
+    long window_us = state.range(0);
+    auto distinct = std::min(queries.size(), static_cast<size_t>(state.range(1)));
+    if (state.thread_index() == 0) {
+        holder.reset(new IndexHolder(CachedIndex(Shape::Faces, 128)));
+        if (window_us >= 0) {
+            SchedulerOptions options;
+            options.window_us = window_us;
+            scheduler.reset(new QueryScheduler(*holder, options));
+        }
+    }
+    size_t q = static_cast<size_t>(state.thread_index());
+    for (auto _ : state) {
+        const Coords &query = queries[q % distinct];
+        q += static_cast<size_t>(state.threads());
+        if (scheduler) {
+            benchmark::DoNotOptimize(scheduler->Submit(query, 10, 50).get());
+        } else {
+            benchmark::DoNotOptimize(holder->Get()->KNNSearch(query, 10, 50));
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) {
+        if (scheduler) {
+            state.counters["queries_per_batch"] =
+                static_cast<double>(scheduler->GetQueries()) / std::max(1L, scheduler->GetBatches());
+        }
+        scheduler.reset();
+        holder.reset();
+    }
+}
+BENCHMARK(BM_QueryScheduler)->ArgsProduct({{-1, 0, 50, 200}, {kQueries, 16}})->Threads(8)->Threads(32)
+    ->UseRealTime();
+
+
+// Clients, one per thread, sending single queries to four snapshots of the faces index in turn
+// through an IndexRegistry; args are its memory budget in indexes (0 for unlimited), items are
+// queries, counters are the loads and evictions per query the budget caused
+static void BM_IndexRegistry(benchmark::State &state) {
+    static const int indexes_num = 4;
+    static std::unique_ptr<IndexRegistry> registry;
+    const Storage &queries = CachedQueries(Shape::Faces, 128);
+    if (state.thread_index() == 0) {
+        const HNSW &hnsw = CachedIndex(Shape::Faces, 128);
+        RegistryOptions options;
+        options.memory_budget = static_cast<size_t>(state.range(0)) * hnsw.MemoryUsage().Total() * 11 / 10;
+        registry.reset(new IndexRegistry(options));
+        for (int i = 0; i < indexes_num; ++i) {
+            std::string file = "bench-registry-" + std::to_string(i) + ".tmp";
+            DumpHNSWSnapshot(file, hnsw);
+            registry->Register(std::to_string(i), file);
+        }
+    }
+    size_t q = static_cast<size_t>(state.thread_index());
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(registry->Search(std::to_string(q % indexes_num), queries[q % queries.size()].data(),
+                                                  1, 128, 10, 50));
+        q += static_cast<size_t>(state.threads());
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) {
+        double queries_num = static_cast<double>(registry->GetScheduler().GetQueries());
+        state.counters["loads_per_query"] = registry->GetLoads() / queries_num;
+        state.counters["evictions_per_query"] = registry->GetEvictions() / queries_num;
+        registry.reset();
+        for (int i = 0; i < indexes_num; ++i) {
+            std::remove(("bench-registry-" + std::to_string(i) + ".tmp").c_str());
+        }
+    }
+}
+BENCHMARK(BM_IndexRegistry)->Arg(0)->Arg(2)->Threads(8)->UseRealTime();
+
+
+// Every cpu of the first nodes searches the queries once from the copy its NumaReplicas gives its
+// node, threads pinned to their nodes; args are the number of nodes (0 for all), items are queries.
+// Without a placement the single copy is built on the first node, as by a loader thread there.
+template<NumaPlacement placement>
+static void BM_NumaReplicas(benchmark::State &state) {
+    const HNSW &hnsw = CachedIndex(Shape::Faces, 128);
+    const Storage &queries = CachedQueries(Shape::Faces, 128);
+    std::vector<NumaNode> nodes = NumaTopology();
+    auto nodes_num = static_cast<int>(state.range(0) > 0 ? std::min<size_t>(state.range(0), nodes.size()) : nodes.size());
+    std::unique_ptr<NumaReplicas> replicas;
+    std::thread([&]() {
+        PinThreadToNode(nodes[0]);
+        replicas.reset(new NumaReplicas(hnsw, placement, nodes_num));
+    }).join();
+
+    size_t threads_num = 0;
+    for (auto _ : state) {
+        std::vector<std::thread> threads;
+        for (int node = 0; node < nodes_num; ++node) {
+            for (size_t c = 0; c < nodes[node].cpus.size(); ++c) {
+                threads.emplace_back([&, node]() {
+                    PinThreadToNode(nodes[node]);
+                    const HNSW &local = replicas->Replica(node);
+                    for (const Coords &query : queries) {
+                        benchmark::DoNotOptimize(local.KNNSearch(query, 10, 50));
+                    }
+                });
+            }
+        }
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+        threads_num = threads.size();
+    }
+    state.SetItemsProcessed(state.iterations() * threads_num * queries.size());
+    state.SetLabel(NumaPlacementToString(placement));
+    state.counters["nodes"] = nodes_num;
+    state.counters["threads"] = static_cast<double>(threads_num);
+}
+BENCHMARK_TEMPLATE(BM_NumaReplicas, NumaPlacement::None)->Arg(1)->Arg(0)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_NumaReplicas, NumaPlacement::Replicate)->Arg(1)->Arg(0)->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_NumaReplicas, NumaPlacement::Interleave)->Arg(1)->Arg(0)->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+
+// Index build from scratch, args are the number of points; items are inserted points
+template<Shape shape>
+static void BM_InsertBatch(benchmark::State &state) {
+    auto N = static_cast<int>(state.range(0));
+    Storage data = GenerateData(shape, N, 128, kSeed);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(BuildIndex(data));
+    }
+    state.SetItemsProcessed(state.iterations() * N);
+    state.SetLabel(ShapeName(shape));
+}
+BENCHMARK_TEMPLATE(BM_InsertBatch, Shape::Uniform)->Arg(1000)->Arg(5000)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_InsertBatch, Shape::Faces)->Arg(1000)->Arg(5000)->Unit(benchmark::kMillisecond);
+
+
+// Build of the cached index's points as parts on every core merged with MergeHNSW, args are the
+// number of parts; items are points, the counter is the recall of the merged index at K 10, ef 50
+template<Shape shape>
+static void BM_BuildPartitioned(benchmark::State &state) {
+    Storage data = GenerateData(shape, kIndexSize, 128, kSeed);
+    auto parts_num = static_cast<int>(state.range(0));
+    HNSW merged;
+    for (auto _ : state) {
+        merged = BuildPartitioned(data, parts_num, 16, 32, 100, 0.5, 0, kSeed);
+    }
+    state.SetItemsProcessed(state.iterations() * kIndexSize);
+    state.SetLabel(ShapeName(shape));
+    state.counters["recall"] = Recall(shape, 10, [&](const Coords &query) { return merged.KNNSearch(query, 10, 50); });
+}
+BENCHMARK_TEMPLATE(BM_BuildPartitioned, Shape::Uniform)->Arg(1)->Arg(4)->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_BuildPartitioned, Shape::Faces)->Arg(1)->Arg(4)->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+
+// Dump and load of each file format, bytes are the written files
+enum class Format { Text, Snapshot, DiskLayout };
+
+static int64_t FileBytes(const std::string &file) {
+    std::ifstream istrm(file, std::ios::binary | std::ios::ate);
+    return istrm ? static_cast<int64_t>(istrm.tellg()) : 0;
+}
+
+static const char *kStorageFile = "bench-storage.tmp";
+static const char *kParamsFile = "bench-params.tmp";
+static const char *kSnapshotFile = "bench-snapshot.tmp";
+static const char *kDiskFile = "bench-disk.tmp";
+
+static int64_t Dump(Format format, const HNSW &hnsw) {
+    switch (format) {
+        case Format::Text:
+            DumpHNSWToFile(kStorageFile, kParamsFile, hnsw, true);
+            return FileBytes(kStorageFile) + FileBytes(kParamsFile);
+        case Format::Snapshot:
+            DumpHNSWSnapshot(kSnapshotFile, hnsw);
+            return FileBytes(kSnapshotFile);
+        default:
+            DumpDiskLayout(kDiskFile, hnsw);
+            return FileBytes(kDiskFile);
+    }
+}
+
+static void RemoveDumps() {
+    for (const char *file : {kStorageFile, kParamsFile, kSnapshotFile, kDiskFile}) {
+        std::remove(file);
+    }
+}
+
+template<Format format>
+static void BM_Dump(benchmark::State &state) {
+    const HNSW &hnsw = CachedIndex(Shape::Faces, 128);
+    int64_t bytes = 0;
+    for (auto _ : state) {
+        bytes = Dump(format, hnsw);
+    }
+    state.SetBytesProcessed(state.iterations() * bytes);
+    RemoveDumps();
+}
+BENCHMARK_TEMPLATE(BM_Dump, Format::Text)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Dump, Format::Snapshot)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Dump, Format::DiskLayout)->Unit(benchmark::kMillisecond);
+
+// the disk layout is opened as a DiskIndex, which also reads the text params for navigation
+template<Format format>
+static void BM_Load(benchmark::State &state) {
+    const HNSW &hnsw = CachedIndex(Shape::Faces, 128);
+    if (format == Format::DiskLayout) {
+        Dump(Format::Text, hnsw);
+    }
+    int64_t bytes = Dump(format, hnsw);
+    for (auto _ : state) {
+        switch (format) {
+            case Format::Text:
+                benchmark::DoNotOptimize(ReadHNSWFromFile(kStorageFile, kParamsFile));
+                break;
+            case Format::Snapshot:
+                benchmark::DoNotOptimize(ReadHNSWSnapshot(kSnapshotFile));
+                break;
+            case Format::DiskLayout: {
+                DiskIndex index(kDiskFile, kParamsFile);
+                benchmark::DoNotOptimize(index.GetNavigationIndex().Size());
+                break;
+            }
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * bytes);
+    RemoveDumps();
+}
+BENCHMARK_TEMPLATE(BM_Load, Format::Text)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Load, Format::Snapshot)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Load, Format::DiskLayout)->Unit(benchmark::kMillisecond);
+
+// text dumps through the stream reader of dumps.h (arg -1) or the parallel loader, args are its
+// thread count (0 for every core)
+static void BM_LoadText(benchmark::State &state) {
+    int64_t bytes = Dump(Format::Text, CachedIndex(Shape::Faces, 128));
+    auto threads_num = static_cast<int>(state.range(0));
+    for (auto _ : state) {
+        if (threads_num < 0) {
+            std::ifstream storage_istrm(kStorageFile, std::ios::binary);
+            Storage storage = ReadStorageFromDump(storage_istrm);
+            std::ifstream params_istrm(kParamsFile, std::ios::binary);
+            benchmark::DoNotOptimize(ReadHNSWParamsFromDump(params_istrm, storage));
+        } else {
+            benchmark::DoNotOptimize(ReadHNSWFromFile(kStorageFile, kParamsFile, threads_num));
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * bytes);
+    RemoveDumps();
+}
+BENCHMARK(BM_LoadText)->Arg(-1)->Arg(1)->Arg(0)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+
+// Search of a DiskIndex with fp16 navigation over the disk layout, args are K, ef and the cached
+// blocks; counters are the recall, the I/O per query and the memory of the navigation index
+static void BM_DiskKNNSearch(benchmark::State &state) {
+    const HNSW &hnsw = CachedIndex(Shape::Faces, 128);
+    Dump(Format::Text, hnsw);
+    Dump(Format::DiskLayout, hnsw);
+    const Storage &queries = CachedQueries(Shape::Faces, 128);
+    auto K = static_cast<int>(state.range(0));
+    auto ef = static_cast<int>(state.range(1));
+    DiskIndex disk(kDiskFile, kParamsFile, ElementType::Float16, static_cast<size_t>(state.range(2)));
+    size_t q = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(disk.KNNSearch(queries[q++ % queries.size()], K, ef));
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.counters["blocks_per_query"] = static_cast<double>(disk.GetBlocksRead()) / disk.GetQueries();
+    state.counters["reads_per_query"] = static_cast<double>(disk.GetReadCalls()) / disk.GetQueries();
+    state.counters["cache_hit_rate"] =
+        static_cast<double>(disk.GetCacheHits()) / std::max(1L, disk.GetCacheHits() + disk.GetBlocksRead());
+    state.counters["navigation_bytes"] = static_cast<double>(disk.GetNavigationIndex().MemoryUsage().Total());
+    state.counters["recall"] = Recall(Shape::Faces, K, [&](const Coords &query) {
+        return disk.KNNSearch(query, K, ef).points;
+    });
+    RemoveDumps();
+}
+BENCHMARK(BM_DiskKNNSearch)->Args({10, 50, 0})->Args({10, 50, kIndexSize / 8});
+
+
+BENCHMARK_MAIN();
@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <immintrin.h>
+
+#include "compressed_graph.h"
+
+
+// one 16-byte load per group of gaps may reach this far past the last list
+static const size_t kPadding = sizeof(__m128i);
+static const size_t kLanes = 4;
+// a gap shifted by up to 7 bits still fits the 4 bytes of its lane
+static const int kMaxLaneBits = 25;
+
+
+static void WriteVarint(std::vector<uint8_t> &out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+
+static uint32_t ReadVarint(const uint8_t *&pos) {
+    uint32_t value = 0;
+    for (int shift = 0; ; shift += 7) {
+        uint8_t byte = *pos++;
+        value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+        if (byte < 0x80) return value;
+    }
+}
+
+
+// gather bytes and shift of every lane for a group of gaps of a width starting at a bit of its
+// first byte
+struct LanePattern {
+    alignas(16) uint8_t bytes[16];
+    alignas(16) uint32_t shifts[kLanes];
+};
+
+
+static std::vector<LanePattern> MakeLanePatterns() {
+    std::vector<LanePattern> patterns((kMaxLaneBits + 1) * 8);
+    for (int bits = 1; bits <= kMaxLaneBits; ++bits) {
+        for (int start = 0; start < 8; ++start) {
+            LanePattern &pattern = patterns[bits * 8 + start];
+            for (size_t lane = 0; lane < kLanes; ++lane) {
+                size_t bit = start + lane * bits;
+                for (size_t byte = 0; byte < 4; ++byte) {
+                    pattern.bytes[lane * 4 + byte] = static_cast<uint8_t>(bit / 8 + byte);
+                }
+                pattern.shifts[lane] = static_cast<uint32_t>(bit % 8);
+            }
+        }
+    }
+    return patterns;
+}
+
+
+static const std::vector<LanePattern> lane_patterns = MakeLanePatterns();
+
+
+static bool DetectLaneUnpack() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+
+static const bool lane_unpack = DetectLaneUnpack();
+
+
+static void UnpackGaps(const uint8_t *gaps, int bits, size_t count, uint32_t id, Point *out) {
+    // gaps are at most 32 bits wide, so one unaligned 8-byte load always holds a whole gap
+    uint64_t mask = (uint64_t(1) << bits) - 1;
+    size_t bit = 0;
+    for (size_t i = 0; i < count; ++i, bit += bits) {
+        uint64_t word;
+        std::memcpy(&word, gaps + bit / 8, sizeof(word));
+        id += static_cast<uint32_t>((word >> (bit & 7)) & mask);
+        out[i] = static_cast<Point>(id);
+    }
+}
+
+
+// four gaps a step: gather the bytes of each lane, shift and mask them, then a prefix sum across
+// the lanes on top of the last id. Stores whole groups, count rounded up to kLanes.
+__attribute__((target("avx2")))
+static void UnpackGapsAVX2(const uint8_t *gaps, int bits, size_t count, uint32_t id, Point *out) {
+    const __m128i mask = _mm_set1_epi32(static_cast<int>((1u << bits) - 1));
+    __m128i last = _mm_set1_epi32(static_cast<int>(id));
+    size_t bit = 0;
+    for (size_t i = 0; i < count; i += kLanes, bit += kLanes * bits) {
+        const LanePattern &pattern = lane_patterns[bits * 8 + bit % 8];
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(gaps + bit / 8));
+        __m128i values = _mm_shuffle_epi8(bytes, _mm_load_si128(reinterpret_cast<const __m128i*>(pattern.bytes)));
+        values = _mm_srlv_epi32(values, _mm_load_si128(reinterpret_cast<const __m128i*>(pattern.shifts)));
+        values = _mm_and_si128(values, mask);
+        values = _mm_add_epi32(values, _mm_slli_si128(values, 4));
+        values = _mm_add_epi32(values, _mm_slli_si128(values, 8));
+        last = _mm_add_epi32(values, last);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), last);
+        last = _mm_shuffle_epi32(last, 0xff);
+    }
+}
+
+
+CompressedGraph::CompressedGraph(const HNSWGraph::mapped_type &level, size_t points_num) {
+    offsets.reserve(points_num + 1);
+    std::vector<uint32_t> ids;
+    for (size_t p = 0; p < points_num; ++p) {
+        if (data.size() > UINT32_MAX) {
+            throw std::length_error("compressed graph exceeds its offset range");
+        }
+        offsets.push_back(static_cast<uint32_t>(data.size()));
+        auto edges = level.find(static_cast<Point>(p));
+        if (edges == level.end() || edges->second.empty()) continue;
+
+        ids.assign(edges->second.begin(), edges->second.end());
+        std::sort(ids.begin(), ids.end());
+        uint32_t max_gap = 1;
+        for (size_t i = 1; i < ids.size(); ++i) {
+            max_gap = std::max(max_gap, ids[i] - ids[i - 1]);
+        }
+        int bits = 32 - __builtin_clz(max_gap);
+
+        data.push_back(static_cast<uint8_t>(bits));
+        WriteVarint(data, static_cast<uint32_t>(ids.size()));
+        WriteVarint(data, ids[0]);
+
+        size_t start = data.size();
+        data.resize(start + ((ids.size() - 1) * bits + 7) / 8, 0);
+        size_t bit = 0;
+        for (size_t i = 1; i < ids.size(); ++i, bit += bits) {
+            uint64_t gap = static_cast<uint64_t>(ids[i] - ids[i - 1]) << (bit & 7);
+            for (size_t byte = start + bit / 8; gap != 0; ++byte, gap >>= 8) {
+                data[byte] |= static_cast<uint8_t>(gap);
+            }
+        }
+    }
+    if (data.size() > UINT32_MAX) {
+        throw std::length_error("compressed graph exceeds its offset range");
+    }
+    offsets.push_back(static_cast<uint32_t>(data.size()));
+    data.resize(data.size() + kPadding, 0);
+}
+
+CompressedGraph::CompressedGraph(std::vector<uint32_t> offsets, std::vector<uint8_t> data) :
+    offsets(std::move(offsets)),
+    data(std::move(data)) {
+    if (this->offsets.empty() || this->offsets.back() + kPadding != this->data.size() ||
+        !std::is_sorted(this->offsets.begin(), this->offsets.end())) {
+        throw std::runtime_error("corrupt compressed graph");
+    }
+}
+
+bool CompressedGraph::Empty() const {
+    return offsets.empty();
+}
+
+size_t CompressedGraph::PointsNum() const {
+    return offsets.empty() ? 0 : offsets.size() - 1;
+}
+
+void CompressedGraph::Decode(Point point, Points &out) const {
+    out.clear();
+    auto p = static_cast<size_t>(point);
+    if (point < 0 || p + 1 >= offsets.size() || offsets[p] == offsets[p + 1]) return;
+
+    const uint8_t *pos = data.data() + offsets[p];
+    int bits = *pos++;
+    uint32_t count = ReadVarint(pos);
+    uint32_t id = ReadVarint(pos);
+    size_t gaps = count - 1;
+    bool lanes = lane_unpack && bits <= kMaxLaneBits;
+    // the lanes store whole groups, the ids past count are cut off below
+    out.resize(1 + (lanes ? (gaps + kLanes - 1) / kLanes * kLanes : gaps));
+    out[0] = static_cast<Point>(id);
+    if (lanes) {
+        UnpackGapsAVX2(pos, bits, gaps, id, out.data() + 1);
+    } else {
+        UnpackGaps(pos, bits, gaps, id, out.data() + 1);
+    }
+    out.resize(count);
+}
+
+void CompressedGraph::Decompress(HNSWGraph::mapped_type &level) const {
+    Points edges;
+    for (size_t p = 0; p < PointsNum(); ++p) {
+        Decode(static_cast<Point>(p), edges);
+        if (!edges.empty()) {
+            level[static_cast<Point>(p)].insert(edges.begin(), edges.end());
+        }
+    }
+}
+
+size_t CompressedGraph::Bytes() const {
+    return offsets.capacity() * sizeof(uint32_t) + data.capacity();
+}
+
+const std::vector<uint32_t>& CompressedGraph::GetOffsets() const {
+    return offsets;
+}
+
+const std::vector<uint8_t>& CompressedGraph::GetData() const {
+    return data;
+}
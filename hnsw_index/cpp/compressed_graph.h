@@ -0,0 +1,44 @@
+#ifndef HNSW_COMPRESSED_GRAPH
+#define HNSW_COMPRESSED_GRAPH
+
+#include <cstdint>
+#include <vector>
+
+#include "types.h"
+
+
+// Read-only neighbor lists of one graph level, indexed by point. A list is sorted and stored as
+// its length and first id in varints, then the gaps to the next ids bit-packed with one width
+// per list: a few bits per edge in dense graphs instead of a hash node each. Decode unpacks four
+// gaps per step with AVX2 where the CPU has it.
+class CompressedGraph {
+    std::vector<uint32_t> offsets;   // byte offset of every point's list, one more for the end
+    std::vector<uint8_t> data;       // lists, followed by padding for the 16-byte loads of Decode
+
+public:
+    CompressedGraph() = default;
+
+    CompressedGraph(const HNSWGraph::mapped_type &level, size_t points_num);
+
+    // arrays as returned by GetOffsets and GetData, e.g. from a snapshot
+    CompressedGraph(std::vector<uint32_t> offsets, std::vector<uint8_t> data);
+
+    bool Empty() const;
+
+    // points with a list slot, lists of points without edges are empty
+    size_t PointsNum() const;
+
+    // replaces out with the neighbors of point, ascending
+    void Decode(Point point, Points &out) const;
+
+    // adds every non-empty list to level
+    void Decompress(HNSWGraph::mapped_type &level) const;
+
+    size_t Bytes() const;
+
+    const std::vector<uint32_t>& GetOffsets() const;
+
+    const std::vector<uint8_t>& GetData() const;
+};
+
+#endif // HNSW_COMPRESSED_GRAPH
@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "dumps.h"
+#include "disk_index.h"
+
+
+DiskLayoutHeader::DiskLayoutHeader() = default;
+
+DiskLayoutHeader::DiskLayoutHeader(size_t points_num, size_t dim, int max_neighbors_0) :
+    dim(static_cast<uint32_t>(dim)),
+    points_num(points_num),
+    max_neighbors_0(static_cast<uint32_t>(max_neighbors_0)),
+    node_size(static_cast<uint32_t>(dim * sizeof(float) + sizeof(uint32_t) + max_neighbors_0 * sizeof(Point))) {}
+
+bool DiskLayoutHeader::Valid() const {
+    return std::memcmp(magic, "HNSWDISK", sizeof(magic)) == 0 && version == 1 && node_size > 0;
+}
+
+size_t DiskLayoutHeader::NodesPerBlock() const {
+    return node_size <= kBlockSize ? kBlockSize / node_size : 0;
+}
+
+size_t DiskLayoutHeader::BlocksPerNode() const {
+    return (node_size + kBlockSize - 1) / kBlockSize;
+}
+
+uint64_t DiskLayoutHeader::NodeOffset(Point point) const {
+    auto p = static_cast<uint64_t>(point);
+    size_t per_block = NodesPerBlock();
+    if (per_block > 0) {
+        return (1 + p / per_block) * kBlockSize + (p % per_block) * node_size;
+    }
+    return (1 + p * BlocksPerNode()) * kBlockSize;
+}
+
+
+static void ReadExactly(int fd, char *buffer, size_t size, uint64_t offset) {
+    while (size > 0) {
+        ssize_t done = pread(fd, buffer, size, static_cast<off_t>(offset));
+        if (done <= 0) {
+            throw std::runtime_error("failed to read disk index");
+        }
+        buffer += done;
+        size -= static_cast<size_t>(done);
+        offset += static_cast<uint64_t>(done);
+    }
+}
+
+
+FileDescriptor::FileDescriptor(int fd) : fd(fd) {}
+
+FileDescriptor::~FileDescriptor() {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+int FileDescriptor::Get() const {
+    return fd;
+}
+
+
+DiskIndex::DiskIndex(const std::string &disk_file, const std::string &index_file,
+                     ElementType navigation_type, size_t cache_blocks) :
+    fd(open(disk_file.c_str(), O_RDONLY)),
+    cache_capacity(cache_blocks) {
+    if (fd.Get() < 0) {
+        throw std::runtime_error("cannot open disk index " + disk_file);
+    }
+    ReadExactly(fd.Get(), reinterpret_cast<char*>(&header), sizeof(header), 0);
+    if (!header.Valid()) {
+        throw std::runtime_error("not a disk index: " + disk_file);
+    }
+
+    navigation = ReadHNSWParamsFromFile(index_file);
+    navigation.SetElementType(navigation_type);
+    if (navigation.GetRerank()) {
+        // full precision vectors stay on disk, re-ranking reads them from there
+        navigation.SetProjection(navigation.GetProjection(), false);
+    }
+
+    // stream full precision vectors once in large sequential reads, keep only their compressed codes
+    const uint64_t batch_nodes = 4096;
+    std::vector<char> chunk;
+    for (uint64_t first = 0; first < header.points_num; first += batch_nodes) {
+        uint64_t last = std::min(first + batch_nodes, header.points_num) - 1;
+        uint64_t begin = header.NodeOffset(static_cast<Point>(first));
+        chunk.resize(header.NodeOffset(static_cast<Point>(last)) + header.node_size - begin);
+        ReadExactly(fd.Get(), chunk.data(), chunk.size(), begin);
+
+        Storage batch(last - first + 1, Coords(header.dim));
+        for (uint64_t p = first; p <= last; ++p) {
+            const char *node = chunk.data() + (header.NodeOffset(static_cast<Point>(p)) - begin);
+            std::memcpy(batch[p - first].data(), node, header.dim * sizeof(float));
+        }
+        navigation.AppendStorage(batch);
+    }
+
+#ifdef POSIX_FADV_RANDOM
+    posix_fadvise(fd.Get(), 0, 0, POSIX_FADV_RANDOM);
+#endif
+}
+
+DiskSearchResult DiskIndex::KNNSearch(const Coords &query, int K, int ef, int rerank) {
+    if (query.size() != header.dim) {
+        throw std::invalid_argument("query dimension does not match the disk index");
+    }
+    DiskSearchResult result;
+    if (rerank <= 0) {
+        rerank = ef;
+    }
+    Points candidates = navigation.KNNSearch(query, rerank, ef);
+
+    std::vector<uint64_t> needed;
+    for (Point p : candidates) {
+        uint64_t first = header.NodeOffset(p) / DiskLayoutHeader::kBlockSize;
+        uint64_t last = (header.NodeOffset(p) + header.node_size - 1) / DiskLayoutHeader::kBlockSize;
+        for (uint64_t b = first; b <= last; ++b) {
+            needed.push_back(b);
+        }
+    }
+    std::sort(needed.begin(), needed.end());
+    needed.erase(std::unique(needed.begin(), needed.end()), needed.end());
+
+    std::unordered_map<uint64_t, std::vector<char>> blocks;
+    ReadBlocks(needed, blocks, result);
+
+    std::vector<Distance> distances;
+    Coords coords(header.dim);
+    for (Point p : candidates) {
+        // copy the vector out block by block, it may cross a block boundary for large nodes
+        uint64_t offset = header.NodeOffset(p);
+        auto dst = reinterpret_cast<char*>(coords.data());
+        size_t left = header.dim * sizeof(float);
+        while (left > 0) {
+            uint64_t block = offset / DiskLayoutHeader::kBlockSize;
+            size_t in_block = offset % DiskLayoutHeader::kBlockSize;
+            size_t chunk = std::min(left, DiskLayoutHeader::kBlockSize - in_block);
+            std::memcpy(dst, blocks[block].data() + in_block, chunk);
+            dst += chunk;
+            offset += chunk;
+            left -= chunk;
+        }
+        distances.emplace_back(p, query, coords);
+    }
+
+    size_t top = std::min(distances.size(), static_cast<size_t>(K));
+    std::partial_sort(distances.begin(), distances.begin() + top, distances.end());
+    for (size_t i = 0; i < top; ++i) {
+        result.points.push_back(distances[i].id);
+    }
+
+    ++total_queries;
+    total_blocks_read += result.blocks_read;
+    total_read_calls += result.read_calls;
+    total_cache_hits += result.cache_hits;
+    return result;
+}
+
+void DiskIndex::ReadBlocks(const std::vector<uint64_t> &blocks, std::unordered_map<uint64_t, std::vector<char>> &out,
+                           DiskSearchResult &result) {
+    std::vector<uint64_t> missing;
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        for (uint64_t b : blocks) {
+            auto cached = cache.find(b);
+            if (cached == cache.end()) {
+                missing.push_back(b);
+                continue;
+            }
+            lru.splice(lru.begin(), lru, cached->second.second);
+            out[b] = cached->second.first;
+            ++result.cache_hits;
+        }
+    }
+
+    // blocks are sorted, runs of adjacent blocks are fetched with a single pread
+    std::vector<char> buffer;
+    for (size_t i = 0; i < missing.size(); ) {
+        size_t j = i + 1;
+        while (j < missing.size() && missing[j] == missing[j - 1] + 1) ++j;
+
+        size_t run = j - i;
+        buffer.resize(run * DiskLayoutHeader::kBlockSize);
+        ReadExactly(fd.Get(), buffer.data(), buffer.size(), missing[i] * DiskLayoutHeader::kBlockSize);
+        ++result.read_calls;
+        result.blocks_read += static_cast<long>(run);
+
+        for (size_t k = 0; k < run; ++k) {
+            auto begin = buffer.begin() + static_cast<long>(k * DiskLayoutHeader::kBlockSize);
+            out[missing[i + k]].assign(begin, begin + DiskLayoutHeader::kBlockSize);
+        }
+        i = j;
+    }
+
+    if (cache_capacity == 0) return;
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    for (uint64_t b : missing) {
+        if (cache.count(b)) continue;
+        if (cache.size() >= cache_capacity) {
+            cache.erase(lru.back());
+            lru.pop_back();
+        }
+        lru.push_front(b);
+        cache.emplace(b, std::make_pair(out[b], lru.begin()));
+    }
+}
+
+const HNSW& DiskIndex::GetNavigationIndex() const {
+    return navigation;
+}
+
+long DiskIndex::GetQueries() const {
+    return total_queries;
+}
+
+long DiskIndex::GetBlocksRead() const {
+    return total_blocks_read;
+}
+
+long DiskIndex::GetReadCalls() const {
+    return total_read_calls;
+}
+
+long DiskIndex::GetCacheHits() const {
+    return total_cache_hits;
+}
@@ -0,0 +1,115 @@
+#ifndef HNSW_DISK_INDEX
+#define HNSW_DISK_INDEX
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "hnsw.h"
+
+
+// On-disk layout: a header block followed by nodes packed into 4KB blocks. Each node is its
+// full precision vector followed by its level-0 neighbor list, so re-ranking and a future
+// graph walk on disk touch one block per node. Nodes never straddle blocks unless a node is
+// bigger than a block, in which case it starts on a block boundary.
+struct DiskLayoutHeader {
+    static constexpr size_t kBlockSize = 4096;
+
+    char magic[8] = {'H', 'N', 'S', 'W', 'D', 'I', 'S', 'K'};
+    uint32_t version = 1;
+    uint32_t dim = 0;
+    uint64_t points_num = 0;
+    uint32_t max_neighbors_0 = 0;
+    uint32_t node_size = 0;
+
+    DiskLayoutHeader();
+
+    DiskLayoutHeader(size_t points_num, size_t dim, int max_neighbors_0);
+
+    bool Valid() const;
+
+    size_t NodesPerBlock() const;
+
+    size_t BlocksPerNode() const;
+
+    // byte offset of the node in the file
+    uint64_t NodeOffset(Point point) const;
+};
+
+
+struct DiskSearchResult {
+    Points points;
+    long blocks_read = 0;    // 4KB blocks fetched from the file
+    long read_calls = 0;     // pread calls, adjacent blocks are coalesced into one
+    long cache_hits = 0;
+};
+
+
+// Read-only file descriptor, closed when it goes out of scope
+class FileDescriptor {
+    int fd = -1;
+
+public:
+    explicit FileDescriptor(int fd);
+
+    ~FileDescriptor();
+
+    FileDescriptor(const FileDescriptor&) = delete;
+
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+    int Get() const;
+};
+
+
+// Search over an in-memory navigation index (graph plus compressed fp16/bf16 codes) with
+// final re-ranking against full precision vectors read from the on-disk layout. Searches
+// may run concurrently, the block cache is shared and guarded by a mutex.
+class DiskIndex {
+    HNSW navigation;
+    DiskLayoutHeader header;
+    FileDescriptor fd;  // closed by its destructor also when the constructor throws
+
+    size_t cache_capacity;
+    std::mutex cache_mutex;
+    std::list<uint64_t> lru;
+    std::unordered_map<uint64_t, std::pair<std::vector<char>, std::list<uint64_t>::iterator>> cache;
+
+    std::atomic<long> total_queries{0};
+    std::atomic<long> total_blocks_read{0};
+    std::atomic<long> total_read_calls{0};
+    std::atomic<long> total_cache_hits{0};
+
+public:
+    // cache_blocks is the number of 4KB blocks kept in memory between queries
+    DiskIndex(const std::string &disk_file, const std::string &index_file,
+              ElementType navigation_type=ElementType::Float16, size_t cache_blocks=1024);
+
+    DiskIndex(const DiskIndex&) = delete;
+
+    DiskIndex& operator=(const DiskIndex&) = delete;
+
+    // ef candidates are found by the navigation index, the best rerank of them are re-ranked exactly;
+    // the query must have the dimension of the stored vectors
+    DiskSearchResult KNNSearch(const Coords &query, int K, int ef, int rerank=0);
+
+    const HNSW& GetNavigationIndex() const;
+
+    long GetQueries() const;
+
+    long GetBlocksRead() const;
+
+    long GetReadCalls() const;
+
+    long GetCacheHits() const;
+
+private:
+    void ReadBlocks(const std::vector<uint64_t> &blocks, std::unordered_map<uint64_t, std::vector<char>> &out,
+                    DiskSearchResult &result);
+};
+
+#endif // HNSW_DISK_INDEX
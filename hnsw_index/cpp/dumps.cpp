@@ -1,6 +1,19 @@
+#include <charconv>
+#include <cstring>
+#include <exception>
 #include <fstream>
+#include <iomanip>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "hnsw.h"
 #include "dumps.h"
+#include "disk_index.h"
 #include "types.h"
 
 
@@ -121,27 +134,351 @@ HNSWGraph ReadHNSWGraphFromDump(std::ifstream &ifstream) {
 }
 
 
+std::string ElementTypeToString(ElementType type) {
+    switch (type) {
+        case ElementType::Float16: return "fp16";
+        case ElementType::BFloat16: return "bf16";
+        default: return "fp32";
+    }
+}
+
+
+ElementType ElementTypeFromString(const std::string &name) {
+    if (name == "fp32") return ElementType::Float32;
+    if (name == "fp16") return ElementType::Float16;
+    if (name == "bf16") return ElementType::BFloat16;
+    throw std::invalid_argument("unknown element type: " + name);
+}
+
+
 void DumpHNSWToFile(const std::string &storage_file, const std::string &index_file,
                     const HNSW &hnsw, bool dump_storage) {
     if (dump_storage) {
         std::ofstream storage_ostrm(storage_file, std::ios::binary);
-        DumpStorage(storage_ostrm, hnsw.GetStorage());
+        if (hnsw.GetElementType() == ElementType::Float32 && hnsw.GetProjection().Empty()) {
+            DumpStorage(storage_ostrm, hnsw.GetStorage());
+        } else {
+            DumpStorage(storage_ostrm, hnsw.DecodeStorage());
+        }
     }
 
     std::ofstream index_ostrm(index_file, std::ios::binary);
     index_ostrm << hnsw.GetMaxLevel() << ' ' << hnsw.GetEntryPoint() << '\n';
     index_ostrm << hnsw.GetMaxNeighbors() << ' ' << hnsw.GetMaxNeighbors0() << '\n';
     index_ostrm << hnsw.GetEfConstruction() << ' ' << hnsw.GetLevelMultiplier() << '\n';
-    DumpHNSWGraph(index_ostrm, hnsw.GetGraph());
+    DumpHNSWGraph(index_ostrm, hnsw.IsGraphCompressed() ? hnsw.GetDecompressedGraph() : hnsw.GetGraph());
     DumpLevels(index_ostrm, hnsw.GetLevels());
+
+    // optional "key value" trailer, older readers stop before it
+    index_ostrm << "element_type " << ElementTypeToString(hnsw.GetElementType()) << '\n';
+    index_ostrm << "seed " << hnsw.GetSeed() << '\n';
+
+    const Projection &projection = hnsw.GetProjection();
+    if (!projection.Empty()) {
+        // storage stays in the input space, the projection is applied again on load
+        index_ostrm << "projection " << projection.GetInputDim() << ' ' << projection.GetOutputDim() << ' '
+                    << hnsw.GetRerank() << ' ' << std::setprecision(9) << projection.GetExplainedVariance() << ' ';
+        for (float v : projection.GetMean()) {
+            index_ostrm << v << ' ';
+        }
+        for (float v : projection.GetComponents()) {
+            index_ostrm << v << ' ';
+        }
+        index_ostrm << '\n';
+    }
+
+    if (!hnsw.GetGroups().empty()) {
+        index_ostrm << "groups ";
+        DumpIterable(index_ostrm, hnsw.GetGroups());
+    }
+
+    const RoutingTable &routing = hnsw.GetRoutingTable();
+    if (!routing.Empty()) {
+        index_ostrm << "routing " << routing.GetDim() << ' ' << routing.CentroidsNum() << ' '
+                    << routing.GetProbes() << ' ' << std::setprecision(9);
+        for (float v : routing.GetCentroids()) {
+            index_ostrm << v << ' ';
+        }
+        for (Point p : routing.GetEntries()) {
+            index_ostrm << p << ' ';
+        }
+        index_ostrm << '\n';
+    }
+}
+
+
+// Read-only private mapping of a whole file, unmapped on scope exit
+class MappedFile {
+    void *data = MAP_FAILED;
+    size_t size = 0;
+
+public:
+    explicit MappedFile(const std::string &file) {
+        int fd = open(file.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("cannot open " + file);
+        }
+        struct stat st{};
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            size = static_cast<size_t>(st.st_size);
+            data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (data == MAP_FAILED) {
+            throw std::runtime_error("cannot map " + file);
+        }
+#ifdef MADV_SEQUENTIAL
+        madvise(data, size, MADV_SEQUENTIAL);
+#endif
+    }
+
+    ~MappedFile() {
+        munmap(data, size);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char *Data() const {
+        return static_cast<const char*>(data);
+    }
+
+    size_t Size() const {
+        return size;
+    }
+};
+
+
+// Text dumps are machine written, one record per line: a vector, a level entry, or a graph point
+// followed by the line of its edges. Record boundaries are found with memchr, the records are
+// parsed on all threads with from_chars and inserted into the containers in one pass.
+
+static bool IsSpace(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+
+// next whitespace separated number before end, pos moves past it
+template<class T>
+static T ParseNumber(const char *&pos, const char *end) {
+    while (pos < end && IsSpace(*pos)) ++pos;
+    T value{};
+    auto result = std::from_chars(pos, end, value);
+    if (result.ec != std::errc()) {
+        size_t shown = std::min<size_t>(static_cast<size_t>(end - pos), 20);
+        throw std::runtime_error("malformed text dump near \"" + std::string(pos, shown) + "\"");
+    }
+    pos = result.ptr;
+    return value;
+}
+
+
+static std::string ParseWord(const char *&pos, const char *end) {
+    while (pos < end && IsSpace(*pos)) ++pos;
+    const char *start = pos;
+    while (pos < end && !IsSpace(*pos)) ++pos;
+    return std::string(start, pos);
+}
+
+
+static const char *NextLine(const char *pos, const char *end) {
+    auto newline = static_cast<const char*>(std::memchr(pos, '\n', static_cast<size_t>(end - pos)));
+    return newline ? newline + 1 : end;
+}
+
+
+// Starts of the count lines from pos followed by the end of the last one, pos moves past them
+static std::vector<const char*> SplitLines(const char *&pos, const char *end, size_t count) {
+    std::vector<const char*> lines(count + 1);
+    for (size_t i = 0; i < count; ++i) {
+        if (pos == end) {
+            throw std::runtime_error("truncated text dump");
+        }
+        lines[i] = pos;
+        pos = NextLine(pos, end);
+    }
+    lines[count] = pos;
+    return lines;
+}
+
+
+// ParallelFor which rethrows the first exception of any chunk in the calling thread
+template<class Body>
+static void ParallelParse(size_t n, int threads_num, const Body &body) {
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    ParallelFor(n, threads_num, [&](size_t begin, size_t end) {
+        try {
+            body(begin, end);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error) error = std::current_exception();
+        }
+    });
+    if (error) std::rethrow_exception(error);
+}
+
+
+static Storage ParseStorage(const char *pos, const char *end, int threads_num) {
+    auto size = ParseNumber<size_t>(pos, end);
+    pos = NextLine(pos, end);
+    std::vector<const char*> lines = SplitLines(pos, end, size);
+
+    Storage storage(size);
+    ParallelParse(size, threads_num, [&](size_t begin, size_t last) {
+        for (size_t i = begin; i < last; ++i) {
+            const char *line = lines[i];
+            storage[i].resize(ParseNumber<size_t>(line, lines[i + 1]));
+            for (float &v : storage[i]) {
+                v = ParseNumber<float>(line, lines[i + 1]);
+            }
+        }
+    });
+    return storage;
+}
+
+
+Storage ReadStorageFromFile(const std::string &storage_file, int threads_num) {
+    MappedFile mapped(storage_file);
+    return ParseStorage(mapped.Data(), mapped.Data() + mapped.Size(), threads_num);
+}
+
+
+HNSW ReadHNSWParamsFromFile(const std::string &index_file, Storage storage, int threads_num) {
+    MappedFile mapped(index_file);
+    const char *pos = mapped.Data();
+    const char *end = pos + mapped.Size();
+
+    auto max_level = ParseNumber<int>(pos, end);
+    auto entry_point = ParseNumber<Point>(pos, end);
+    auto max_neighbors = ParseNumber<int>(pos, end);
+    auto max_neighbors_0 = ParseNumber<int>(pos, end);
+    auto ef_construction = ParseNumber<int>(pos, end);
+    auto level_multiplier = ParseNumber<float>(pos, end);
+    HNSW hnsw(max_neighbors, max_neighbors_0, ef_construction, level_multiplier);
+    hnsw.max_level = max_level;
+    hnsw.entry_point = entry_point;
+
+    auto graph_levels_num = ParseNumber<size_t>(pos, end);
+    for (size_t l = 0; l < graph_levels_num; ++l) {
+        auto level_index = ParseNumber<int>(pos, end);
+        auto nodes_num = ParseNumber<size_t>(pos, end);
+        pos = NextLine(pos, end);
+        std::vector<const char*> lines = SplitLines(pos, end, 2 * nodes_num);
+
+        // edges of all nodes in one array, node i owns edges[offsets[i], offsets[i + 1])
+        Points points(nodes_num);
+        std::vector<size_t> offsets(nodes_num + 1, 0);
+        ParallelParse(nodes_num, threads_num, [&](size_t begin, size_t last) {
+            for (size_t i = begin; i < last; ++i) {
+                const char *line = lines[2 * i];
+                points[i] = ParseNumber<Point>(line, lines[2 * i + 1]);
+                line = lines[2 * i + 1];
+                offsets[i + 1] = ParseNumber<size_t>(line, lines[2 * i + 2]);
+            }
+        });
+        for (size_t i = 0; i < nodes_num; ++i) {
+            offsets[i + 1] += offsets[i];
+        }
+
+        Points edges(offsets[nodes_num]);
+        ParallelParse(nodes_num, threads_num, [&](size_t begin, size_t last) {
+            for (size_t i = begin; i < last; ++i) {
+                const char *line = lines[2 * i + 1];
+                ParseNumber<size_t>(line, lines[2 * i + 2]);
+                for (size_t e = offsets[i]; e < offsets[i + 1]; ++e) {
+                    edges[e] = ParseNumber<Point>(line, lines[2 * i + 2]);
+                }
+            }
+        });
+
+        // the arena is not thread-safe, the sized containers are filled by this thread alone
+        auto &level = hnsw.graph[level_index];
+        level.reserve(nodes_num);
+        for (size_t i = 0; i < nodes_num; ++i) {
+            PointsSet &neighbors = level[points[i]];
+            neighbors.reserve(offsets[i + 1] - offsets[i]);
+            neighbors.insert(edges.begin() + static_cast<long>(offsets[i]), edges.begin() + static_cast<long>(offsets[i + 1]));
+        }
+    }
+
+    auto levels_num = ParseNumber<size_t>(pos, end);
+    pos = NextLine(pos, end);
+    std::vector<const char*> lines = SplitLines(pos, end, levels_num);
+    std::vector<std::pair<Point, int>> entries(levels_num);
+    ParallelParse(levels_num, threads_num, [&](size_t begin, size_t last) {
+        for (size_t i = begin; i < last; ++i) {
+            const char *line = lines[i];
+            entries[i].first = ParseNumber<Point>(line, lines[i + 1]);
+            entries[i].second = ParseNumber<int>(line, lines[i + 1]);
+        }
+    });
+    hnsw.levels.reserve(levels_num);
+    for (const auto &entry : entries) {
+        hnsw.levels[entry.first] = entry.second;
+    }
+
+    // the trailer is short apart from groups, parsed as ReadHNSWParamsFromDump does
+    std::vector<int> groups;
+    RoutingTable routing;
+    for (std::string key = ParseWord(pos, end); !key.empty(); key = ParseWord(pos, end)) {
+        if (key == "element_type") {
+            hnsw.SetElementType(ElementTypeFromString(ParseWord(pos, end)));
+        } else if (key == "seed") {
+            hnsw.SetSeed(ParseNumber<uint64_t>(pos, end));
+        } else if (key == "projection") {
+            auto input_dim = ParseNumber<size_t>(pos, end);
+            auto output_dim = ParseNumber<size_t>(pos, end);
+            bool rerank = ParseNumber<int>(pos, end) != 0;
+            auto explained_variance = ParseNumber<float>(pos, end);
+
+            Coords mean(input_dim);
+            std::vector<float> components(input_dim * output_dim);
+            for (float &v : mean) v = ParseNumber<float>(pos, end);
+            for (float &v : components) v = ParseNumber<float>(pos, end);
+            hnsw.SetProjection(Projection(mean, components, output_dim, explained_variance), rerank);
+        } else if (key == "groups") {
+            groups.resize(ParseNumber<size_t>(pos, end));
+            for (int &group : groups) group = ParseNumber<int>(pos, end);
+        } else if (key == "routing") {
+            auto dim = ParseNumber<size_t>(pos, end);
+            auto centroids_num = ParseNumber<size_t>(pos, end);
+            auto probes = ParseNumber<int>(pos, end);
+
+            std::vector<float> centroids(dim * centroids_num);
+            Points entries(centroids_num);
+            for (float &v : centroids) v = ParseNumber<float>(pos, end);
+            for (Point &p : entries) p = ParseNumber<Point>(pos, end);
+            routing = RoutingTable(dim, std::move(centroids), std::move(entries), probes);
+        } else {
+            pos = NextLine(pos, end);
+        }
+    }
+
+    // plain float vectors are moved in, other layouts are encoded as they are appended
+    if (hnsw.element_type == ElementType::Float32 && hnsw.projection.Empty()) {
+        hnsw.SetDim(storage.empty() ? 0 : storage[0].size());
+        hnsw.storage = std::move(storage);
+    } else {
+        hnsw.AppendStorage(storage);
+    }
+    if (!groups.empty()) {
+        hnsw.SetGroups(groups);
+    }
+    if (!routing.Empty()) {
+        hnsw.SetRoutingTable(std::move(routing));
+    }
+    return hnsw;
 }
 
 
-HNSW ReadHNSWFromFile(const std::string &storage_file, const std::string &index_file) {
-    std::ifstream storage_istrm(storage_file, std::ios::binary);
-    Storage storage = ReadStorageFromDump(storage_istrm);
-    std::ifstream index_istrm(index_file, std::ios::binary);
+HNSW ReadHNSWFromFile(const std::string &storage_file, const std::string &index_file, int threads_num) {
+    return ReadHNSWParamsFromFile(index_file, ReadStorageFromFile(storage_file, threads_num), threads_num);
+}
+
 
+HNSW ReadHNSWParamsFromDump(std::ifstream &index_istrm, Storage &storage) {
     int max_level, max_neighbors, max_neighbors_0, ef_construction;
     float level_multiplier;
     Point entry_point;
@@ -152,6 +489,451 @@ HNSW ReadHNSWFromFile(const std::string &storage_file, const std::string &index_
     HNSWGraph graph = ReadHNSWGraphFromDump(index_istrm);
     Levels levels = ReadLevelsFromDump(index_istrm);
 
-    return HNSW(max_neighbors, max_neighbors_0, ef_construction, level_multiplier,
-                max_level, entry_point, storage, graph, levels);
+    // vectors are attached after the trailer, which decides how they are stored
+    Storage no_storage;
+    HNSW hnsw(max_neighbors, max_neighbors_0, ef_construction, level_multiplier,
+              max_level, entry_point, no_storage, graph, levels);
+
+    std::vector<int> groups;
+    RoutingTable routing;
+    std::string key;
+    while (index_istrm >> key) {
+        if (key == "element_type") {
+            std::string type;
+            index_istrm >> type;
+            hnsw.SetElementType(ElementTypeFromString(type));
+        } else if (key == "seed") {
+            uint64_t seed;
+            index_istrm >> seed;
+            hnsw.SetSeed(seed);
+        } else if (key == "projection") {
+            size_t input_dim, output_dim;
+            bool rerank;
+            float explained_variance;
+            index_istrm >> input_dim >> output_dim >> rerank >> explained_variance;
+
+            Coords mean(input_dim);
+            std::vector<float> components(input_dim * output_dim);
+            for (float &v : mean) index_istrm >> v;
+            for (float &v : components) index_istrm >> v;
+            hnsw.SetProjection(Projection(mean, components, output_dim, explained_variance), rerank);
+        } else if (key == "groups") {
+            groups = ReadVectorFromDump<int>(index_istrm);
+        } else if (key == "routing") {
+            size_t dim, centroids_num;
+            int probes;
+            index_istrm >> dim >> centroids_num >> probes;
+
+            std::vector<float> centroids(dim * centroids_num);
+            Points entries(centroids_num);
+            for (float &v : centroids) index_istrm >> v;
+            for (Point &p : entries) index_istrm >> p;
+            routing = RoutingTable(dim, std::move(centroids), std::move(entries), probes);
+        } else {
+            index_istrm.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        }
+    }
+
+    hnsw.AppendStorage(storage);
+    if (!groups.empty()) {
+        hnsw.SetGroups(groups);
+    }
+    if (!routing.Empty()) {
+        hnsw.SetRoutingTable(std::move(routing));
+    }
+    return hnsw;
+}
+
+
+std::vector<int> ReadGroupsFromFile(const std::string &groups_file) {
+    std::ifstream istrm(groups_file);
+    if (!istrm) {
+        throw std::runtime_error("cannot open " + groups_file);
+    }
+
+    std::vector<int> groups;
+    std::string line, field, last;
+    while (std::getline(istrm, line)) {
+        std::istringstream fields(line);
+        last.clear();
+        while (fields >> field) {
+            last = field;
+        }
+        if (!last.empty()) {
+            groups.push_back(std::stoi(last));
+        }
+    }
+    return groups;
+}
+
+
+static const char kSnapshotMagic[8] = {'H', 'N', 'S', 'W', 'S', 'N', 'A', 'P'};
+// version 2 adds the groups section, version 3 the compressed level 0, version 4 the routing table,
+// version 5 the level seed, version 6 32-bit offsets of the compressed level 0; older snapshots
+// are still read
+static const uint32_t kSnapshotVersion = 6;
+
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t element_type;
+    uint64_t points_num;
+    uint64_t dim;
+    int32_t max_level;
+    int32_t entry_point;
+    int32_t max_neighbors;
+    int32_t max_neighbors_0;
+    int32_t ef_construction;
+    float level_multiplier;
+    uint64_t levels_num;
+    uint64_t graph_levels_num;
+};
+
+
+template<class T>
+static void WriteRaw(std::ofstream &ostrm, const T *data, size_t count) {
+    ostrm.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(count * sizeof(T)));
+}
+
+
+void DumpHNSWSnapshot(const std::string &snapshot_file, const HNSW &hnsw) {
+    SnapshotHeader header{};
+    std::memcpy(header.magic, kSnapshotMagic, sizeof(header.magic));
+    header.version = kSnapshotVersion;
+    header.element_type = static_cast<uint32_t>(hnsw.element_type);
+    header.points_num = hnsw.Size();
+    header.dim = hnsw.dim;
+    header.max_level = hnsw.max_level;
+    header.entry_point = hnsw.entry_point;
+    header.max_neighbors = hnsw.max_neighbors;
+    header.max_neighbors_0 = hnsw.max_neighbors_0;
+    header.ef_construction = hnsw.ef_construction;
+    header.level_multiplier = hnsw.level_multiplier;
+    header.levels_num = hnsw.levels.size();
+    header.graph_levels_num = hnsw.graph.size();
+
+    // written next to the target and renamed, so a watcher never sees a half written snapshot
+    std::string tmp_file = snapshot_file + ".tmp";
+    {
+        std::ofstream ostrm(tmp_file, std::ios::binary);
+        WriteRaw(ostrm, &header, 1);
+
+        if (hnsw.element_type == ElementType::Float32) {
+            for (const Coords &coords : hnsw.storage) {
+                WriteRaw(ostrm, coords.data(), coords.size());
+            }
+        } else {
+            WriteRaw(ostrm, hnsw.half_storage.data(), hnsw.half_storage.size());
+        }
+
+        for (const auto &entry : hnsw.levels) {
+            int32_t record[2] = {entry.first, entry.second};
+            WriteRaw(ostrm, record, 2);
+        }
+
+        std::vector<int32_t> edges;
+        for (const auto &level : hnsw.graph) {
+            int32_t level_index = level.first;
+            uint64_t nodes_num = level.second.size();
+            WriteRaw(ostrm, &level_index, 1);
+            WriteRaw(ostrm, &nodes_num, 1);
+
+            for (const auto &point_edges : level.second) {
+                edges.assign({point_edges.first, static_cast<int32_t>(point_edges.second.size())});
+                edges.insert(edges.end(), point_edges.second.begin(), point_edges.second.end());
+                WriteRaw(ostrm, edges.data(), edges.size());
+            }
+        }
+
+        uint64_t groups_num = hnsw.groups.size();
+        WriteRaw(ostrm, &groups_num, 1);
+        WriteRaw(ostrm, hnsw.groups.data(), hnsw.groups.size());
+
+        // sizes are zero when level 0 is stored with the other levels above
+        const CompressedGraph &compressed = hnsw.compressed_level_0;
+        uint64_t compressed_sizes[2] = {compressed.GetOffsets().size(), compressed.GetData().size()};
+        WriteRaw(ostrm, compressed_sizes, 2);
+        WriteRaw(ostrm, compressed.GetOffsets().data(), compressed.GetOffsets().size());
+        WriteRaw(ostrm, compressed.GetData().data(), compressed.GetData().size());
+
+        // zero centroids without a routing table
+        const RoutingTable &routing = hnsw.routing;
+        uint64_t routing_sizes[2] = {routing.GetDim(), routing.CentroidsNum()};
+        int32_t probes = routing.GetProbes();
+        WriteRaw(ostrm, routing_sizes, 2);
+        WriteRaw(ostrm, &probes, 1);
+        WriteRaw(ostrm, routing.GetCentroids().data(), routing.GetCentroids().size());
+        WriteRaw(ostrm, routing.GetEntries().data(), routing.GetEntries().size());
+
+        uint64_t seed = hnsw.seed;
+        WriteRaw(ostrm, &seed, 1);
+
+        // optional projection section, absent in snapshots of indexes without one
+        const Projection &projection = hnsw.projection;
+        if (!projection.Empty()) {
+            uint64_t dims[2] = {projection.GetInputDim(), projection.GetOutputDim()};
+            float explained_variance = projection.GetExplainedVariance();
+            uint32_t rerank = hnsw.rerank;
+            WriteRaw(ostrm, dims, 2);
+            WriteRaw(ostrm, &explained_variance, 1);
+            WriteRaw(ostrm, &rerank, 1);
+            WriteRaw(ostrm, projection.GetMean().data(), projection.GetMean().size());
+            WriteRaw(ostrm, projection.GetComponents().data(), projection.GetComponents().size());
+            for (const Coords &coords : hnsw.original_storage) {
+                WriteRaw(ostrm, coords.data(), coords.size());
+            }
+        }
+
+        if (!ostrm) {
+            throw std::runtime_error("failed to write snapshot " + tmp_file);
+        }
+    }
+
+    if (std::rename(tmp_file.c_str(), snapshot_file.c_str()) != 0) {
+        throw std::runtime_error("failed to rename snapshot to " + snapshot_file);
+    }
+}
+
+
+// Bounds checked cursor over a mapped snapshot
+class SnapshotCursor {
+    const char *pos;
+    const char *end;
+
+public:
+    SnapshotCursor(const char *begin, size_t size) : pos(begin), end(begin + size) {}
+
+    const char *Take(size_t bytes) {
+        if (bytes > static_cast<size_t>(end - pos)) {
+            throw std::runtime_error("truncated snapshot");
+        }
+        const char *data = pos;
+        pos += bytes;
+        return data;
+    }
+
+    bool AtEnd() const {
+        return pos == end;
+    }
+
+    template<class T>
+    T Read() {
+        T value;
+        std::memcpy(&value, Take(sizeof(T)), sizeof(T));
+        return value;
+    }
+
+    // sections follow each other unpadded, so arrays are copied out rather than cast in place
+    template<class T>
+    void ReadArray(std::vector<T> &out, size_t count) {
+        const char *data = Take(count * sizeof(T));
+        out.resize(count);
+        if (count != 0) {
+            std::memcpy(out.data(), data, count * sizeof(T));
+        }
+    }
+};
+
+
+HNSW ReadHNSWSnapshot(const std::string &snapshot_file) {
+    MappedFile mapped(snapshot_file);
+    SnapshotCursor cursor(mapped.Data(), mapped.Size());
+
+    auto header = cursor.Read<SnapshotHeader>();
+    if (std::memcmp(header.magic, kSnapshotMagic, sizeof(header.magic)) != 0 ||
+        header.version < 1 || header.version > kSnapshotVersion || header.element_type > static_cast<uint32_t>(ElementType::BFloat16)) {
+        throw std::runtime_error("not an HNSW snapshot: " + snapshot_file);
+    }
+
+    HNSW hnsw(header.max_neighbors, header.max_neighbors_0, header.ef_construction, header.level_multiplier);
+    hnsw.max_level = header.max_level;
+    hnsw.entry_point = header.entry_point;
+    hnsw.element_type = static_cast<ElementType>(header.element_type);
+    hnsw.SetDim(header.dim);
+
+    size_t values_num = header.points_num * header.dim;
+    if (hnsw.element_type == ElementType::Float32) {
+        const char *values = cursor.Take(values_num * sizeof(float));
+        hnsw.storage.resize(header.points_num);
+        for (size_t p = 0; p < header.points_num; ++p) {
+            hnsw.storage[p].resize(header.dim);
+            std::memcpy(hnsw.storage[p].data(), values + p * header.dim * sizeof(float), header.dim * sizeof(float));
+        }
+    } else {
+        cursor.ReadArray(hnsw.half_storage, values_num);
+    }
+
+    hnsw.levels.reserve(header.levels_num);
+    for (uint64_t i = 0; i < header.levels_num; ++i) {
+        auto point = cursor.Read<int32_t>();
+        hnsw.levels[point] = cursor.Read<int32_t>();
+    }
+
+    std::vector<int32_t> edges;
+    for (uint64_t i = 0; i < header.graph_levels_num; ++i) {
+        auto level_index = cursor.Read<int32_t>();
+        auto nodes_num = cursor.Read<uint64_t>();
+        auto &level = hnsw.graph[level_index];
+        level.reserve(nodes_num);
+
+        for (uint64_t j = 0; j < nodes_num; ++j) {
+            auto point = cursor.Read<int32_t>();
+            auto edges_num = cursor.Read<int32_t>();
+            cursor.ReadArray(edges, static_cast<size_t>(edges_num));
+
+            PointsSet &neighbors = level[point];
+            neighbors.reserve(edges.size());
+            neighbors.insert(edges.begin(), edges.end());
+        }
+    }
+
+    if (header.version >= 2) {
+        auto groups_num = cursor.Read<uint64_t>();
+        if (groups_num != 0 && groups_num != header.points_num) {
+            throw std::runtime_error("groups do not match points in snapshot " + snapshot_file);
+        }
+        cursor.ReadArray(hnsw.groups, groups_num);
+    }
+
+    if (header.version >= 3) {
+        auto offsets_num = cursor.Read<uint64_t>();
+        auto bytes = cursor.Read<uint64_t>();
+        if (offsets_num != 0 && offsets_num != header.points_num + 1) {
+            throw std::runtime_error("compressed graph does not match points in snapshot " + snapshot_file);
+        }
+        if (offsets_num != 0) {
+            std::vector<uint32_t> offsets;
+            if (header.version >= 6) {
+                cursor.ReadArray(offsets, offsets_num);
+            } else {
+                // 64-bit offsets and 8 bytes of padding before version 6, the lists are unchanged
+                offsets.resize(offsets_num);
+                for (auto &offset : offsets) {
+                    auto wide = cursor.Read<uint64_t>();
+                    if (wide > UINT32_MAX) {
+                        throw std::runtime_error("compressed graph too large in snapshot " + snapshot_file);
+                    }
+                    offset = static_cast<uint32_t>(wide);
+                }
+            }
+            auto data = reinterpret_cast<const uint8_t*>(cursor.Take(bytes));
+            std::vector<uint8_t> lists(data, data + bytes);
+            if (header.version < 6) {
+                lists.resize(lists.size() + sizeof(uint64_t), 0);
+            }
+            hnsw.compressed_level_0 = CompressedGraph(std::move(offsets), std::move(lists));
+        }
+    }
+
+    RoutingTable routing;
+    if (header.version >= 4) {
+        auto dim = cursor.Read<uint64_t>();
+        auto centroids_num = cursor.Read<uint64_t>();
+        auto probes = cursor.Read<int32_t>();
+        if (centroids_num != 0) {
+            std::vector<float> centroids;
+            Points entries;
+            cursor.ReadArray(centroids, dim * centroids_num);
+            cursor.ReadArray(entries, centroids_num);
+            routing = RoutingTable(dim, std::move(centroids), std::move(entries), probes);
+        }
+    }
+
+    if (header.version >= 5) {
+        hnsw.seed = cursor.Read<uint64_t>();
+    }
+
+    if (!cursor.AtEnd()) {
+        auto input_dim = cursor.Read<uint64_t>();
+        auto output_dim = cursor.Read<uint64_t>();
+        auto explained_variance = cursor.Read<float>();
+        auto rerank = cursor.Read<uint32_t>();
+
+        Coords mean;
+        std::vector<float> components;
+        cursor.ReadArray(mean, input_dim);
+        cursor.ReadArray(components, input_dim * output_dim);
+        hnsw.projection = Projection(std::move(mean), std::move(components), output_dim, explained_variance);
+        hnsw.rerank = rerank != 0;
+
+        if (hnsw.rerank) {
+            const char *values = cursor.Take(header.points_num * input_dim * sizeof(float));
+            hnsw.original_storage.resize(header.points_num);
+            for (size_t p = 0; p < header.points_num; ++p) {
+                hnsw.original_storage[p].resize(input_dim);
+                std::memcpy(hnsw.original_storage[p].data(), values + p * input_dim * sizeof(float),
+                            input_dim * sizeof(float));
+            }
+        }
+    }
+
+    if (!routing.Empty()) {
+        hnsw.SetRoutingTable(std::move(routing));
+    }
+    return hnsw;
+}
+
+
+bool IsHNSWSnapshot(const std::string &file) {
+    std::ifstream istrm(file, std::ios::binary);
+    char magic[sizeof(kSnapshotMagic)] = {};
+    istrm.read(magic, sizeof(magic));
+    return istrm && std::memcmp(magic, kSnapshotMagic, sizeof(magic)) == 0;
+}
+
+
+void DumpDiskLayout(const std::string &disk_file, const HNSW &hnsw) {
+    DiskLayoutHeader header(hnsw.Size(), hnsw.GetInputDim(), hnsw.GetMaxNeighbors0());
+    std::ofstream ostrm(disk_file, std::ios::binary);
+
+    std::vector<char> header_block(DiskLayoutHeader::kBlockSize, 0);
+    std::memcpy(header_block.data(), &header, sizeof(header));
+    ostrm.write(header_block.data(), static_cast<std::streamsize>(header_block.size()));
+
+    HNSWGraph decompressed;
+    if (hnsw.IsGraphCompressed()) {
+        decompressed = hnsw.GetDecompressedGraph();
+    }
+    const HNSWGraph &graph = hnsw.IsGraphCompressed() ? decompressed : hnsw.GetGraph();
+    auto level_0 = graph.find(0);
+
+    uint64_t written = DiskLayoutHeader::kBlockSize;
+    std::vector<char> node(header.node_size);
+    for (size_t p = 0; p < hnsw.Size(); ++p) {
+        auto point = static_cast<Point>(p);
+        std::fill(node.begin(), node.end(), 0);
+
+        Coords coords = hnsw.DecodeInputCoords(point);
+        std::memcpy(node.data(), coords.data(), coords.size() * sizeof(float));
+
+        std::vector<Point> neighbors(header.max_neighbors_0, -1);
+        uint32_t count = 0;
+        if (level_0 != graph.end()) {
+            auto edges = level_0->second.find(point);
+            if (edges != level_0->second.end()) {
+                if (edges->second.size() > header.max_neighbors_0) {
+                    throw std::runtime_error("point " + std::to_string(point) + " has more than " +
+                                             std::to_string(header.max_neighbors_0) + " level 0 neighbors");
+                }
+                for (Point n : edges->second) {
+                    neighbors[count++] = n;
+                }
+            }
+        }
+        char *tail = node.data() + coords.size() * sizeof(float);
+        std::memcpy(tail, &count, sizeof(count));
+        std::memcpy(tail + sizeof(count), neighbors.data(), neighbors.size() * sizeof(Point));
+
+        // pad up to the node position, nodes do not straddle block boundaries
+        uint64_t offset = header.NodeOffset(point);
+        std::vector<char> padding(offset - written, 0);
+        ostrm.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+        ostrm.write(node.data(), static_cast<std::streamsize>(node.size()));
+        written = offset + node.size();
+    }
+
+    std::vector<char> padding((DiskLayoutHeader::kBlockSize - written % DiskLayoutHeader::kBlockSize) %
+                              DiskLayoutHeader::kBlockSize, 0);
+    ostrm.write(padding.data(), static_cast<std::streamsize>(padding.size()));
 }
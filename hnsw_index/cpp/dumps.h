@@ -33,10 +33,50 @@ void DumpHNSWGraph(std::ofstream &ofstream, const HNSWGraph &graph);
 HNSWGraph ReadHNSWGraphFromDump(std::ifstream &ifstream);
 
 
+std::string ElementTypeToString(ElementType type);
+
+
+ElementType ElementTypeFromString(const std::string &name);
+
+
 void DumpHNSWToFile(const std::string &storage_file, const std::string &index_file,
                     const HNSW &hnsw, bool dump_storage=false);
 
 
-HNSW ReadHNSWFromFile(const std::string &storage_file, const std::string &index_file);
+// Loads text dumps written by DumpHNSWToFile. The files are mapped and their records parsed on
+// threads_num threads (0 for every core) straight into the index, the result is the same as
+// from the stream readers below.
+HNSW ReadHNSWFromFile(const std::string &storage_file, const std::string &index_file, int threads_num=0);
+
+
+Storage ReadStorageFromFile(const std::string &storage_file, int threads_num=0);
+
+
+HNSW ReadHNSWParamsFromFile(const std::string &index_file, Storage storage=Storage(), int threads_num=0);
+
+
+// Token by token stream reader of the params dump, the reference for ReadHNSWParamsFromFile
+HNSW ReadHNSWParamsFromDump(std::ifstream &index_istrm, Storage &storage);
+
+
+// One line per point in point order, the last field of a line is the group id, so both plain id
+// lists and "<image> <identity>" files like CelebA's identity_CelebA.txt can be read
+std::vector<int> ReadGroupsFromFile(const std::string &groups_file);
+
+
+// Binary snapshot: one file with parameters, raw vectors in their element type, levels and
+// graph. Loads by mapping the file and copying the arrays out, without any text parsing.
+void DumpHNSWSnapshot(const std::string &snapshot_file, const HNSW &hnsw);
+
+
+HNSW ReadHNSWSnapshot(const std::string &snapshot_file);
+
+
+// true when the file starts with the snapshot magic
+bool IsHNSWSnapshot(const std::string &file);
+
+
+// throws std::runtime_error for a level 0 list longer than max_neighbors_0, nodes have no room for it
+void DumpDiskLayout(const std::string &disk_file, const HNSW &hnsw);
 
 #endif // HNSW_DUMPS
\ No newline at end of file
@@ -0,0 +1,171 @@
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "utils.h"
+#include "graph_stats.h"
+
+
+// Level-synchronous breadth-first walk, every frontier is expanded by all threads at once.
+// visited must hold one zeroed flag per point.
+static void ParallelBFS(const std::vector<const PointsSet*> &adjacency, Point start,
+                        std::atomic<uint8_t> *visited, int threads_num) {
+    std::vector<Point> frontier{start};
+    visited[start] = 1;
+    std::mutex merge_mutex;
+
+    while (!frontier.empty()) {
+        std::vector<Point> next;
+        ParallelFor(frontier.size(), threads_num, [&](size_t begin, size_t end) {
+            std::vector<Point> local;
+            for (size_t i = begin; i < end; ++i) {
+                const PointsSet *edges = adjacency[frontier[i]];
+                if (!edges) continue;
+                for (Point n : *edges) {
+                    if (n >= 0 && static_cast<size_t>(n) < adjacency.size() && !visited[n].exchange(1)) {
+                        local.push_back(n);
+                    }
+                }
+            }
+            std::lock_guard<std::mutex> lock(merge_mutex);
+            next.insert(next.end(), local.begin(), local.end());
+        });
+        frontier.swap(next);
+    }
+}
+
+
+std::vector<LevelStats> AnalyzeGraph(const HNSW &hnsw, int threads_num) {
+    size_t N = hnsw.Size();
+    std::vector<int> point_level(N, -1);
+    for (const auto &entry : hnsw.GetLevels()) {
+        if (entry.first >= 0 && static_cast<size_t>(entry.first) < N) {
+            point_level[entry.first] = entry.second;
+        }
+    }
+
+    std::vector<LevelStats> report;
+    HNSWGraph decompressed;
+    if (hnsw.IsGraphCompressed()) {
+        decompressed = hnsw.GetDecompressedGraph();
+    }
+    const HNSWGraph &graph = hnsw.IsGraphCompressed() ? decompressed : hnsw.GetGraph();
+    for (int level = 0; level <= hnsw.GetMaxLevel(); ++level) {
+        LevelStats stats;
+        stats.level = level;
+        stats.max_degree = level > 0 ? hnsw.GetMaxNeighbors() : hnsw.GetMaxNeighbors0();
+        stats.degree_histogram.assign(static_cast<size_t>(stats.max_degree) + 2, 0);
+
+        // dense view of the level so threads can index it, the hash maps are only read
+        std::vector<const PointsSet*> adjacency(N, nullptr);
+        auto level_graph = graph.find(level);
+        if (level_graph != graph.end()) {
+            for (const auto &point_edges : level_graph->second) {
+                if (point_edges.first >= 0 && static_cast<size_t>(point_edges.first) < N) {
+                    adjacency[point_edges.first] = &point_edges.second;
+                }
+            }
+        }
+
+        std::mutex merge_mutex;
+        ParallelFor(N, threads_num, [&](size_t begin, size_t end) {
+            LevelStats local;
+            local.degree_histogram.assign(stats.degree_histogram.size(), 0);
+            for (size_t p = begin; p < end; ++p) {
+                if (point_level[p] < level) continue;
+                ++local.nodes;
+
+                size_t degree = adjacency[p] ? adjacency[p]->size() : 0;
+                ++local.degree_histogram[std::min(degree, local.degree_histogram.size() - 1)];
+                if (!adjacency[p]) continue;
+
+                local.edges += degree;
+                for (Point n : *adjacency[p]) {
+                    if (n < 0 || static_cast<size_t>(n) >= N || point_level[n] < level) {
+                        ++local.dangling_edges;
+                    } else if (!adjacency[n] || adjacency[n]->find(static_cast<Point>(p)) == adjacency[n]->end()) {
+                        ++local.asymmetric_edges;
+                    }
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(merge_mutex);
+            stats.nodes += local.nodes;
+            stats.edges += local.edges;
+            stats.asymmetric_edges += local.asymmetric_edges;
+            stats.dangling_edges += local.dangling_edges;
+            for (size_t d = 0; d < stats.degree_histogram.size(); ++d) {
+                stats.degree_histogram[d] += local.degree_histogram[d];
+            }
+        });
+
+        // value-initialized, so every flag starts at zero
+        std::unique_ptr<std::atomic<uint8_t>[]> visited(new std::atomic<uint8_t>[N]());
+        Point entry_point = hnsw.GetEntryPoint();
+        if (entry_point >= 0 && static_cast<size_t>(entry_point) < N) {
+            ParallelBFS(adjacency, entry_point, visited.get(), threads_num);
+        }
+
+        for (size_t p = 0; p < N; ++p) {
+            if (point_level[p] < level) continue;
+            if (visited[p]) {
+                ++stats.reachable;
+            } else {
+                stats.unreachable.push_back(static_cast<Point>(p));
+            }
+        }
+        report.push_back(std::move(stats));
+    }
+    return report;
+}
+
+
+void PrintGraphReport(const std::vector<LevelStats> &report) {
+    for (const LevelStats &stats : report) {
+        double nodes = std::max<size_t>(stats.nodes, 1);
+        std::printf("Level %d: %zu nodes, %zu reachable (%.4f%%), %.2f mean degree of %d, "
+                    "%zu edges, %.2f%% asymmetric, %zu dangling\n",
+                    stats.level, stats.nodes, stats.reachable, 100.0 * stats.reachable / nodes,
+                    stats.edges / nodes, stats.max_degree, stats.edges,
+                    100.0 * stats.asymmetric_edges / std::max<size_t>(stats.edges, 1), stats.dangling_edges);
+
+        // degrees 1..max_degree-1 are folded into up to 8 ranges, 0, full and over full lists stand apart
+        const std::vector<size_t> &histogram = stats.degree_histogram;
+        int limit = stats.max_degree;
+        int width = std::max(1, (limit - 1 + 7) / 8);
+        std::printf("\tdegree 0: %zu\n", histogram[0]);
+        for (int low = 1; low < limit; low += width) {
+            int high = std::min(limit - 1, low + width - 1);
+            size_t count = 0;
+            for (int d = low; d <= high; ++d) {
+                count += histogram[d];
+            }
+            if (low == high) {
+                std::printf("\tdegree %d: %zu\n", low, count);
+            } else {
+                std::printf("\tdegree %d-%d: %zu\n", low, high, count);
+            }
+        }
+        std::printf("\tdegree %d (full): %zu\n", limit, histogram[limit]);
+        std::printf("\tdegree > %d: %zu\n", limit, histogram[limit + 1]);
+    }
+}
+
+
+size_t RepairGraph(HNSW &hnsw, int max_rounds, int threads_num) {
+    size_t repaired = 0;
+    for (int round = 0; round < max_rounds; ++round) {
+        size_t round_repaired = 0;
+        for (const LevelStats &stats : AnalyzeGraph(hnsw, threads_num)) {
+            if (!stats.unreachable.empty()) {
+                hnsw.Reconnect(stats.unreachable, stats.level);
+                round_repaired += stats.unreachable.size();
+            }
+        }
+        if (round_repaired == 0) break;
+        repaired += round_repaired;
+    }
+    return repaired;
+}
@@ -0,0 +1,36 @@
+#ifndef HNSW_GRAPH_STATS
+#define HNSW_GRAPH_STATS
+
+#include <string>
+#include <vector>
+
+#include "hnsw.h"
+
+
+// Health of one graph level. Unreachable nodes and collapsed degrees after trimming cost
+// recall silently, searches never see them.
+struct LevelStats {
+    int level = 0;
+    size_t nodes = 0;              // points with this level or a higher one
+    size_t reachable = 0;          // nodes found by a walk from the entry point over this level's edges
+    size_t edges = 0;
+    size_t asymmetric_edges = 0;   // a -> b without b -> a
+    size_t dangling_edges = 0;     // edges to points which are not on this level
+    int max_degree = 0;            // max_neighbors, or max_neighbors_0 on level 0
+    std::vector<size_t> degree_histogram;  // nodes by degree 0..max_degree, the last bucket counts the ones above
+    Points unreachable;
+};
+
+
+// Per-level statistics from level 0 up, computed in parallel; threads_num <= 0 uses every core
+std::vector<LevelStats> AnalyzeGraph(const HNSW &hnsw, int threads_num=0);
+
+
+void PrintGraphReport(const std::vector<LevelStats> &report);
+
+
+// Reconnects unreachable nodes until every node is reachable or max_rounds analyses passed,
+// relinking can trim edges elsewhere so one round is not always enough. Returns relinked nodes.
+size_t RepairGraph(HNSW &hnsw, int max_rounds=3, int threads_num=0);
+
+#endif // HNSW_GRAPH_STATS
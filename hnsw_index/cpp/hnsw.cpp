@@ -1,9 +1,20 @@
+#include <cstdio>
 #include <utility>
 #include <vector>
 #include <cmath>
 #include <chrono>
+#include <stdexcept>
+#include <algorithm>
+#include <iterator>
+#include <numeric>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <set>
+#include <string_view>
 
 #include "utils.h"
+#include "kernels.h"
 #include "hnsw.h"
 
 
@@ -25,44 +36,104 @@ HNSW::HNSW(int max_neighbors, int max_neighbors_0, int ef_construction, float le
     max_level(max_level),
     entry_point(entry_point),
     storage(storage),
-    graph(graph),
-    levels(levels) {}
+    graph(graph, arena.get()),
+    levels(levels, arena.get()) {
+    SetDim(storage.empty() ? 0 : storage[0].size());
+}
+
+HNSW::HNSW(const HNSW &other) : HNSW() {
+    *this = other;
+}
+
+static_assert(std::is_nothrow_move_constructible<HNSW>::value, "move assignment rebuilds the index in place");
+
+HNSW& HNSW::operator=(HNSW &&other) noexcept {
+    // pmr containers keep the allocator they were built with, so a member-wise move would copy
+    // the graph node by node into this arena; the index is rebuilt on other's arena instead
+    if (this != &other) {
+        this->~HNSW();
+        new (this) HNSW(std::move(other));
+    }
+    return *this;
+}
+
+void HNSW::InsertBatch(Storage batch, bool log_progress) {
+    CheckWritable();
+    size_t input_dim = Size() > 0 || !projection.Empty() || batch.empty() ? GetInputDim() : batch[0].size();
+    for (const Coords &coords : batch) {
+        if (coords.size() != input_dim) {
+            throw std::invalid_argument("vector dimension does not match the index");
+        }
+    }
+
+    auto first = static_cast<Point>(Size());
+    AppendStorage(batch);
+    std::vector<int> batch_levels = GenerateLevels(first, batch.size());
+    std::vector<Point> order(batch.size());
+    std::iota(order.begin(), order.end(), first);
+    std::stable_sort(order.begin(), order.end(), [&](Point a, Point b) {
+        return batch_levels[a - first] > batch_levels[b - first];
+    });
 
-void HNSW::InsertBatch(Storage batch) {
     int log_step = 100;
     using namespace std::chrono;
     high_resolution_clock::time_point start = high_resolution_clock::now();
     high_resolution_clock::time_point end;
 
-    for (const Coords &coords : batch) {
-        auto new_point = static_cast<Point>(storage.size());
-        if (new_point % log_step == 0) {
+    for (size_t i = 0; i < order.size(); ++i) {
+        if (log_progress && i % log_step == 0) {
             end = high_resolution_clock::now();
-            std::printf("\t%d %f per point\n", new_point,
+            std::printf("\t%zu %f per point\n", i,
                         static_cast<double>(duration_cast<microseconds>(end - start).count()) / log_step / 10e6);
             start = end;
         }
-        storage.push_back(coords);
-        Insert(new_point);
+        Insert(order[i], batch_levels[order[i] - first]);
+    }
+}
+
+void HNSW::AppendStorage(const Storage &batch) {
+    query_cache.Clear();
+    if (element_type == ElementType::Float32) {
+        storage.reserve(storage.size() + batch.size());
+    } else if (!batch.empty()) {
+        half_storage.reserve(half_storage.size() + batch.size() * batch[0].size());
+    }
+
+    if (rerank) {
+        original_storage.reserve(original_storage.size() + batch.size());
+    }
+
+    for (const Coords &coords : batch) {
+        AppendInput(coords);
     }
 }
 
 void HNSW::Insert(Point new_point) {
-    int level = GenerateLevel();
+    Insert(new_point, GenerateLevel(new_point));
+}
+
+void HNSW::Insert(Point new_point, int level) {
+    CheckWritable();
+    query_cache.Clear();
     levels[new_point] = level;
-    Coords new_point_coords = GetCoords(new_point);
+    Link(new_point, level, 0);
+}
+
+void HNSW::Link(Point new_point, int level, int lowest_level) {
+    Coords new_point_coords = DecodeCoords(new_point);
 
     PointsSet entry_points_set = entry_point < 0 ? PointsSet() : PointsSet{entry_point};
 
     for (int cur_level = max_level; cur_level > level; --cur_level) {
-        LessDistanceQueue best_candidates = SearchLevel(new_point_coords, entry_points_set, 1, cur_level);
+        LessDistanceQueue best_candidates = SearchLevel(new_point_coords.data(), entry_points_set, 1, cur_level);
         entry_points_set = {best_candidates.top().id};
     }
 
     int start_level = std::min(max_level, level);
-    for (int cur_level = start_level; cur_level >= 0; --cur_level) {
+    for (int cur_level = start_level; cur_level >= lowest_level; --cur_level) {
         int M = cur_level > 0 ? max_neighbors : max_neighbors_0;
-        LessDistanceQueue best_candidates = SearchLevel(new_point_coords, entry_points_set, ef_construction, cur_level);
+        LessDistanceQueue best_candidates = SearchLevel(new_point_coords.data(), entry_points_set, ef_construction,
+                                                        cur_level);
         entry_points_set = SelectBestNeighbors(best_candidates, new_point, M, cur_level);
 
         for (Point neighbor : entry_points_set) {
@@ -77,29 +148,525 @@ void HNSW::Insert(Point new_point) {
     }
 }
 
-Points HNSW::KNNSearch(const Coords &query, int K, int ef) {
-    PointsSet entry_points_set{entry_point};
+void HNSW::Reconnect(const Points &points, int level) {
+    CheckWritable();
+    query_cache.Clear();
+    int M = level > 0 ? max_neighbors : max_neighbors_0;
 
-    for (int cur_level = max_level; cur_level > 0; --cur_level) {
-        LessDistanceQueue best_candidates = SearchLevel(query, entry_points_set, 1, cur_level);
-        entry_points_set = {best_candidates.top().id};
+    for (Point point : points) {
+        Coords point_coords = DecodeCoords(point);
+        PointsSet entry_points_set{entry_point};
+        for (int cur_level = max_level; cur_level > level; --cur_level) {
+            LessDistanceQueue best_candidates = SearchLevel(point_coords.data(), entry_points_set, 1, cur_level);
+            entry_points_set = {best_candidates.top().id};
+        }
+
+        LessDistanceQueue best_candidates = SearchLevel(point_coords.data(), entry_points_set, ef_construction, level);
+        std::vector<Distance> reachable;
+        while (!best_candidates.empty()) {
+            if (best_candidates.top().id != point) {
+                reachable.push_back(best_candidates.top());
+            }
+            best_candidates.pop();
+        }
+        if (reachable.empty()) continue;
+
+        LessDistanceQueue candidates(reachable);
+        PointsSet neighbors = SelectBestNeighbors(candidates, point, M, level);
+        for (Point neighbor : neighbors) {
+            MutuallyConnect(point, neighbor, level);
+            TrimNeighbors(neighbor, M, level);
+        }
+        TrimNeighbors(point, M, level);
+
+        auto &level_graph = graph[level];
+        bool linked = std::any_of(neighbors.begin(), neighbors.end(), [&](Point neighbor) {
+            return level_graph[neighbor].count(point) > 0;
+        });
+        if (!linked) {
+            // the nearest reachable point links to it, giving up its farthest neighbor when full
+            Point nearest = reachable[0].id;
+            PointsSet &nearest_edges = level_graph[nearest];
+            if (nearest_edges.size() >= static_cast<size_t>(M)) {
+                Coords scratch;
+                const Coords &nearest_coords = CoordsOf(nearest, scratch);
+                Distance farthest(-1, -1.0);
+                for (Point n : nearest_edges) {
+                    Distance distance = QueryDistance(n, nearest_coords.data());
+                    if (distance.dist > farthest.dist) {
+                        farthest = distance;
+                    }
+                }
+                nearest_edges.erase(farthest.id);
+            }
+            nearest_edges.insert(point);
+        }
     }
+}
+
+Points HNSW::KNNSearch(const Coords &query, int K, int ef) const {
+    return KNNSearch(query.data(), K, ef);
+}
+
+Points HNSW::KNNSearch(const float *query, int K, int ef) const {
+    if (!query_cache.Enabled()) {
+        return UncachedKNNSearch(query, K, ef);
+    }
+
+    QueryKey key = query_cache.Key(query, GetInputDim(), K, ef);
+    Points points;
+    if (!query_cache.Lookup(key, points)) {
+        points = UncachedKNNSearch(query, K, ef);
+        query_cache.Store(key, points);
+    }
+    return points;
+}
+
+Points HNSW::UncachedKNNSearch(const float *raw_query, int K, int ef) const {
+    if (entry_point < 0) return {};
+    Coords scratch;
+    const float *query = ProjectQuery(raw_query, scratch);
+    PointsSet entry_points_set = EntryPoints(query);
 
     LessDistanceQueue best_candidates = SearchLevel(query, entry_points_set, ef, 0);
 
+    size_t wanted = rerank ? best_candidates.size() : static_cast<size_t>(K);
     Points points;
-    while (points.size() < static_cast<size_t>(K) and !best_candidates.empty()) {
+    while (points.size() < wanted and !best_candidates.empty()) {
         points.push_back(best_candidates.top().id);
         best_candidates.pop();
     }
 
+    if (rerank) {
+        RerankExact(raw_query, points, K);
+    }
     return points;
 }
 
+std::vector<Points> HNSW::BatchKNNSearch(const std::vector<BatchQuery> &batch) const {
+    std::vector<Points> results(batch.size());
+    if (entry_point < 0) return results;
+    size_t input_dim = GetInputDim();
+
+    // identical queries coalesce on the first one, the rest copy its result
+    std::vector<size_t> source(batch.size());
+    std::unordered_multimap<size_t, size_t> seen;
+    std::vector<size_t> unique;
+    for (size_t i = 0; i < batch.size(); ++i) {
+        const BatchQuery &q = batch[i];
+        size_t hash = std::hash<std::string_view>()(
+            std::string_view(reinterpret_cast<const char*>(q.query), input_dim * sizeof(float)));
+        hash ^= (static_cast<size_t>(q.K) << 32) ^ static_cast<size_t>(q.ef);
+
+        source[i] = i;
+        auto range = seen.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            const BatchQuery &other = batch[it->second];
+            if (other.K == q.K && other.ef == q.ef &&
+                std::memcmp(other.query, q.query, input_dim * sizeof(float)) == 0) {
+                source[i] = it->second;
+                break;
+            }
+        }
+        if (source[i] == i) {
+            seen.emplace(hash, i);
+            unique.push_back(i);
+        }
+    }
+
+    std::vector<size_t> pending;
+    std::vector<QueryKey> keys(batch.size());
+    for (size_t i : unique) {
+        if (query_cache.Enabled()) {
+            keys[i] = query_cache.Key(batch[i].query, input_dim, batch[i].K, batch[i].ef);
+            if (query_cache.Lookup(keys[i], results[i])) continue;
+        }
+        pending.push_back(i);
+    }
+
+    std::vector<Coords> scratch(pending.size());
+    std::vector<const float*> queries(pending.size());
+    std::vector<PointsSet> entries(pending.size());
+    for (size_t j = 0; j < pending.size(); ++j) {
+        queries[j] = ProjectQuery(batch[pending[j]].query, scratch[j]);
+    }
+
+    if (!routing.Empty()) {
+        for (size_t j = 0; j < pending.size(); ++j) {
+            entries[j] = EntryPoints(queries[j]);
+        }
+    } else {
+        // level by level for the whole batch, the small upper levels stay in cache between queries
+        std::vector<Point> descended(pending.size(), entry_point);
+        for (int level = max_level; level > 0; --level) {
+            for (size_t j = 0; j < pending.size(); ++j) {
+                descended[j] = GreedyDescent(queries[j], descended[j], level);
+            }
+        }
+        for (size_t j = 0; j < pending.size(); ++j) {
+            entries[j] = {descended[j]};
+        }
+    }
+
+    for (size_t j = 0; j < pending.size(); ++j) {
+        size_t i = pending[j];
+        int K = batch[i].K;
+        LessDistanceQueue best_candidates = SearchLevel(queries[j], entries[j], batch[i].ef, 0);
+
+        size_t wanted = rerank ? best_candidates.size() : static_cast<size_t>(K);
+        while (results[i].size() < wanted and !best_candidates.empty()) {
+            results[i].push_back(best_candidates.top().id);
+            best_candidates.pop();
+        }
+        if (rerank) {
+            RerankExact(batch[i].query, results[i], K);
+        }
+        if (query_cache.Enabled()) {
+            query_cache.Store(keys[i], results[i]);
+        }
+    }
+
+    for (size_t i = 0; i < batch.size(); ++i) {
+        if (source[i] != i) {
+            results[i] = results[source[i]];
+        }
+    }
+    return results;
+}
+
+Points HNSW::GroupedKNNSearch(const Coords &query, int K, int ef) const {
+    return GroupedKNNSearch(query.data(), K, ef);
+}
+
+Points HNSW::GroupedKNNSearch(const float *raw_query, int K, int ef) const {
+    if (groups.size() != Size()) {
+        throw std::logic_error("grouped search needs a group for every point");
+    }
+    if (entry_point < 0) return {};
+    Coords scratch;
+    const float *query = ProjectQuery(raw_query, scratch);
+    PointsSet entry_points_set = EntryPoints(query);
+
+    Points points = SearchLevelGroups(query, entry_points_set, std::max(ef, K));
+    if (rerank) {
+        RerankExact(raw_query, points, K);
+    } else if (points.size() > static_cast<size_t>(K)) {
+        points.resize(static_cast<size_t>(K));
+    }
+    return points;
+}
+
+void HNSW::SetGroups(std::vector<int> new_groups) {
+    if (new_groups.size() != Size()) {
+        throw std::invalid_argument("groups must hold one id per indexed point");
+    }
+    groups = std::move(new_groups);
+}
+
+const std::vector<int>& HNSW::GetGroups() const {
+    return groups;
+}
+
+SearchResult HNSW::AdaptiveKNNSearch(const Coords &query, int K, int ef, const SearchLimits &limits) const {
+    return AdaptiveKNNSearch(query.data(), K, ef, limits);
+}
+
+SearchResult HNSW::AdaptiveKNNSearch(const float *raw_query, int K, int ef, const SearchLimits &limits) const {
+    SearchState state(limits, K);
+    if (entry_point < 0) return state.result;
+    Coords scratch;
+    const float *query = ProjectQuery(raw_query, scratch);
+    PointsSet entry_points_set = EntryPoints(query, &state);
+
+    LessDistanceQueue best_candidates = SearchLevel(query, entry_points_set, ef, 0, &state);
+
+    size_t wanted = rerank ? best_candidates.size() : static_cast<size_t>(K);
+    while (state.result.points.size() < wanted and !best_candidates.empty()) {
+        state.result.points.push_back(best_candidates.top().id);
+        best_candidates.pop();
+    }
+
+    if (rerank) {
+        RerankExact(raw_query, state.result.points, K);
+    }
+    return state.result;
+}
+
+void HNSW::SetElementType(ElementType type) {
+    if (type == element_type) return;
+    query_cache.Clear();
+
+    Storage decoded(Size());
+    for (size_t i = 0; i < decoded.size(); ++i) {
+        decoded[i] = DecodeCoords(static_cast<Point>(i));
+    }
+    // swap with empty containers to actually release the old representation
+    Storage().swap(storage);
+    std::vector<uint16_t>().swap(half_storage);
+    element_type = type;
+
+    if (type == ElementType::Float32) {
+        storage = std::move(decoded);
+        return;
+    }
+
+    half_storage.reserve(decoded.size() * dim);
+    for (const Coords &coords : decoded) {
+        AppendCoords(coords);
+    }
+}
+
+void HNSW::SetProjection(const Projection &new_projection, bool new_rerank) {
+    if (Size() > 0) {
+        throw std::logic_error("projection must be set before inserting");
+    }
+    query_cache.Clear();
+    projection = new_projection;
+    rerank = new_rerank && !projection.Empty();
+}
+
+const Projection& HNSW::GetProjection() const {
+    return projection;
+}
+
+bool HNSW::GetRerank() const {
+    return rerank;
+}
+
+void HNSW::SetQueryCache(size_t budget_bytes, float quantization_step) {
+    query_cache = QueryCache(budget_bytes, quantization_step);
+}
+
+const QueryCache& HNSW::GetQueryCache() const {
+    return query_cache;
+}
+
+size_t HNSW::Size() const {
+    if (element_type == ElementType::Float32) {
+        return storage.size();
+    }
+    return dim ? half_storage.size() / dim : 0;
+}
+
+Coords HNSW::DecodeCoords(Point point) const {
+    if (element_type == ElementType::Float32) {
+        return storage[point];
+    }
+
+    Coords coords(dim);
+    const uint16_t *codes = half_storage.data() + static_cast<size_t>(point) * dim;
+    for (size_t i = 0; i < dim; ++i) {
+        coords[i] = element_type == ElementType::Float16 ? HalfToFloat(codes[i]) : BFloat16ToFloat(codes[i]);
+    }
+    return coords;
+}
+
+Coords HNSW::DecodeInputCoords(Point point) const {
+    if (projection.Empty()) {
+        return DecodeCoords(point);
+    }
+    if (rerank) {
+        return original_storage[point];
+    }
+    return projection.Unproject(DecodeCoords(point).data());
+}
+
+Storage HNSW::DecodeStorage() const {
+    if (projection.Empty() && element_type == ElementType::Float32) {
+        return storage;
+    }
+    if (rerank) {
+        return original_storage;
+    }
+
+    Storage decoded(Size());
+    for (size_t i = 0; i < decoded.size(); ++i) {
+        decoded[i] = DecodeInputCoords(static_cast<Point>(i));
+    }
+    return decoded;
+}
+
 const Storage& HNSW::GetStorage() const {
     return storage;
 }
 
+ElementType HNSW::GetElementType() const {
+    return element_type;
+}
+
+size_t HNSW::GetDim() const {
+    return dim;
+}
+
+size_t HNSW::GetInputDim() const {
+    return projection.Empty() ? dim : projection.GetInputDim();
+}
+
+// libstdc++ hash containers: one pointer per bucket, nodes hold a next pointer and the value
+template<class Container>
+static size_t HashNodeBytes() {
+    size_t node = sizeof(void*) + sizeof(typename Container::value_type);
+    return (node + alignof(void*) - 1) / alignof(void*) * alignof(void*);
+}
+
+template<class Container>
+static size_t HashContainerBytes(const Container &container) {
+    return container.bucket_count() * sizeof(void*) + container.size() * HashNodeBytes<Container>();
+}
+
+// bucket count is the next prime after doubling, 1.5 buckets per element on average
+template<class Container>
+static size_t HashContainerBytes(size_t size) {
+    return size * 3 / 2 * sizeof(void*) + size * HashNodeBytes<Container>();
+}
+
+size_t MemoryReport::Total() const {
+    return storage + graph_level_0 + graph_upper + metadata;
+}
+
+void PrintMemoryReport(const std::string &prefix, const MemoryReport &report) {
+    std::printf("%s: storage %zu, level 0 %zu, upper levels %zu, metadata %zu, total %zu bytes "
+                "(arena: %zu used, %zu reserved)\n", prefix.c_str(), report.storage, report.graph_level_0,
+                report.graph_upper, report.metadata, report.Total(), report.arena_used, report.arena_reserved);
+}
+
+MemoryReport HNSW::MemoryUsage() const {
+    MemoryReport report;
+
+    report.storage = storage.capacity() * sizeof(Coords) + half_storage.capacity() * sizeof(uint16_t);
+    for (const Coords &coords : storage) {
+        report.storage += coords.capacity() * sizeof(float);
+    }
+    report.storage += original_storage.capacity() * sizeof(Coords);
+    for (const Coords &coords : original_storage) {
+        report.storage += coords.capacity() * sizeof(float);
+    }
+
+    report.graph_level_0 = compressed_level_0.Bytes();
+    for (const auto &level : graph) {
+        size_t bytes = HashContainerBytes(level.second);
+        for (const auto &point_edges : level.second) {
+            bytes += HashContainerBytes(point_edges.second);
+        }
+        (level.first == 0 ? report.graph_level_0 : report.graph_upper) += bytes;
+    }
+
+    report.metadata = sizeof(HNSW) + HashContainerBytes(graph) + HashContainerBytes(levels) + query_cache.Bytes() +
+                      groups.capacity() * sizeof(int) + routing.GetCentroids().size() * sizeof(float) +
+                      routing.GetEntries().size() * sizeof(Point) +
+                      (projection.GetComponents().size() + 2 * projection.GetInputDim()) * sizeof(float);
+    report.arena_reserved = arena.get()->Reserved();
+    report.arena_used = arena.get()->Used();
+    return report;
+}
+
+MemoryReport HNSW::EstimateMemoryUsage(size_t N, size_t dim, int max_neighbors, int max_neighbors_0,
+                                       float level_multiplier, ElementType element_type) {
+    MemoryReport report;
+
+    if (element_type == ElementType::Float32) {
+        report.storage = N * (sizeof(Coords) + dim * sizeof(float));
+    } else {
+        report.storage = N * dim * sizeof(uint16_t);
+    }
+
+    typedef HNSWGraph::mapped_type LevelGraph;
+    report.graph_level_0 = HashContainerBytes<LevelGraph>(N) +
+                           N * HashContainerBytes<PointsSet>(static_cast<size_t>(max_neighbors_0));
+
+    // GenerateLevel gives P(level >= l) = exp(-l / level_multiplier)
+    size_t levels_num = 0;
+    for (int level = 1; ; ++level) {
+        auto nodes = static_cast<size_t>(N * std::exp(-level / level_multiplier));
+        if (nodes == 0) break;
+        report.graph_upper += HashContainerBytes<LevelGraph>(nodes) +
+                              nodes * HashContainerBytes<PointsSet>(static_cast<size_t>(max_neighbors));
+        ++levels_num;
+    }
+
+    report.metadata = sizeof(HNSW) + HashContainerBytes<HNSWGraph>(levels_num + 1) + HashContainerBytes<Levels>(N);
+
+    // the pool rounds requests up to power-of-two size classes
+    report.arena_used = report.graph_level_0 + report.graph_upper + report.metadata - sizeof(HNSW);
+    report.arena_reserved = report.arena_used * 3 / 2;
+    return report;
+}
+
+void HNSW::TrainRouting(size_t centroids_num, int probes, int iterations, size_t max_samples, int threads_num) {
+    if (centroids_num == 0 || Size() == 0) {
+        SetRoutingTable(RoutingTable());
+        return;
+    }
+
+    Storage samples;
+    size_t step = std::max<size_t>(1, Size() / std::max<size_t>(1, max_samples));
+    for (size_t p = 0; p < Size(); p += step) {
+        samples.push_back(DecodeCoords(static_cast<Point>(p)));
+    }
+    std::vector<float> centroids = RoutingTable::TrainCentroids(samples, centroids_num, iterations, threads_num,
+                                                                seed);
+
+    // the nearest point of a centroid is what a build-quality search for it finds first
+    Points entries(centroids.size() / dim);
+    ParallelFor(entries.size(), threads_num, [&](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; ++c) {
+            const float *centroid = centroids.data() + c * dim;
+            Point start = entry_point;
+            for (int level = max_level; level > 0; --level) {
+                start = GreedyDescent(centroid, start, level);
+            }
+            entries[c] = SearchLevel(centroid, PointsSet{start}, ef_construction, 0).top().id;
+        }
+    });
+    SetRoutingTable(RoutingTable(dim, std::move(centroids), std::move(entries), probes));
+}
+
+void HNSW::SetRoutingTable(RoutingTable table) {
+    if (!table.Empty()) {
+        bool inside = std::all_of(table.GetEntries().begin(), table.GetEntries().end(), [&](Point p) {
+            return p >= 0 && static_cast<size_t>(p) < Size();
+        });
+        if (table.GetDim() != dim || !inside) {
+            throw std::invalid_argument("routing table does not match the index");
+        }
+    }
+    query_cache.Clear();
+    routing = std::move(table);
+}
+
+const RoutingTable& HNSW::GetRoutingTable() const {
+    return routing;
+}
+
+void HNSW::CompressGraph() {
+    if (IsGraphCompressed()) return;
+    auto level_0 = graph.find(0);
+    if (level_0 == graph.end()) return;
+
+    compressed_level_0 = CompressedGraph(level_0->second, Size());
+    graph.erase(level_0);
+}
+
+void HNSW::DecompressGraph() {
+    if (!IsGraphCompressed()) return;
+    compressed_level_0.Decompress(graph[0]);
+    compressed_level_0 = CompressedGraph();
+}
+
+bool HNSW::IsGraphCompressed() const {
+    return !compressed_level_0.Empty();
+}
+
+const CompressedGraph& HNSW::GetCompressedGraph() const {
+    return compressed_level_0;
+}
+
+void HNSW::CheckWritable() const {
+    if (IsGraphCompressed()) {
+        throw std::logic_error("level 0 is compressed and read-only, call DecompressGraph first");
+    }
+}
+
 const Levels& HNSW::GetLevels() const {
     return levels;
 }
@@ -108,6 +675,12 @@ const HNSWGraph& HNSW::GetGraph() const {
     return graph;
 }
 
+HNSWGraph HNSW::GetDecompressedGraph() const {
+    HNSWGraph full(graph);
+    compressed_level_0.Decompress(full[0]);
+    return full;
+}
+
 const int HNSW::GetMaxLevel() const {
     return max_level;
 }
@@ -136,9 +709,12 @@ void HNSW::TrimNeighbors(Point element_id, int max_neighbors, int level) {
     PointsSet neighbors = graph[level][element_id];
 
     if (neighbors.size() > static_cast<size_t>(max_neighbors)) {
+        Coords scratch;
+        const Coords &element_coords = CoordsOf(element_id, scratch);
+
         std::vector<Distance> distances;
         for (Point n: neighbors) {
-            distances.emplace_back(n, GetCoords(element_id), GetCoords(n));
+            distances.push_back(QueryDistance(n, element_coords.data()));
         }
 
         LessDistanceQueue candidates(distances);
@@ -167,21 +743,25 @@ PointsSet HNSW::SelectBestNeighbors(LessDistanceQueue &candidates, Point point,
             tmp.pop();
         }
 
+        Coords scratch;
+        const Coords &point_coords = CoordsOf(point, scratch);
         for (Point p: extended_candidates) {
-            candidates.push(Distance(p, GetCoords(point), GetCoords(p)));
+            candidates.push(QueryDistance(p, point_coords.data()));
         }
     }
 
+    Coords cand_scratch;
     while (!candidates.empty()) {
         if (best_neighbors.size() >= static_cast<size_t>(max_neighbors)) break;
 
         Distance cand_q = candidates.top();
         candidates.pop();
+        const Coords &cand_coords = CoordsOf(cand_q.id, cand_scratch);
 
         // distance between query and candidate should be shortest candidate edge (NSW)
         bool good = true;
         for (Point n: best_neighbors) {
-            Distance cand_n = Distance(n, GetCoords(n), GetCoords(cand_q.id));
+            Distance cand_n = QueryDistance(n, cand_coords.data());
 
             if (cand_n.dist < cand_q.dist) {
                 good = false;
@@ -205,36 +785,78 @@ PointsSet HNSW::SelectBestNeighbors(LessDistanceQueue &candidates, Point point,
     return best_neighbors;
 }
 
-LessDistanceQueue HNSW::SearchLevel(const Coords &query, PointsSet &entry_points_set, int max_neighbors, int level) {
+LessDistanceQueue HNSW::SearchLevel(const float *query, const PointsSet &entry_points_set, int max_neighbors,
+                                    int level, SearchState *state) const {
     std::vector<Distance> distances;
     for (Point n: entry_points_set) {
-        distances.emplace_back(n, query, GetCoords(n));
+        distances.push_back(QueryDistance(n, query));
+    }
+
+    // termination heuristics only make sense on the final level, hard budgets apply everywhere
+    SearchState *adaptive = level == 0 ? state : nullptr;
+    if (state) {
+        state->result.distance_evals += static_cast<long>(distances.size());
+    }
+    if (adaptive) {
+        for (const Distance &d : distances) {
+            adaptive->Offer(d.dist);
+        }
     }
 
     LessDistanceQueue candidates(distances);
     MoreDistanceQueue neighbors(distances);
     PointsSet visited(entry_points_set);
+    Points decoded;  // lists of a compressed level 0, reused across hops
 
-    while (!candidates.empty()) {
+    bool stop = false;
+    while (!candidates.empty() && !stop) {
         Distance candidate = candidates.top();
         candidates.pop();
 
         if (candidate.dist > neighbors.top().dist) break;
+        if (adaptive && adaptive->Converged(candidate.dist)) break;
+
+        bool improved = false;
+        auto expand = [&](const auto &edges) {
+            for (Point e: edges) {
+                if (visited.find(e) == visited.end()) {
+                    if (state && state->Exhausted()) {
+                        stop = true;
+                        break;
+                    }
+                    visited.insert(e);
 
-        for (Point e: graph[level][candidate.id]) {
-            if (visited.find(e) == visited.end()) {
-                visited.insert(e);
+                    Distance e_dist = QueryDistance(e, query);
+                    if (state) {
+                        ++state->result.distance_evals;
+                    }
+                    if (adaptive) {
+                        improved |= adaptive->Offer(e_dist.dist);
+                    }
 
-                Distance e_dist(e, query, GetCoords(e));
-                if (e_dist.dist < neighbors.top().dist || neighbors.size() < static_cast<size_t>(max_neighbors)) {
-                    neighbors.push(e_dist);
-                    candidates.push(e_dist);
+                    if (e_dist.dist < neighbors.top().dist || neighbors.size() < static_cast<size_t>(max_neighbors)) {
+                        neighbors.push(e_dist);
+                        candidates.push(e_dist);
 
-                    if (neighbors.size() > static_cast<size_t>(max_neighbors)) {
-                        neighbors.pop();
+                        if (neighbors.size() > static_cast<size_t>(max_neighbors)) {
+                            neighbors.pop();
+                        }
                     }
                 }
             }
+        };
+        if (level == 0 && !compressed_level_0.Empty()) {
+            compressed_level_0.Decode(candidate.id, decoded);
+            expand(decoded);
+        } else {
+            expand(Neighbors(candidate.id, level));
+        }
+
+        if (state) {
+            ++state->result.hops;
+        }
+        if (adaptive) {
+            adaptive->FinishHop(improved);
         }
     }
 
@@ -247,11 +869,268 @@ LessDistanceQueue HNSW::SearchLevel(const Coords &query, PointsSet &entry_points
     return neighbors_selected;
 }
 
-int HNSW::GenerateLevel() {
-    float r = static_cast<float>(std::rand()) / static_cast<float>(RAND_MAX);
+Points HNSW::SearchLevelGroups(const float *query, const PointsSet &entry_points_set, int max_groups) const {
+    typedef std::set<std::pair<double, Point>> Hits;
+    Hits best;  // best hit per group, the last one bounds the search like the top of the ef heap
+    std::unordered_map<int, Hits::iterator> best_of_group;
+    auto full = [&]() { return best.size() >= static_cast<size_t>(max_groups); };
+
+    // true when the point is within the bound and gets expanded like in SearchLevel, also when its
+    // group already has a closer hit: the way to other groups may lead through it
+    auto offer = [&](const Distance &d) {
+        if (full() && d.dist >= std::prev(best.end())->first) return false;
+
+        int group = groups[d.id];
+        auto current = best_of_group.find(group);
+        if (current != best_of_group.end()) {
+            if (current->second->first <= d.dist) return true;
+            best.erase(current->second);
+        } else if (full()) {
+            auto worst = std::prev(best.end());
+            best_of_group.erase(groups[worst->second]);
+            best.erase(worst);
+        }
+        best_of_group[group] = best.emplace(d.dist, d.id).first;
+        return true;
+    };
+
+    LessDistanceQueue candidates;
+    PointsSet visited(entry_points_set);
+    Points decoded;
+    for (Point n : entry_points_set) {
+        Distance d = QueryDistance(n, query);
+        offer(d);
+        candidates.push(d);
+    }
+
+    while (!candidates.empty()) {
+        Distance candidate = candidates.top();
+        candidates.pop();
+        if (full() && candidate.dist > std::prev(best.end())->first) break;
+
+        auto expand = [&](const auto &edges) {
+            for (Point e : edges) {
+                if (visited.insert(e).second) {
+                    Distance e_dist = QueryDistance(e, query);
+                    if (offer(e_dist)) {
+                        candidates.push(e_dist);
+                    }
+                }
+            }
+        };
+        if (!compressed_level_0.Empty()) {
+            compressed_level_0.Decode(candidate.id, decoded);
+            expand(decoded);
+        } else {
+            expand(Neighbors(candidate.id, 0));
+        }
+    }
+
+    Points points;
+    points.reserve(best.size());
+    for (const auto &hit : best) {
+        points.push_back(hit.second);
+    }
+    return points;
+}
+
+HNSW::SearchState::SearchState(const SearchLimits &limits, int K) :
+    limits(limits),
+    K(static_cast<size_t>(K)),
+    deadline(std::chrono::steady_clock::now() + std::chrono::microseconds(limits.deadline_us)) {}
+
+bool HNSW::SearchState::Exhausted() {
+    if (limits.max_distance_evals > 0 && result.distance_evals >= limits.max_distance_evals) {
+        result.cut_short = true;
+    }
+    // clock is read once per distance evaluation at most, cheap compared to the evaluation itself
+    if (limits.deadline_us > 0 && std::chrono::steady_clock::now() >= deadline) {
+        result.cut_short = true;
+    }
+    return result.cut_short;
+}
+
+bool HNSW::SearchState::Converged(double candidate_dist) {
+    if (top_k.size() < K) return false;
+
+    if (limits.patience > 0 && stale_hops >= limits.patience) {
+        result.early_stopped = true;
+    }
+    if (limits.distance_ratio > 0 && candidate_dist > limits.distance_ratio * top_k.top()) {
+        result.early_stopped = true;
+    }
+    return result.early_stopped;
+}
+
+bool HNSW::SearchState::Offer(double dist) {
+    if (top_k.size() < K) {
+        top_k.push(dist);
+        return true;
+    }
+    if (dist < top_k.top()) {
+        top_k.pop();
+        top_k.push(dist);
+        return true;
+    }
+    return false;
+}
+
+void HNSW::SearchState::FinishHop(bool improved) {
+    stale_hops = improved ? 0 : stale_hops + 1;
+}
+
+int HNSW::GenerateLevel(Point point) const {
+    // uniform in (0, 1] from the top 53 bits, so the logarithm stays finite
+    uint64_t bits = MixBits(seed ^ MixBits(static_cast<uint64_t>(point)));
+    double r = static_cast<double>((bits >> 11) + 1) * 0x1p-53;
     return static_cast<int>(std::floor(-std::log(r) * level_multiplier));
 }
 
+void HNSW::SetSeed(uint64_t seed) {
+    this->seed = seed;
+}
+
+uint64_t HNSW::GetSeed() const {
+    return seed;
+}
+
+std::vector<int> HNSW::GenerateLevels(Point first, size_t count) const {
+    std::vector<int> generated(count);
+    for (size_t i = 0; i < count; ++i) {
+        generated[i] = GenerateLevel(first + static_cast<Point>(i));
+    }
+    return generated;
+}
+
+void HNSW::AppendInput(const Coords &coords) {
+    if (projection.Empty()) {
+        AppendCoords(coords);
+        return;
+    }
+    if (coords.size() != projection.GetInputDim()) {
+        throw std::invalid_argument("vector dimension does not match the projection");
+    }
+    if (rerank) {
+        original_storage.push_back(coords);
+    }
+    AppendCoords(projection.Apply(coords));
+}
+
+void HNSW::SetDim(size_t new_dim) {
+    dim = new_dim;
+    kernels = SelectDistanceKernels(dim);
+}
+
+void HNSW::AppendCoords(const Coords &coords) {
+    if (dim == 0) {
+        SetDim(coords.size());
+    }
+
+    switch (element_type) {
+        case ElementType::Float32:
+            storage.push_back(coords);
+            break;
+        case ElementType::Float16:
+            for (float v : coords) half_storage.push_back(FloatToHalf(v));
+            break;
+        case ElementType::BFloat16:
+            for (float v : coords) half_storage.push_back(FloatToBFloat16(v));
+            break;
+    }
+}
+
+Distance HNSW::QueryDistance(Point point, const float *query) const {
+    double dist;
+    const uint16_t *codes = half_storage.data() + static_cast<size_t>(point) * dim;
+
+    switch (element_type) {
+        case ElementType::Float16:
+            dist = kernels.float16(query, codes, dim);
+            break;
+        case ElementType::BFloat16:
+            dist = kernels.bfloat16(query, codes, dim);
+            break;
+        default:
+            dist = kernels.float32(query, storage[point].data(), dim);
+            break;
+    }
+    return Distance(point, std::sqrt(dist / dim));
+}
+
+const float *HNSW::ProjectQuery(const float *query, Coords &scratch) const {
+    if (projection.Empty()) {
+        return query;
+    }
+    scratch.resize(projection.GetOutputDim());
+    projection.Apply(query, scratch.data());
+    return scratch.data();
+}
+
+void HNSW::RerankExact(const float *query, Points &candidates, int K) const {
+    std::vector<Distance> distances;
+    distances.reserve(candidates.size());
+    for (Point p : candidates) {
+        distances.emplace_back(p, L2SqrFloat(query, original_storage[p].data(), projection.GetInputDim()));
+    }
+
+    size_t top = std::min(distances.size(), static_cast<size_t>(K));
+    std::partial_sort(distances.begin(), distances.begin() + top, distances.end());
+    candidates.resize(top);
+    for (size_t i = 0; i < top; ++i) {
+        candidates[i] = distances[i].id;
+    }
+}
+
+PointsSet HNSW::EntryPoints(const float *query, SearchState *state) const {
+    if (!routing.Empty()) {
+        if (state) {
+            state->result.distance_evals += static_cast<long>(routing.CentroidsNum());
+        }
+        Points routed = routing.Route(query);
+        return PointsSet(routed.begin(), routed.end());
+    }
+
+    PointsSet entry_points_set{entry_point};
+    for (int cur_level = max_level; cur_level > 0; --cur_level) {
+        LessDistanceQueue best_candidates = SearchLevel(query, entry_points_set, 1, cur_level, state);
+        entry_points_set = {best_candidates.top().id};
+    }
+    return entry_points_set;
+}
+
+Point HNSW::GreedyDescent(const float *query, Point start, int level) const {
+    Distance best = QueryDistance(start, query);
+    Point current = -1;
+    while (best.id != current) {
+        current = best.id;
+        for (Point n : Neighbors(current, level)) {
+            Distance d = QueryDistance(n, query);
+            if (d.dist < best.dist) {
+                best = d;
+            }
+        }
+    }
+    return best.id;
+}
+
+const PointsSet& HNSW::Neighbors(Point point, int level) const {
+    // lookups must not insert, searches run concurrently on a shared index
+    static const PointsSet no_neighbors;
+
+    auto level_graph = graph.find(level);
+    if (level_graph == graph.end()) return no_neighbors;
+    auto edges = level_graph->second.find(point);
+    return edges == level_graph->second.end() ? no_neighbors : edges->second;
+}
+
+const Coords& HNSW::CoordsOf(Point point, Coords &scratch) const {
+    if (element_type == ElementType::Float32) {
+        return storage[point];
+    }
+    scratch = DecodeCoords(point);
+    return scratch;
+}
+
 Coords& HNSW::GetCoords(const Point query) {
     return storage[query];
 }
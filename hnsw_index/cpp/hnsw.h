@@ -7,9 +7,61 @@
 #include <unordered_set>
 #include <cmath>
 #include <chrono>
+#include <queue>
+#include <random>
+#include <cstdint>
+#include <string>
 
 #include "utils.h"
+#include "kernels.h"
 #include "types.h"
+#include "arena.h"
+#include "compressed_graph.h"
+#include "query_cache.h"
+#include "projection.h"
+#include "routing.h"
+
+
+// Early-termination knobs for AdaptiveKNNSearch, zero disables a limit.
+struct SearchLimits {
+    int patience = 0;              // stop after this many layer-0 hops without top-K improvement
+    float distance_ratio = 0;      // stop when next candidate is farther than ratio * K-th best distance
+    long max_distance_evals = 0;   // hard budget on distance evaluations
+    long deadline_us = 0;          // hard budget on wall-clock time
+};
+
+
+struct SearchResult {
+    Points points;
+    bool cut_short = false;        // hard budget or deadline was hit, result may be incomplete
+    bool early_stopped = false;    // patience or distance ratio criterion fired
+    long distance_evals = 0;
+    int hops = 0;
+};
+
+
+// One query of a batch, see HNSW::BatchKNNSearch
+struct BatchQuery {
+    const float *query;
+    int K;
+    int ef;
+};
+
+
+// Bytes held by an index, graph parts are estimated from container sizes,
+// arena totals are exact.
+struct MemoryReport {
+    size_t storage = 0;
+    size_t graph_level_0 = 0;
+    size_t graph_upper = 0;
+    size_t metadata = 0;
+    size_t arena_reserved = 0;
+    size_t arena_used = 0;
+
+    size_t Total() const;
+};
+
+void PrintMemoryReport(const std::string &prefix, const MemoryReport &report);
 
 
 class HNSW {
@@ -17,14 +69,50 @@ class HNSW {
     int max_neighbors_0{};
     int ef_construction{};
     float level_multiplier{};
+    uint64_t seed = kDefaultSeed;  // levels derive from it and the point id only, see GenerateLevels
     int max_level = -1;
     Point entry_point = -1;
 
+    ElementType element_type = ElementType::Float32;
+    size_t dim = 0;
+    DistanceKernels kernels;  // specialized for dim when one of the prebuilt sizes, see SetDim
+
     Storage storage;
-    HNSWGraph graph;
-    Levels levels;
+    std::vector<uint16_t> half_storage;  // row-major fp16/bf16 vectors, replaces storage when not Float32
+
+    Projection projection;      // empty unless the index runs in a reduced space
+    bool rerank = false;
+    Storage original_storage;   // input vectors for exact re-ranking, kept only with rerank
+
+    ArenaHandle arena;  // must precede the containers allocated from it
+    HNSWGraph graph{HNSWGraph::allocator_type(arena.get())};
+    Levels levels{Levels::allocator_type(arena.get())};
+
+    mutable QueryCache query_cache;  // disabled unless SetQueryCache is called, cleared on every change
+
+    std::vector<int> groups;    // group id of every point, empty unless SetGroups is called
+
+    CompressedGraph compressed_level_0;  // replaces graph[0] after CompressGraph, the index is read-only then
+
+    RoutingTable routing;       // empty unless set, searches then start layer 0 from its entries
+
+    // binary snapshots copy the containers as they are, see dumps.h
+    friend void DumpHNSWSnapshot(const std::string &snapshot_file, const HNSW &hnsw);
+
+    friend HNSW ReadHNSWSnapshot(const std::string &snapshot_file);
+
+    // the parallel text loader fills the containers directly
+    friend HNSW ReadHNSWParamsFromFile(const std::string &index_file, Storage storage, int threads_num);
+
+    // merges relink the parts' graphs into a new one, see merge.h
+    friend HNSW MergeHNSW(const std::vector<HNSW> &parts, int threads_num);
+
+    // microbenchmarks time private search stages, see bench.cpp
+    friend struct BenchmarkAccess;
 
 public:
+    static constexpr uint64_t kDefaultSeed = std::mt19937_64::default_seed;
+
     HNSW();
 
     HNSW(int max_neighbors, int max_neighbors_0, int ef_construction, float level_multiplier);
@@ -32,18 +120,142 @@ public:
     HNSW(int max_neighbors, int max_neighbors_0, int ef_construction, float level_multiplier,
          int max_level, Point entry_point, Storage &storage, HNSWGraph &graph, Levels &levels);
 
-    void InsertBatch(Storage batch);
+    // copies move the graph into an arena of their own
+    HNSW(const HNSW &other);
+
+    // moves take over the arena together with the containers allocated from it
+    HNSW(HNSW &&other) = default;
+
+    HNSW& operator=(const HNSW &other) = default;
+
+    HNSW& operator=(HNSW &&other) noexcept;
+
+    // Appends the whole batch, then links its points highest level first so the upper levels
+    // are in place before the bulk of level 0 arrives. log_progress prints the insert time every 100 points.
+    void InsertBatch(Storage batch, bool log_progress=false);
 
     void Insert(Point new_point);
 
-    Points KNNSearch(const Coords &query, int K, int ef);
+    // links an appended point at a level drawn beforehand, e.g. by GenerateLevels
+    void Insert(Point new_point, int level);
+
+    // Levels are drawn from a stream keyed by the seed and the point id instead of shared
+    // generator state, so equal seeds, parameters and data build equal indexes on any thread.
+    // Set before inserting; dumps and snapshots keep the seed.
+    void SetSeed(uint64_t seed);
+
+    uint64_t GetSeed() const;
+
+    // levels Insert gives points first .. first + count - 1
+    std::vector<int> GenerateLevels(Point first, size_t count) const;
+
+    // Links points back into a level the way Insert does, for points no search can reach. When
+    // trimming leaves a point without incoming edges its nearest neighbor links to it instead of
+    // its own farthest neighbor.
+    void Reconnect(const Points &points, int level);
+
+    // Appends vectors without linking them, attaches storage to a graph loaded on its own
+    void AppendStorage(const Storage &batch);
+
+    // Searches only read the index and may run concurrently with each other, not with inserts
+    Points KNNSearch(const Coords &query, int K, int ef) const;
+
+    // query must hold GetInputDim() floats
+    Points KNNSearch(const float *query, int K, int ef) const;
+
+    // KNNSearch of every query, same results. Identical queries are searched once and the greedy
+    // descent through the upper levels runs for the whole batch level by level.
+    std::vector<Points> BatchKNNSearch(const std::vector<BatchQuery> &batch) const;
+
+    SearchResult AdaptiveKNNSearch(const Coords &query, int K, int ef, const SearchLimits &limits) const;
+
+    SearchResult AdaptiveKNNSearch(const float *query, int K, int ef, const SearchLimits &limits) const;
+
+    // Best hit of each of the K nearest groups, ordered by distance. The layer-0 result set keeps
+    // one point per group, so ef counts groups, not points. Needs a group for every point.
+    Points GroupedKNNSearch(const Coords &query, int K, int ef) const;
+
+    Points GroupedKNNSearch(const float *query, int K, int ef) const;
+
+    // groups[p] is the group of point p, e.g. the identity of a face; one id per indexed point
+    void SetGroups(std::vector<int> groups);
+
+    const std::vector<int>& GetGroups() const;
+
+    // Caches KNNSearch results within budget_bytes, zero disables. Queries equal after rounding
+    // to quantization_step share results. Adaptive searches are never cached.
+    void SetQueryCache(size_t budget_bytes, float quantization_step=1e-3f);
+
+    const QueryCache& GetQueryCache() const;
+
+    // Inserts and searches take input vectors and run on their projection, with rerank the
+    // ef candidates are re-ranked exactly against the kept input vectors. Set before inserting.
+    void SetProjection(const Projection &projection, bool rerank=false);
+
+    const Projection& GetProjection() const;
+
+    bool GetRerank() const;
+
+    // Re-encodes stored vectors, storage memory halves for Float16/BFloat16
+    void SetElementType(ElementType type);
+
+    size_t Size() const;
+
+    // vector as the graph sees it, in the reduced space when there is a projection
+    Coords DecodeCoords(Point point) const;
+
+    // vector in the input space: the kept original, or the closest point to its projection
+    Coords DecodeInputCoords(Point point) const;
+
+    // Float32 input space vectors for any element type, GetStorage() holds the stored ones
+    // and is empty unless the type is Float32
+    Storage DecodeStorage() const;
 
     const Storage& GetStorage() const;
 
+    ElementType GetElementType() const;
+
+    size_t GetDim() const;
+
+    // dimension of vectors passed to inserts and searches, differs from GetDim() with a projection
+    size_t GetInputDim() const;
+
+    MemoryReport MemoryUsage() const;
+
+    // Expected footprint of an index built from N vectors, assumes full neighbor lists
+    static MemoryReport EstimateMemoryUsage(size_t N, size_t dim, int max_neighbors, int max_neighbors_0,
+                                            float level_multiplier, ElementType element_type=ElementType::Float32);
+
+    // Learns centroids_num k-means centroids over at most max_samples evenly spaced points and
+    // maps each to its nearest point. Searches then start layer 0 from the points of the probes
+    // closest centroids instead of the descent through the upper levels. Zero centroids removes
+    // the table. Must not overlap with searches.
+    void TrainRouting(size_t centroids_num, int probes=4, int iterations=10, size_t max_samples=100000,
+                      int threads_num=0);
+
+    // centroids in the space of GetDim(), entries must be indexed points
+    void SetRoutingTable(RoutingTable table);
+
+    const RoutingTable& GetRoutingTable() const;
+
+    // Moves level 0 into the compressed read-only layout of CompressedGraph. Searches decode the
+    // lists on the fly, inserts throw until DecompressGraph; meant for frozen serving indexes.
+    void CompressGraph();
+
+    void DecompressGraph();
+
+    bool IsGraphCompressed() const;
+
+    const CompressedGraph& GetCompressedGraph() const;
+
     const Levels& GetLevels() const;
 
+    // without level 0 while the graph is compressed
     const HNSWGraph& GetGraph() const;
 
+    // copy of the graph with level 0 decoded, for readers of the whole graph like dumps
+    HNSWGraph GetDecompressedGraph() const;
+
     const int GetMaxLevel() const;
 
     const Point GetEntryPoint() const;
@@ -57,6 +269,31 @@ public:
     const float GetLevelMultiplier() const;
 
 private:
+    struct SearchState {
+        const SearchLimits &limits;
+        size_t K;
+        std::chrono::steady_clock::time_point deadline;
+        std::priority_queue<double> top_k;
+        int stale_hops = 0;
+        SearchResult result;
+
+        SearchState(const SearchLimits &limits, int K);
+
+        bool Exhausted();
+
+        bool Converged(double candidate_dist);
+
+        bool Offer(double dist);
+
+        void FinishHop(bool improved);
+    };
+
+    // throws while level 0 is compressed
+    void CheckWritable() const;
+
+    // links a point whose level is set on levels lowest_level..level, as inserts do from level 0
+    void Link(Point new_point, int level, int lowest_level);
+
     void TrimNeighbors(Point element_id, int max_neighbors, int level);
 
     void MutuallyConnect(Point first, Point second, int level);
@@ -64,9 +301,41 @@ private:
     PointsSet SelectBestNeighbors(LessDistanceQueue &candidates, Point point, int max_neighbors, int level,
                                   bool extend_candidates=false, bool keep_pruned=false);
 
-    LessDistanceQueue SearchLevel(const Coords &query, PointsSet &entry_points_set, int max_neighbors, int level);
+    Points UncachedKNNSearch(const float *query, int K, int ef) const;
+
+    // the closest point to the query on the level by moving to better neighbors, as SearchLevel
+    // with ef 1 does, without its queues and visited set
+    Point GreedyDescent(const float *query, Point start, int level) const;
+
+    // layer-0 entry points of a query: the routed ones with a routing table, the end of the
+    // greedy descent through the upper levels otherwise
+    PointsSet EntryPoints(const float *query, SearchState *state=nullptr) const;
+
+    // projected query in scratch, or the query itself without a projection
+    const float *ProjectQuery(const float *query, Coords &scratch) const;
+
+    // the best K of the candidates by exact distance to the kept input vectors
+    void RerankExact(const float *query, Points &candidates, int K) const;
+
+    void AppendInput(const Coords &coords);
+
+    void SetDim(size_t new_dim);
+
+    LessDistanceQueue SearchLevel(const float *query, const PointsSet &entry_points_set, int max_neighbors, int level,
+                                  SearchState *state=nullptr) const;
+
+    // layer-0 search keeping the best point of at most max_groups groups, nearest first
+    Points SearchLevelGroups(const float *query, const PointsSet &entry_points_set, int max_groups) const;
+
+    const PointsSet& Neighbors(Point point, int level) const;
+
+    int GenerateLevel(Point point) const;
+
+    void AppendCoords(const Coords &coords);
+
+    Distance QueryDistance(Point point, const float *query) const;
 
-    int GenerateLevel();
+    const Coords& CoordsOf(Point point, Coords &scratch) const;
 
     Coords& GetCoords(Point query);
 };
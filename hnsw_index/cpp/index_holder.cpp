@@ -0,0 +1,52 @@
+#include "dumps.h"
+#include "index_holder.h"
+
+
+IndexHolder::IndexHolder() : current(std::make_shared<HNSW>()) {}
+
+IndexHolder::IndexHolder(HNSW index) : current(std::make_shared<HNSW>(std::move(index))) {}
+
+std::shared_ptr<HNSW> IndexHolder::Get() const {
+    return std::atomic_load(&current);
+}
+
+std::shared_ptr<HNSW> IndexHolder::Swap(std::shared_ptr<HNSW> index) {
+    std::lock_guard<std::mutex> lock(swap_mutex);
+    std::shared_ptr<const NumaReplicas> index_replicas;
+    if (numa_placement != NumaPlacement::None) {
+        index_replicas = std::make_shared<NumaReplicas>(*index, numa_placement);
+    }
+    // searches on the replicas see the new index a moment before those calling Get()
+    std::atomic_store(&replicas, index_replicas);
+    std::shared_ptr<HNSW> previous = std::atomic_exchange(&current, std::move(index));
+    ++version;
+    return previous;
+}
+
+void IndexHolder::SetNumaPlacement(NumaPlacement placement) {
+    std::lock_guard<std::mutex> lock(swap_mutex);
+    numa_placement = placement;
+    std::shared_ptr<const NumaReplicas> index_replicas;
+    if (placement != NumaPlacement::None) {
+        index_replicas = std::make_shared<NumaReplicas>(*Get(), placement);
+    }
+    std::atomic_store(&replicas, index_replicas);
+}
+
+std::shared_ptr<const NumaReplicas> IndexHolder::GetReplicas() const {
+    return std::atomic_load(&replicas);
+}
+
+void IndexHolder::Reload(const std::string &storage_file, const std::string &index_file) {
+    std::lock_guard<std::mutex> lock(reload_mutex);
+    auto index = std::make_shared<HNSW>(index_file.empty() ? ReadHNSWSnapshot(storage_file)
+                                                           : ReadHNSWFromFile(storage_file, index_file));
+    const QueryCache &cache = Get()->GetQueryCache();
+    index->SetQueryCache(cache.GetBudget(), cache.GetQuantizationStep());
+    // the old index goes away here unless a search still holds it
+    Swap(std::move(index));
+}
+
+long IndexHolder::Version() const {
+    return version;
+}
@@ -0,0 +1,55 @@
+#ifndef HNSW_INDEX_HOLDER
+#define HNSW_INDEX_HOLDER
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "hnsw.h"
+#include "numa_replicas.h"
+
+
+// Serving slot for an index that can be replaced while searches run. Searches take a
+// reference with Get() and keep using that index until they finish, Reload() builds the
+// new index aside and swaps it in atomically, the old one is freed by its last user.
+// The held index is never changed in place: changes go to a copy that is swapped in.
+// With a NUMA placement the node copies of every index are built before it is swapped in,
+// by the swapping thread, so searches never wait for them.
+class IndexHolder {
+    std::shared_ptr<HNSW> current;
+    std::shared_ptr<const NumaReplicas> replicas;  // of current, nullptr without a placement
+    NumaPlacement numa_placement = NumaPlacement::None;
+    std::mutex reload_mutex;  // one reload at a time, searches never take it
+    std::mutex swap_mutex;    // publishes an index and its replicas together, searches never take it
+    std::atomic<long> version{0};
+
+public:
+    IndexHolder();
+
+    explicit IndexHolder(HNSW index);
+
+    IndexHolder(const IndexHolder&) = delete;
+
+    IndexHolder& operator=(const IndexHolder&) = delete;
+
+    std::shared_ptr<HNSW> Get() const;
+
+    // returns the previous index, which is freed when the caller and running searches drop it
+    std::shared_ptr<HNSW> Swap(std::shared_ptr<HNSW> index);
+
+    // copies the current and every later index to the NUMA nodes, None drops the copies
+    void SetNumaPlacement(NumaPlacement placement);
+
+    // NUMA copies of the current index, nullptr without a placement
+    std::shared_ptr<const NumaReplicas> GetReplicas() const;
+
+    // Loads a binary snapshot, or text dumps when index_file is set, and swaps it in.
+    // The query cache settings carry over, its contents do not.
+    void Reload(const std::string &storage_file, const std::string &index_file="");
+
+    // number of swaps so far
+    long Version() const;
+};
+
+#endif // HNSW_INDEX_HOLDER
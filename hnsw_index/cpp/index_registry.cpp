@@ -0,0 +1,184 @@
+#include <stdexcept>
+
+#include "dumps.h"
+#include "index_registry.h"
+
+
+IndexRegistry::IndexRegistry(const RegistryOptions &options) :
+    options(options),
+    scheduler(options.scheduler) {}
+
+void IndexRegistry::Register(const std::string &name, const std::string &storage_file,
+                             const std::string &index_file) {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto found = entries.find(name);
+    if (found == entries.end()) {
+        std::unique_ptr<Entry> entry(new Entry());
+        entry->storage_file = storage_file;
+        entry->index_file = index_file;
+        entries.emplace(name, std::move(entry));
+        return;
+    }
+
+    // a load of the old files finishes first, so it cannot install them afterwards
+    Entry &entry = *found->second;
+    lock.unlock();
+    std::lock_guard<std::mutex> load_lock(entry.load_mutex);
+    lock.lock();
+    entry.storage_file = storage_file;
+    entry.index_file = index_file;
+    Release(entry);
+}
+
+std::shared_ptr<HNSW> IndexRegistry::Get(const std::string &name) {
+    return Acquire(name).index;
+}
+
+void IndexRegistry::Reload(const std::string &name) {
+    Entry *entry;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entry = &Find(name);
+    }
+    std::lock_guard<std::mutex> load_lock(entry->load_mutex);
+    Load(*entry);
+}
+
+void IndexRegistry::Unload(const std::string &name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Release(Find(name));
+}
+
+std::vector<Points> IndexRegistry::Search(const std::string &name, const float *queries, size_t count,
+                                          size_t dim, int K, int ef) {
+    Loaded loaded = Acquire(name);
+    if (options.scheduler.window_us <= 0 && options.scheduler.numa_placement == NumaPlacement::None) {
+        if (dim != loaded.index->GetInputDim()) {
+            throw std::invalid_argument("query dimension does not match the index");
+        }
+        std::vector<BatchQuery> batch;
+        batch.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            batch.push_back({queries + i * dim, K, ef});
+        }
+        return loaded.index->BatchKNNSearch(batch);
+    }
+    return scheduler.Search(loaded.index, queries, count, dim, K, ef, loaded.replicas);
+}
+
+std::vector<std::string> IndexRegistry::Names() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::string> names;
+    for (const auto &entry : entries) {
+        names.push_back(entry.first);
+    }
+    return names;
+}
+
+bool IndexRegistry::IsLoaded(const std::string &name) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return static_cast<bool>(Find(name).index);
+}
+
+size_t IndexRegistry::LoadedBytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return loaded_bytes;
+}
+
+long IndexRegistry::GetLoads() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return loads_num;
+}
+
+long IndexRegistry::GetEvictions() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return evictions_num;
+}
+
+const QueryScheduler& IndexRegistry::GetScheduler() const {
+    return scheduler;
+}
+
+IndexRegistry::Entry& IndexRegistry::Find(const std::string &name) const {
+    auto found = entries.find(name);
+    if (found == entries.end()) {
+        throw std::out_of_range("no index named " + name);
+    }
+    return *found->second;
+}
+
+IndexRegistry::Loaded IndexRegistry::Acquire(const std::string &name) {
+    Entry *entry;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entry = &Find(name);
+        entry->last_use = ++clock;
+        if (entry->index) return {entry->index, entry->replicas};
+    }
+
+    std::lock_guard<std::mutex> load_lock(entry->load_mutex);
+    {
+        // loaded by another caller meanwhile
+        std::lock_guard<std::mutex> lock(mutex);
+        if (entry->index) return {entry->index, entry->replicas};
+    }
+    return Load(*entry);
+}
+
+IndexRegistry::Loaded IndexRegistry::Load(Entry &entry) {
+    std::string storage_file;
+    std::string index_file;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        storage_file = entry.storage_file;
+        index_file = entry.index_file;
+    }
+
+    // the slow part runs without the registry lock, other indexes keep serving
+    auto index = std::make_shared<HNSW>(index_file.empty() ? ReadHNSWSnapshot(storage_file)
+                                                           : ReadHNSWFromFile(storage_file, index_file));
+    index->SetQueryCache(options.query_cache_bytes);
+    std::shared_ptr<const NumaReplicas> replicas;
+    size_t copies = 1;
+    if (options.scheduler.numa_placement != NumaPlacement::None) {
+        replicas = std::make_shared<NumaReplicas>(*index, options.scheduler.numa_placement);
+        copies += replicas->ReplicasNum();
+    }
+    size_t bytes = (index->MemoryUsage().Total() + options.query_cache_bytes) * copies;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    Release(entry);
+    entry.index = index;
+    entry.replicas = replicas;
+    entry.bytes = bytes;
+    entry.last_use = ++clock;
+    loaded_bytes += bytes;
+    ++loads_num;
+    Evict(&entry);
+    return {index, replicas};
+}
+
+void IndexRegistry::Evict(const Entry *keep) {
+    while (options.memory_budget > 0 && loaded_bytes > options.memory_budget) {
+        Entry *oldest = nullptr;
+        for (const auto &named : entries) {
+            Entry *entry = named.second.get();
+            if (entry == keep || !entry->index) continue;
+            if (!oldest || entry->last_use < oldest->last_use) {
+                oldest = entry;
+            }
+        }
+        // an index over the budget on its own still serves
+        if (!oldest) return;
+        Release(*oldest);
+        ++evictions_num;
+    }
+}
+
+void IndexRegistry::Release(Entry &entry) {
+    if (!entry.index) return;
+    loaded_bytes -= entry.bytes;
+    entry.bytes = 0;
+    entry.index.reset();
+    entry.replicas.reset();
+}
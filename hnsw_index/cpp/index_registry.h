@@ -0,0 +1,106 @@
+#ifndef HNSW_INDEX_REGISTRY
+#define HNSW_INDEX_REGISTRY
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "hnsw.h"
+#include "query_scheduler.h"
+
+
+struct RegistryOptions {
+    // bytes of loaded indexes, each charged its MemoryUsage().Total() and query cache budget per
+    // copy, NUMA copies included; past it the least recently used indexes are unloaded, zero is unlimited
+    size_t memory_budget = 0;
+    size_t query_cache_bytes = 0;  // query cache of every loaded index, zero disables it
+    // one pool for the searches of every index; with a NUMA placement every index is copied to
+    // the nodes when it loads. Without a placement a window of zero or less turns batching off,
+    // searches then run on the calling thread.
+    SchedulerOptions scheduler;
+};
+
+
+// Named indexes served from one process. Register() only records where an index lives, the
+// first Get() or Search() loads it: a binary snapshot is read from a mmap'd file, text dumps
+// when an index file is given. Loaded indexes share the scheduler pool and the memory budget.
+// An unloaded index is freed by its last running search and loads again on next use.
+class IndexRegistry {
+    struct Entry {
+        std::string storage_file;
+        std::string index_file;
+        std::shared_ptr<HNSW> index;   // nullptr while not loaded
+        std::shared_ptr<const NumaReplicas> replicas;  // of index, nullptr without a placement
+        size_t bytes = 0;
+        unsigned long last_use = 0;
+        std::mutex load_mutex;         // one load of the index at a time, searches never take it
+    };
+
+    struct Loaded {
+        std::shared_ptr<HNSW> index;
+        std::shared_ptr<const NumaReplicas> replicas;
+    };
+
+    RegistryOptions options;
+    mutable std::mutex mutex;          // guards the map and the entries' fields but load_mutex
+    std::map<std::string, std::unique_ptr<Entry>> entries;
+    unsigned long clock = 0;
+    size_t loaded_bytes = 0;
+    long loads_num = 0;
+    long evictions_num = 0;
+    QueryScheduler scheduler;
+
+public:
+    explicit IndexRegistry(const RegistryOptions &options=RegistryOptions());
+
+    IndexRegistry(const IndexRegistry&) = delete;
+
+    IndexRegistry& operator=(const IndexRegistry&) = delete;
+
+    // Adds the index, or points an existing name at new files and unloads the old index
+    void Register(const std::string &name, const std::string &storage_file, const std::string &index_file="");
+
+    // the index of name, loaded if needed; throws std::out_of_range for unknown names
+    std::shared_ptr<HNSW> Get(const std::string &name);
+
+    // Loads the registered files aside and swaps them in, searches running meanwhile finish on the old index
+    void Reload(const std::string &name);
+
+    // frees the index once running searches are done, the name stays registered
+    void Unload(const std::string &name);
+
+    // count row-major queries of dim floats, batched with the concurrent searches of every index
+    // unless batching is off
+    std::vector<Points> Search(const std::string &name, const float *queries, size_t count, size_t dim,
+                               int K, int ef);
+
+    std::vector<std::string> Names() const;
+
+    bool IsLoaded(const std::string &name) const;
+
+    size_t LoadedBytes() const;
+
+    long GetLoads() const;
+
+    long GetEvictions() const;
+
+    const QueryScheduler& GetScheduler() const;
+
+private:
+    Entry& Find(const std::string &name) const;
+
+    // the index of name and its NUMA copies, loaded if needed
+    Loaded Acquire(const std::string &name);
+
+    // loads the entry's files with its load_mutex held and installs the index
+    Loaded Load(Entry &entry);
+
+    // unloads least recently used indexes but keep until the budget fits, under the mutex
+    void Evict(const Entry *keep);
+
+    void Release(Entry &entry);
+};
+
+#endif // HNSW_INDEX_REGISTRY
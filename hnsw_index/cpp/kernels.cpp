@@ -0,0 +1,415 @@
+#include <cstring>
+#include <immintrin.h>
+#include "kernels.h"
+
+
+uint16_t FloatToHalf(float value) {
+    uint32_t x;
+    std::memcpy(&x, &value, sizeof(x));
+
+    uint32_t sign = x & 0x80000000u;
+    x ^= sign;
+
+    uint32_t h;
+    if (x >= (127u + 16) << 23) {
+        // overflow goes to infinity, NaN stays quiet NaN
+        h = x > 255u << 23 ? 0x7e00 : 0x7c00;
+    } else if (x < 113u << 23) {
+        // half subnormal or zero: let float addition align and round the mantissa
+        const uint32_t magic_bits = 126u << 23;
+        float magic, f;
+        std::memcpy(&magic, &magic_bits, sizeof(magic));
+        std::memcpy(&f, &x, sizeof(f));
+        f += magic;
+        std::memcpy(&h, &f, sizeof(h));
+        h -= magic_bits;
+    } else {
+        uint32_t mant_odd = (x >> 13) & 1;
+        x += (static_cast<uint32_t>(15 - 127) << 23) + 0xfff + mant_odd;
+        h = x >> 13;
+    }
+
+    return static_cast<uint16_t>(h | (sign >> 16));
+}
+
+float HalfToFloat(uint16_t value) {
+    const uint32_t shifted_exp = 0x7c00u << 13;
+    uint32_t x = (value & 0x7fffu) << 13;
+    uint32_t exp = x & shifted_exp;
+    x += (127u - 15) << 23;
+
+    float result;
+    if (exp == shifted_exp) {
+        x += (128u - 16) << 23;
+        std::memcpy(&result, &x, sizeof(result));
+    } else if (exp == 0) {
+        // subnormal: renormalize through float subtraction
+        const uint32_t magic_bits = 113u << 23;
+        float magic;
+        std::memcpy(&magic, &magic_bits, sizeof(magic));
+        x += 1u << 23;
+        std::memcpy(&result, &x, sizeof(result));
+        result -= magic;
+    } else {
+        std::memcpy(&result, &x, sizeof(result));
+    }
+
+    uint32_t bits;
+    std::memcpy(&bits, &result, sizeof(bits));
+    bits |= static_cast<uint32_t>(value & 0x8000u) << 16;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+uint16_t FloatToBFloat16(float value) {
+    uint32_t x;
+    std::memcpy(&x, &value, sizeof(x));
+
+    if ((x & 0x7fffffffu) > 0x7f800000u) {
+        return static_cast<uint16_t>((x >> 16) | 0x40);
+    }
+    x += 0x7fff + ((x >> 16) & 1);
+    return static_cast<uint16_t>(x >> 16);
+}
+
+float BFloat16ToFloat(uint16_t value) {
+    uint32_t x = static_cast<uint32_t>(value) << 16;
+    float result;
+    std::memcpy(&result, &x, sizeof(result));
+    return result;
+}
+
+
+static float L2SqrFloatScalar(const float *x, const float *y, size_t dim) {
+    float sum = 0;
+    for (size_t i = 0; i < dim; ++i) {
+        float d = x[i] - y[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+static float L2SqrHalfScalar(const float *x, const uint16_t *y, size_t dim) {
+    float sum = 0;
+    for (size_t i = 0; i < dim; ++i) {
+        float d = x[i] - HalfToFloat(y[i]);
+        sum += d * d;
+    }
+    return sum;
+}
+
+static float L2SqrBFloat16Scalar(const float *x, const uint16_t *y, size_t dim) {
+    float sum = 0;
+    for (size_t i = 0; i < dim; ++i) {
+        float d = x[i] - BFloat16ToFloat(y[i]);
+        sum += d * d;
+    }
+    return sum;
+}
+
+static float DotFloatScalar(const float *x, const float *y, size_t dim) {
+    float sum = 0;
+    for (size_t i = 0; i < dim; ++i) {
+        sum += x[i] * y[i];
+    }
+    return sum;
+}
+
+
+// SIMD kernels clear the upper register state before falling back to the scalar tail,
+// the compiler does not insert vzeroupper for target-attributed functions on its own and
+// the AVX to SSE transition penalty costs more than the whole distance.
+
+__attribute__((target("avx2,fma")))
+static float HorizontalSum(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+    return _mm_cvtss_f32(sum);
+}
+
+__attribute__((target("avx2,fma")))
+static float L2SqrFloatAVX2(const float *x, const float *y, size_t dim) {
+    __m256 sum = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        __m256 d = _mm256_sub_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i));
+        sum = _mm256_fmadd_ps(d, d, sum);
+    }
+    float result = HorizontalSum(sum);
+    _mm256_zeroupper();
+    return result + L2SqrFloatScalar(x + i, y + i, dim - i);
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static float L2SqrHalfAVX2(const float *x, const uint16_t *y, size_t dim) {
+    __m256 sum = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        __m256 vy = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(y + i)));
+        __m256 d = _mm256_sub_ps(_mm256_loadu_ps(x + i), vy);
+        sum = _mm256_fmadd_ps(d, d, sum);
+    }
+    float result = HorizontalSum(sum);
+    _mm256_zeroupper();
+    return result + L2SqrHalfScalar(x + i, y + i, dim - i);
+}
+
+__attribute__((target("avx2,fma")))
+static float L2SqrBFloat16AVX2(const float *x, const uint16_t *y, size_t dim) {
+    __m256 sum = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        // bfloat16 is the upper half of a float, widening is an exact shift
+        __m256i wide = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(y + i)));
+        __m256 vy = _mm256_castsi256_ps(_mm256_slli_epi32(wide, 16));
+        __m256 d = _mm256_sub_ps(_mm256_loadu_ps(x + i), vy);
+        sum = _mm256_fmadd_ps(d, d, sum);
+    }
+    float result = HorizontalSum(sum);
+    _mm256_zeroupper();
+    return result + L2SqrBFloat16Scalar(x + i, y + i, dim - i);
+}
+
+__attribute__((target("avx2,fma")))
+static void MatVecFloatAVX2(const float *matrix, const float *x, size_t rows, size_t cols, float *out) {
+    for (size_t r = 0; r < rows; ++r) {
+        const float *row = matrix + r * cols;
+        __m256 sum = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 8 <= cols; i += 8) {
+            sum = _mm256_fmadd_ps(_mm256_loadu_ps(row + i), _mm256_loadu_ps(x + i), sum);
+        }
+        out[r] = HorizontalSum(sum);
+        _mm256_zeroupper();
+        out[r] += DotFloatScalar(row + i, x + i, cols - i);
+    }
+}
+
+__attribute__((target("avx512f")))
+static float L2SqrFloatAVX512(const float *x, const float *y, size_t dim) {
+    __m512 sum = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m512 d = _mm512_sub_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i));
+        sum = _mm512_fmadd_ps(d, d, sum);
+    }
+    float result = _mm512_reduce_add_ps(sum);
+    _mm256_zeroupper();
+    return result + L2SqrFloatScalar(x + i, y + i, dim - i);
+}
+
+__attribute__((target("avx512f")))
+static float L2SqrHalfAVX512(const float *x, const uint16_t *y, size_t dim) {
+    __m512 sum = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m512 vy = _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(y + i)));
+        __m512 d = _mm512_sub_ps(_mm512_loadu_ps(x + i), vy);
+        sum = _mm512_fmadd_ps(d, d, sum);
+    }
+    float result = _mm512_reduce_add_ps(sum);
+    _mm256_zeroupper();
+    return result + L2SqrHalfScalar(x + i, y + i, dim - i);
+}
+
+__attribute__((target("avx512f")))
+static float L2SqrBFloat16AVX512(const float *x, const uint16_t *y, size_t dim) {
+    __m512 sum = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m512i wide = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(y + i)));
+        __m512 vy = _mm512_castsi512_ps(_mm512_slli_epi32(wide, 16));
+        __m512 d = _mm512_sub_ps(_mm512_loadu_ps(x + i), vy);
+        sum = _mm512_fmadd_ps(d, d, sum);
+    }
+    float result = _mm512_reduce_add_ps(sum);
+    _mm256_zeroupper();
+    return result + L2SqrBFloat16Scalar(x + i, y + i, dim - i);
+}
+
+__attribute__((target("avx512f")))
+static void MatVecFloatAVX512(const float *matrix, const float *x, size_t rows, size_t cols, float *out) {
+    for (size_t r = 0; r < rows; ++r) {
+        const float *row = matrix + r * cols;
+        __m512 sum = _mm512_setzero_ps();
+        size_t i = 0;
+        for (; i + 16 <= cols; i += 16) {
+            sum = _mm512_fmadd_ps(_mm512_loadu_ps(row + i), _mm512_loadu_ps(x + i), sum);
+        }
+        out[r] = _mm512_reduce_add_ps(sum);
+        _mm256_zeroupper();
+        out[r] += DotFloatScalar(row + i, x + i, cols - i);
+    }
+}
+
+
+// Lane loaders for the fixed-dimension kernels, one per element type
+struct LoadFloat {
+    typedef float Element;
+
+    __attribute__((target("avx2,fma,f16c")))
+    static __m256 Load8(const float *p) {
+        return _mm256_loadu_ps(p);
+    }
+
+    __attribute__((target("avx512f")))
+    static __m512 Load16(const float *p) {
+        return _mm512_loadu_ps(p);
+    }
+};
+
+struct LoadHalf {
+    typedef uint16_t Element;
+
+    __attribute__((target("avx2,fma,f16c")))
+    static __m256 Load8(const uint16_t *p) {
+        return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+    }
+
+    __attribute__((target("avx512f")))
+    static __m512 Load16(const uint16_t *p) {
+        return _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)));
+    }
+};
+
+struct LoadBFloat16 {
+    typedef uint16_t Element;
+
+    __attribute__((target("avx2,fma,f16c")))
+    static __m256 Load8(const uint16_t *p) {
+        __m256i wide = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+        return _mm256_castsi256_ps(_mm256_slli_epi32(wide, 16));
+    }
+
+    __attribute__((target("avx512f")))
+    static __m512 Load16(const uint16_t *p) {
+        __m512i wide = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)));
+        return _mm512_castsi512_ps(_mm512_slli_epi32(wide, 16));
+    }
+};
+
+// Four independent accumulators hide the FMA latency, the trip count is a constant so
+// the loop is unrolled completely and there is no tail.
+template<size_t Dim, class Loader>
+__attribute__((target("avx2,fma,f16c")))
+static float L2SqrFixedAVX2(const float *x, const typename Loader::Element *y, size_t) {
+    static_assert(Dim % 32 == 0, "fixed kernels consume four registers per step");
+    __m256 sum[4] = {_mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps()};
+#pragma GCC unroll 16
+    for (size_t i = 0; i < Dim; i += 32) {
+#pragma GCC unroll 4
+        for (size_t k = 0; k < 4; ++k) {
+            __m256 d = _mm256_sub_ps(_mm256_loadu_ps(x + i + 8 * k), Loader::Load8(y + i + 8 * k));
+            sum[k] = _mm256_fmadd_ps(d, d, sum[k]);
+        }
+    }
+    float result = HorizontalSum(_mm256_add_ps(_mm256_add_ps(sum[0], sum[1]), _mm256_add_ps(sum[2], sum[3])));
+    _mm256_zeroupper();
+    return result;
+}
+
+template<size_t Dim, class Loader>
+__attribute__((target("avx512f")))
+static float L2SqrFixedAVX512(const float *x, const typename Loader::Element *y, size_t) {
+    static_assert(Dim % 64 == 0, "fixed kernels consume four registers per step");
+    __m512 sum[4] = {_mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps()};
+#pragma GCC unroll 8
+    for (size_t i = 0; i < Dim; i += 64) {
+#pragma GCC unroll 4
+        for (size_t k = 0; k < 4; ++k) {
+            __m512 d = _mm512_sub_ps(_mm512_loadu_ps(x + i + 16 * k), Loader::Load16(y + i + 16 * k));
+            sum[k] = _mm512_fmadd_ps(d, d, sum[k]);
+        }
+    }
+    float result = _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(sum[0], sum[1]), _mm512_add_ps(sum[2], sum[3])));
+    _mm256_zeroupper();
+    return result;
+}
+
+
+enum class KernelLevel { Scalar, AVX2, AVX512 };
+
+static KernelLevel DetectKernelLevel() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return KernelLevel::AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c")) {
+        return KernelLevel::AVX2;
+    }
+    return KernelLevel::Scalar;
+}
+
+static const KernelLevel kernel_level = DetectKernelLevel();
+
+
+float L2SqrFloat(const float *x, const float *y, size_t dim) {
+    switch (kernel_level) {
+        case KernelLevel::AVX512: return L2SqrFloatAVX512(x, y, dim);
+        case KernelLevel::AVX2: return L2SqrFloatAVX2(x, y, dim);
+        default: return L2SqrFloatScalar(x, y, dim);
+    }
+}
+
+float L2SqrHalf(const float *x, const uint16_t *y, size_t dim) {
+    switch (kernel_level) {
+        case KernelLevel::AVX512: return L2SqrHalfAVX512(x, y, dim);
+        case KernelLevel::AVX2: return L2SqrHalfAVX2(x, y, dim);
+        default: return L2SqrHalfScalar(x, y, dim);
+    }
+}
+
+float L2SqrBFloat16(const float *x, const uint16_t *y, size_t dim) {
+    switch (kernel_level) {
+        case KernelLevel::AVX512: return L2SqrBFloat16AVX512(x, y, dim);
+        case KernelLevel::AVX2: return L2SqrBFloat16AVX2(x, y, dim);
+        default: return L2SqrBFloat16Scalar(x, y, dim);
+    }
+}
+
+void MatVecFloat(const float *matrix, const float *x, size_t rows, size_t cols, float *out) {
+    switch (kernel_level) {
+        case KernelLevel::AVX512:
+            MatVecFloatAVX512(matrix, x, rows, cols, out);
+            break;
+        case KernelLevel::AVX2:
+            MatVecFloatAVX2(matrix, x, rows, cols, out);
+            break;
+        default:
+            for (size_t r = 0; r < rows; ++r) {
+                out[r] = DotFloatScalar(matrix + r * cols, x, cols);
+            }
+            break;
+    }
+}
+
+
+template<size_t Dim>
+static DistanceKernels FixedDistanceKernels() {
+    DistanceKernels kernels;
+    switch (kernel_level) {
+        case KernelLevel::AVX512:
+            kernels.float32 = L2SqrFixedAVX512<Dim, LoadFloat>;
+            kernels.float16 = L2SqrFixedAVX512<Dim, LoadHalf>;
+            kernels.bfloat16 = L2SqrFixedAVX512<Dim, LoadBFloat16>;
+            kernels.specialized = true;
+            break;
+        case KernelLevel::AVX2:
+            kernels.float32 = L2SqrFixedAVX2<Dim, LoadFloat>;
+            kernels.float16 = L2SqrFixedAVX2<Dim, LoadHalf>;
+            kernels.bfloat16 = L2SqrFixedAVX2<Dim, LoadBFloat16>;
+            kernels.specialized = true;
+            break;
+        default:
+            break;
+    }
+    return kernels;
+}
+
+DistanceKernels SelectDistanceKernels(size_t dim) {
+    switch (dim) {
+        case 128: return FixedDistanceKernels<128>();
+        case 256: return FixedDistanceKernels<256>();
+        case 512: return FixedDistanceKernels<512>();
+        default: return DistanceKernels();
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef HNSW_KERNELS
+#define HNSW_KERNELS
+
+#include <cstddef>
+#include <cstdint>
+
+
+// Squared L2 distance kernels. The best implementation (AVX-512F, AVX2+FMA+F16C or scalar)
+// is picked once at startup from the CPU features, so the binary does not need -march flags.
+
+float L2SqrFloat(const float *x, const float *y, size_t dim);
+
+float L2SqrHalf(const float *x, const uint16_t *y, size_t dim);
+
+float L2SqrBFloat16(const float *x, const uint16_t *y, size_t dim);
+
+
+typedef float (*L2SqrFloatKernel)(const float *x, const float *y, size_t dim);
+
+typedef float (*L2SqrHalfKernel)(const float *x, const uint16_t *y, size_t dim);
+
+// Distance kernels for vectors of one fixed dimension. Dimensions 128, 256 and 512 get
+// completely unrolled SIMD kernels without tail handling, others the generic ones above.
+struct DistanceKernels {
+    L2SqrFloatKernel float32 = L2SqrFloat;
+    L2SqrHalfKernel float16 = L2SqrHalf;
+    L2SqrHalfKernel bfloat16 = L2SqrBFloat16;
+    bool specialized = false;
+};
+
+DistanceKernels SelectDistanceKernels(size_t dim);
+
+
+// Matrix-vector product out = matrix * x, matrix is rows x cols in row-major order
+void MatVecFloat(const float *matrix, const float *x, size_t rows, size_t cols, float *out);
+
+
+// IEEE 754 binary16 and bfloat16 conversions, both round to nearest even.
+
+uint16_t FloatToHalf(float value);
+
+float HalfToFloat(uint16_t value);
+
+uint16_t FloatToBFloat16(float value);
+
+float BFloat16ToFloat(uint16_t value);
+
+#endif // HNSW_KERNELS
@@ -1,14 +1,18 @@
 #include <getopt.h>
 #include <iostream>
+#include <sstream>
 #include "hnsw.h"
 #include "dumps.h"
+#include "graph_stats.h"
+#include "merge.h"
 #include "tests.h"
 
 
-bool build, load, test;
-int max_neighbors, max_neighbors_0, ef_construction;
-std::string storage_path, params_path;
-float level_multiplier;
+bool build, load, test, huge_pages, rerank, graph_stats, repair, compress_graph;
+int max_neighbors, max_neighbors_0, ef_construction, partitions, routing_centroids, routing_probes = 4;
+std::string storage_path, params_path, element_type, disk_path, snapshot_path, groups_path, merge_paths;
+float level_multiplier, pca_variance;
+uint64_t seed = HNSW::kDefaultSeed;
 
 
 void PrintHelp() {
@@ -20,15 +24,30 @@ void PrintHelp() {
         "--max-neighbors-0 (-n) <int>:   Degree limit for level 0\n"
         "--ef-construction (-e) <int>:   Degree limit during build\n"
         "--level-mult (-m) <float>:      Level multiplier during build\n"
+        "--seed (-x) <int>:              Seed of the level assignment, equal seeds build equal indexes\n"
         "--storage (-s) <fname>:         File to read/write storage\n"
         "--params (-p) <fname>:          File to read/write params\n"
+        "--element-type (-E) <type>:     Vector storage type: fp32 (default), fp16 or bf16\n"
+        "--huge-pages (-H)               Back index arena with 2MB transparent huge pages\n"
+        "--disk-layout (-D) <fname>:     Also write vectors and level-0 lists in the on-disk layout\n"
+        "--snapshot (-S) <fname>:        Also write a binary snapshot for fast (re)loading\n"
+        "--pca (-P) <float>:             Build in a PCA space keeping this share of variance\n"
+        "--rerank (-R)                   Keep input vectors to re-rank PCA search results exactly\n"
+        "--groups (-G) <fname>:          Group id of every point, last field per line, for grouped search\n"
+        "--graph-stats (-g)              Report reachability, degrees and asymmetric edges per level\n"
+        "--repair (-r)                   Relink unreachable nodes and write the params back\n"
+        "--compress-graph (-C)           Compress level-0 lists for the snapshot, it loads read-only\n"
+        "--partitions (-k) <int>:        Build this many parts in parallel and merge them\n"
+        "--merge (-M) <fnames>:          Merge comma separated snapshots into the index, rewrites storage & params\n"
+        "--routing (-T) <int>:           Start searches from this many k-means centroids, rewrites params\n"
+        "--routing-probes (-q) <int>:    Closest centroids a search starts from, 4 by default\n"
         "--help (-h):                    Show help\n";
     exit(1);
 }
 
 
 void ProcessArgs(int argc, char** argv) {
-    const char* const short_opts = "bltN:n:e:m:s:p:h";
+    const char* const short_opts = "bltN:n:e:m:x:s:p:E:HD:S:P:RG:grCk:M:T:q:h";
     const option long_opts[] = {
             // const char *name; int has_arg; int *flag; int val;
             // int has_arg: [0 - no arg, 1 - required, 2 - not required];
@@ -42,9 +61,24 @@ void ProcessArgs(int argc, char** argv) {
             {"max_neighbors_0", 1, nullptr, 'n'},
             {"ef_construction", 1, nullptr, 'e'},
             {"level_multiplier", 1, nullptr, 'm'},
+            {"seed", 1, nullptr, 'x'},
 
             {"storage_path", 1, nullptr, 's'},
             {"params_path", 1, nullptr, 'p'},
+            {"element_type", 1, nullptr, 'E'},
+            {"huge_pages", 0, nullptr, 'H'},
+            {"disk_layout", 1, nullptr, 'D'},
+            {"snapshot", 1, nullptr, 'S'},
+            {"pca", 1, nullptr, 'P'},
+            {"rerank", 0, nullptr, 'R'},
+            {"groups", 1, nullptr, 'G'},
+            {"graph_stats", 0, nullptr, 'g'},
+            {"repair", 0, nullptr, 'r'},
+            {"compress_graph", 0, nullptr, 'C'},
+            {"partitions", 1, nullptr, 'k'},
+            {"merge", 1, nullptr, 'M'},
+            {"routing", 1, nullptr, 'T'},
+            {"routing_probes", 1, nullptr, 'q'},
 
             {"help", 0, nullptr, 'h'},
             {nullptr, 0, nullptr, 0},  // last element must be zeros
@@ -90,6 +124,11 @@ void ProcessArgs(int argc, char** argv) {
                 std::cout << "level_multiplier is set to " << level_multiplier << std::endl;
                 break;
 
+            case 'x':
+                seed = std::stoull(optarg);
+                std::cout << "seed is set to " << seed << std::endl;
+                break;
+
             case 's':
                 storage_path = std::string(optarg);
                 std::cout << "storage_path file set to: " << storage_path << std::endl;
@@ -100,6 +139,76 @@ void ProcessArgs(int argc, char** argv) {
                 std::cout << "params_path file set to: " << params_path << std::endl;
                 break;
 
+            case 'E':
+                element_type = std::string(optarg);
+                std::cout << "element_type is set to " << element_type << std::endl;
+                break;
+
+            case 'H':
+                huge_pages = true;
+                std::cout << "huge_pages is set to true\n";
+                break;
+
+            case 'D':
+                disk_path = std::string(optarg);
+                std::cout << "disk_path file set to: " << disk_path << std::endl;
+                break;
+
+            case 'S':
+                snapshot_path = std::string(optarg);
+                std::cout << "snapshot_path file set to: " << snapshot_path << std::endl;
+                break;
+
+            case 'P':
+                pca_variance = std::stof(optarg);
+                std::cout << "pca_variance is set to " << pca_variance << std::endl;
+                break;
+
+            case 'R':
+                rerank = true;
+                std::cout << "rerank is set to true\n";
+                break;
+
+            case 'G':
+                groups_path = std::string(optarg);
+                std::cout << "groups_path file set to: " << groups_path << std::endl;
+                break;
+
+            case 'g':
+                graph_stats = true;
+                std::cout << "graph_stats is set to true\n";
+                break;
+
+            case 'r':
+                repair = true;
+                std::cout << "repair is set to true\n";
+                break;
+
+            case 'C':
+                compress_graph = true;
+                std::cout << "compress_graph is set to true\n";
+                break;
+
+            case 'k':
+                partitions = std::stoi(optarg);
+                std::cout << "partitions is set to " << partitions << std::endl;
+                break;
+
+            case 'M':
+                merge_paths = std::string(optarg);
+                std::cout << "merge_paths files set to: " << merge_paths << std::endl;
+                break;
+
+            case 'T':
+                routing_centroids = std::stoi(optarg);
+                std::cout << "routing_centroids is set to " << routing_centroids << std::endl;
+                break;
+
+            case 'q':
+                routing_probes = std::stoi(optarg);
+                std::cout << "routing_probes is set to " << routing_probes << std::endl;
+                break;
+
             case 'h': // -h or --help
             case '?': // Unrecognized option
             default:
@@ -125,22 +234,73 @@ void ValidateArgs() {
         std::cout << "--max-neighbors, --max-neighbors-0, --ef-construction, --level-mult must be set" << std::endl;
         exit(1);
     }
+
+    if (!element_type.empty() && element_type != "fp32" && element_type != "fp16" && element_type != "bf16") {
+        std::cout << "--element-type must be one of fp32, fp16, bf16" << std::endl;
+        exit(1);
+    }
+
+    if (pca_variance < 0 || pca_variance > 1 || ((pca_variance > 0 || rerank) && !build)) {
+        std::cout << "--pca must be in (0, 1] and is used with --build only, as is --rerank" << std::endl;
+        exit(1);
+    }
+
+    if (partitions < 0 || (partitions > 1 && (!build || pca_variance > 0))) {
+        std::cout << "--partitions must be positive and is used with --build without --pca" << std::endl;
+        exit(1);
+    }
+
+    if (routing_centroids < 0 || routing_probes <= 0) {
+        std::cout << "--routing and --routing-probes must be positive" << std::endl;
+        exit(1);
+    }
 }
 
 
 int main(int argc, char **argv) {
     ProcessArgs(argc, argv);
     ValidateArgs();
+    SetArenaHugePages(huge_pages);
 
     HNSW hnsw;
     if (build) {
         std::cout << "Loading data from " << storage_path << "...\n";
-        std::ifstream istream(storage_path, std::ios::binary);
-        Storage storage = ReadStorageFromDump(istream);
-
-        std::cout << "Building index...\n";
+        Storage storage = ReadStorageFromFile(storage_path);
         hnsw = HNSW(max_neighbors, max_neighbors_0, ef_construction, level_multiplier);
-        hnsw.InsertBatch(storage);
+        hnsw.SetSeed(seed);
+        size_t dim = storage.empty() ? 0 : storage[0].size();
+
+        if (pca_variance > 0) {
+            std::cout << "Training PCA...\n";
+            Projection projection = Projection::TrainPCA(storage, pca_variance);
+            std::cout << "PCA keeps " << projection.GetOutputDim() << " of " << dim << " dimensions, "
+                      << projection.GetExplainedVariance() << " of variance\n";
+            dim = projection.GetOutputDim();
+            hnsw.SetProjection(projection, rerank);
+        }
+
+        PrintMemoryReport("Estimated memory", HNSW::EstimateMemoryUsage(
+            storage.size(), dim, max_neighbors, max_neighbors_0, level_multiplier,
+            element_type.empty() ? ElementType::Float32 : ElementTypeFromString(element_type)));
+
+        if (partitions > 1) {
+            std::cout << "Building " << partitions << " partitions and merging them...\n";
+            hnsw = BuildPartitioned(storage, partitions, max_neighbors, max_neighbors_0, ef_construction,
+                                    level_multiplier, 0, seed);
+        } else {
+            std::cout << "Building index...\n";
+            hnsw.InsertBatch(storage, true);
+        }
+
+        if (!element_type.empty()) {
+            std::cout << "Converting storage to " << element_type << "...\n";
+            hnsw.SetElementType(ElementTypeFromString(element_type));
+        }
+
+        if (!groups_path.empty()) {
+            std::cout << "Reading groups from " << groups_path << "...\n";
+            hnsw.SetGroups(ReadGroupsFromFile(groups_path));
+        }
 
         std::cout << "Writing index params to " << params_path << "... \n";
         DumpHNSWToFile(storage_path, params_path, hnsw, false);
@@ -152,11 +312,82 @@ int main(int argc, char **argv) {
                   << params_path << "...\n";
 
         hnsw = ReadHNSWFromFile(storage_path, params_path);
+
+        if (!element_type.empty()) {
+            hnsw.SetElementType(ElementTypeFromString(element_type));
+        }
+
+        // loaded indexes take groups for the snapshot written below
+        if (!groups_path.empty()) {
+            hnsw.SetGroups(ReadGroupsFromFile(groups_path));
+        }
+    }
+
+    if (!merge_paths.empty()) {
+        std::vector<HNSW> parts;
+        parts.push_back(hnsw);
+        std::stringstream paths(merge_paths);
+        std::string path;
+        while (std::getline(paths, path, ',')) {
+            std::cout << "Reading snapshot " << path << " to merge...\n";
+            parts.push_back(ReadHNSWSnapshot(path));
+        }
+        std::cout << "Merging " << parts.size() << " indexes...\n";
+        hnsw = MergeHNSW(parts);
+
+        // the storage file holds the merged points from now on
+        std::cout << "Writing merged index to " << storage_path << " and " << params_path << "... \n";
+        DumpHNSWToFile(storage_path, params_path, hnsw, true);
+    }
+
+    if (routing_centroids > 0) {
+        std::cout << "Training routing table of " << routing_centroids << " centroids...\n";
+        hnsw.TrainRouting(routing_centroids, routing_probes);
+        std::cout << "Writing index params with the routing table to " << params_path << "... \n";
+        DumpHNSWToFile(storage_path, params_path, hnsw, false);
+    }
+
+    if (graph_stats || repair) {
+        std::cout << "Analyzing graph...\n";
+        auto start = std::chrono::steady_clock::now();
+        std::vector<LevelStats> report = AnalyzeGraph(hnsw);
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        PrintGraphReport(report);
+        std::cout << "Analysis took " << elapsed << " s\n";
+    }
+
+    if (repair) {
+        std::cout << "Repairing graph...\n";
+        size_t repaired = RepairGraph(hnsw);
+        std::cout << repaired << " nodes relinked\n";
+        if (repaired > 0) {
+            PrintGraphReport(AnalyzeGraph(hnsw));
+            std::cout << "Writing repaired index params to " << params_path << "... \n";
+            DumpHNSWToFile(storage_path, params_path, hnsw, false);
+        }
+    }
+
+    if (compress_graph) {
+        PrintMemoryReport("Memory before compression", hnsw.MemoryUsage());
+        std::cout << "Compressing level 0...\n";
+        hnsw.CompressGraph();
+    }
+
+    PrintMemoryReport("Memory", hnsw.MemoryUsage());
+
+    if (!disk_path.empty()) {
+        std::cout << "Writing on-disk layout to " << disk_path << "...\n";
+        DumpDiskLayout(disk_path, hnsw);
+    }
+
+    if (!snapshot_path.empty()) {
+        std::cout << "Writing snapshot to " << snapshot_path << "...\n";
+        DumpHNSWSnapshot(snapshot_path, hnsw);
     }
 
     if (test) {
         std::cout << "Testing index...\n";
-        TestHNSWSearch(hnsw, hnsw.GetStorage());
+        TestHNSWSearch(hnsw, hnsw.DecodeStorage());
     }
 
     return 0;
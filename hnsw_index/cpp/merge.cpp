@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include "utils.h"
+#include "merge.h"
+
+
+std::vector<HNSW> BuildPartitions(const Storage &data, int parts_num, int max_neighbors, int max_neighbors_0,
+                                  int ef_construction, float level_multiplier, int threads_num, uint64_t seed) {
+    if (parts_num <= 0) {
+        throw std::invalid_argument("number of partitions must be positive");
+    }
+
+    std::vector<HNSW> parts;
+    parts.reserve(parts_num);
+    for (int i = 0; i < parts_num; ++i) {
+        parts.emplace_back(max_neighbors, max_neighbors_0, ef_construction, level_multiplier);
+        parts.back().SetSeed(MixBits(seed + static_cast<uint64_t>(i)));
+    }
+
+    // every part has an arena of its own, so builds share nothing
+    size_t chunk = (data.size() + parts_num - 1) / parts_num;
+    ParallelFor(parts.size(), threads_num, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            size_t first = std::min(data.size(), i * chunk);
+            size_t last = std::min(data.size(), first + chunk);
+            parts[i].InsertBatch(Storage(data.begin() + first, data.begin() + last));
+        }
+    });
+    return parts;
+}
+
+
+HNSW MergeHNSW(const std::vector<HNSW> &parts, int threads_num) {
+    if (parts.empty()) {
+        throw std::invalid_argument("nothing to merge");
+    }
+
+    const HNSW &first = parts[0];
+    std::vector<size_t> offsets{0};
+    bool with_groups = true;
+    for (const HNSW &part : parts) {
+        if (part.max_neighbors != first.max_neighbors || part.max_neighbors_0 != first.max_neighbors_0 ||
+            part.ef_construction != first.ef_construction || part.level_multiplier != first.level_multiplier ||
+            part.element_type != first.element_type) {
+            throw std::invalid_argument("merged indexes must share build parameters and element type");
+        }
+        if (!part.projection.Empty()) {
+            throw std::invalid_argument("indexes with a projection can not be merged");
+        }
+        if (part.IsGraphCompressed()) {
+            throw std::invalid_argument("decompress graphs before merging");
+        }
+        offsets.push_back(offsets.back() + part.Size());
+        with_groups &= part.Size() == 0 || !part.groups.empty();
+    }
+
+    HNSW merged(first.max_neighbors, first.max_neighbors_0, first.ef_construction, first.level_multiplier);
+    merged.SetElementType(first.element_type);
+    merged.SetSeed(first.seed);
+    for (const HNSW &part : parts) {
+        merged.AppendStorage(part.DecodeStorage());
+    }
+
+    size_t N = offsets.back();
+    int M0 = merged.max_neighbors_0;
+
+    // Level 0: candidates of a point are its current neighbors and its nearest points in the other
+    // parts, the usual neighbor selection picks the list. Searching the other parts dominates the
+    // merge, a beam of one list length finds nearly the same candidates as ef_construction does.
+    // Parts and merged storage are only read.
+    std::vector<Points> lists(N);
+    ParallelFor(N, threads_num, [&](size_t begin, size_t end) {
+        Coords scratch;
+        size_t i = std::upper_bound(offsets.begin(), offsets.end(), begin) - offsets.begin() - 1;
+        for (size_t g = begin; g < end; ++g) {
+            while (g >= offsets[i + 1]) ++i;
+            auto point = static_cast<Point>(g);
+            const float *coords = merged.CoordsOf(point, scratch).data();
+
+            std::vector<Distance> candidates;
+            for (Point n : parts[i].Neighbors(static_cast<Point>(g - offsets[i]), 0)) {
+                candidates.push_back(merged.QueryDistance(static_cast<Point>(n + offsets[i]), coords));
+            }
+            for (size_t j = 0; j < parts.size(); ++j) {
+                if (j == i || parts[j].Size() == 0) continue;
+                for (Point n : parts[j].KNNSearch(coords, M0, M0)) {
+                    candidates.push_back(merged.QueryDistance(static_cast<Point>(n + offsets[j]), coords));
+                }
+            }
+
+            LessDistanceQueue queue(candidates);
+            PointsSet best = merged.SelectBestNeighbors(queue, point, M0, 0);
+            lists[g].assign(best.begin(), best.end());
+        }
+    });
+
+    auto &level_0 = merged.graph[0];
+    level_0.reserve(N);
+    for (size_t g = 0; g < N; ++g) {
+        level_0[static_cast<Point>(g)];
+    }
+    for (size_t g = 0; g < N; ++g) {
+        for (Point n : lists[g]) {
+            merged.MutuallyConnect(static_cast<Point>(g), n, 0);
+        }
+    }
+    for (size_t g = 0; g < N; ++g) {
+        merged.TrimNeighbors(static_cast<Point>(g), M0, 0);
+    }
+
+    // Upper levels are a small fraction of the points, they are linked again from the top down
+    // so the merged entry point is the first point of the highest level.
+    std::vector<Point> upper;
+    for (size_t i = 0; i < parts.size(); ++i) {
+        for (const auto &entry : parts[i].levels) {
+            auto point = static_cast<Point>(entry.first + offsets[i]);
+            merged.levels[point] = entry.second;
+            if (entry.second > 0) {
+                upper.push_back(point);
+            }
+        }
+    }
+    std::sort(upper.begin(), upper.end(), [&](Point a, Point b) {
+        int level_a = merged.levels[a], level_b = merged.levels[b];
+        return level_a != level_b ? level_a > level_b : a < b;
+    });
+    for (Point point : upper) {
+        merged.Link(point, merged.levels[point], 1);
+    }
+    if (upper.empty() && N > 0) {
+        merged.max_level = 0;
+        merged.entry_point = 0;
+    }
+
+    if (with_groups && N > 0) {
+        std::vector<int> groups;
+        groups.reserve(N);
+        for (const HNSW &part : parts) {
+            groups.insert(groups.end(), part.groups.begin(), part.groups.end());
+        }
+        merged.SetGroups(std::move(groups));
+    }
+    return merged;
+}
+
+
+HNSW BuildPartitioned(const Storage &data, int parts_num, int max_neighbors, int max_neighbors_0,
+                      int ef_construction, float level_multiplier, int threads_num, uint64_t seed) {
+    HNSW merged = MergeHNSW(BuildPartitions(data, parts_num, max_neighbors, max_neighbors_0, ef_construction,
+                                            level_multiplier, threads_num, seed), threads_num);
+    merged.SetSeed(seed);
+    return merged;
+}
@@ -0,0 +1,31 @@
+#ifndef HNSW_MERGE
+#define HNSW_MERGE
+
+#include <vector>
+
+#include "hnsw.h"
+
+
+// Indexes of parts_num contiguous slices of data, each built on its own without shared locks.
+// threads_num <= 0 uses every core. Part i levels are seeded with MixBits(seed + i), so the
+// parts do not depend on which thread builds them.
+std::vector<HNSW> BuildPartitions(const Storage &data, int parts_num, int max_neighbors, int max_neighbors_0,
+                                  int ef_construction, float level_multiplier, int threads_num=0,
+                                  uint64_t seed=HNSW::kDefaultSeed);
+
+
+// One index over the points of all parts, in order: points of parts[i] follow those of parts[i - 1].
+// Level-0 lists are selected again from a point's own list and its max_neighbors_0 nearest points
+// in every other part, then linked both ways and trimmed; upper levels are relinked from the parts'
+// levels. Parts must share build parameters and element type, without projections or compressed
+// graphs. Adding a batch to an index is a merge with an index of the batch. The merged index
+// keeps the seed of the first part.
+HNSW MergeHNSW(const std::vector<HNSW> &parts, int threads_num=0);
+
+
+// BuildPartitions followed by MergeHNSW, the result has the given seed
+HNSW BuildPartitioned(const Storage &data, int parts_num, int max_neighbors, int max_neighbors_0,
+                      int ef_construction, float level_multiplier, int threads_num=0,
+                      uint64_t seed=HNSW::kDefaultSeed);
+
+#endif // HNSW_MERGE
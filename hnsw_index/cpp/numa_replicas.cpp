@@ -0,0 +1,213 @@
+#include <dirent.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+
+#include "numa_replicas.h"
+
+
+// from linux/mempolicy.h, without a libnuma dependency
+static const int kMemPolicyDefault = 0;
+static const int kMemPolicyInterleave = 3;
+
+
+// "0-3,8,10-11" as in sysfs cpulist files
+static std::vector<int> ParseCpuList(const std::string &list) {
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t comma = list.find(',', pos);
+        std::string range = list.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+        size_t dash = range.find('-');
+        if (!range.empty() && range.find_first_not_of("0123456789-\n") == std::string::npos) {
+            int low = std::atoi(range.c_str());
+            int high = dash == std::string::npos ? low : std::atoi(range.c_str() + dash + 1);
+            for (int cpu = low; cpu <= high; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        }
+        if (comma == std::string::npos) break;
+        pos = comma + 1;
+    }
+    return cpus;
+}
+
+
+std::vector<NumaNode> NumaTopology() {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool affinity_known = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+    auto is_allowed = [&](int cpu) {
+        return !affinity_known || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed));
+    };
+
+    std::vector<NumaNode> nodes;
+    const char *root = "/sys/devices/system/node";
+    if (DIR *dir = opendir(root)) {
+        while (dirent *entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name.size() <= 4 || name.compare(0, 4, "node") != 0 ||
+                name.find_first_not_of("0123456789", 4) != std::string::npos) continue;
+
+            std::ifstream cpulist(std::string(root) + "/" + name + "/cpulist");
+            std::string list;
+            std::getline(cpulist, list);
+            NumaNode node{std::atoi(name.c_str() + 4), {}};
+            for (int cpu : ParseCpuList(list)) {
+                if (is_allowed(cpu)) {
+                    node.cpus.push_back(cpu);
+                }
+            }
+            // memory-only nodes and nodes outside the affinity mask get no replica
+            if (!node.cpus.empty()) {
+                nodes.push_back(std::move(node));
+            }
+        }
+        closedir(dir);
+    }
+
+    if (nodes.empty()) {
+        NumaNode node{0, {}};
+        int cpus_num = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+        for (int cpu = 0; cpu < std::max(cpus_num, CPU_SETSIZE); ++cpu) {
+            if (affinity_known ? CPU_ISSET(cpu, &allowed) : cpu < cpus_num) {
+                node.cpus.push_back(cpu);
+            }
+        }
+        nodes.push_back(std::move(node));
+    }
+    std::sort(nodes.begin(), nodes.end(), [](const NumaNode &a, const NumaNode &b) { return a.id < b.id; });
+    return nodes;
+}
+
+
+bool PinThreadToNode(const NumaNode &node) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu : node.cpus) {
+        if (cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &cpus);
+        }
+    }
+    return sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+}
+
+
+std::string NumaPlacementToString(NumaPlacement placement) {
+    switch (placement) {
+        case NumaPlacement::None:
+            return "none";
+        case NumaPlacement::Replicate:
+            return "replicate";
+        case NumaPlacement::Interleave:
+            return "interleave";
+    }
+    return "none";
+}
+
+
+NumaPlacement NumaPlacementFromString(const std::string &name) {
+    if (name == "none") return NumaPlacement::None;
+    if (name == "replicate") return NumaPlacement::Replicate;
+    if (name == "interleave") return NumaPlacement::Interleave;
+    throw std::invalid_argument("unknown NUMA placement " + name + ", expected none, replicate or interleave");
+}
+
+
+// Sets the calling thread's memory policy to interleave over the nodes, false when not allowed
+static bool InterleaveThreadMemory(const std::vector<NumaNode> &nodes) {
+    int max_id = 0;
+    for (const NumaNode &node : nodes) {
+        max_id = std::max(max_id, node.id);
+    }
+    size_t word_bits = 8 * sizeof(unsigned long);
+    std::vector<unsigned long> mask(max_id / word_bits + 1, 0);
+    for (const NumaNode &node : nodes) {
+        mask[node.id / word_bits] |= 1UL << (node.id % word_bits);
+    }
+    return syscall(SYS_set_mempolicy, kMemPolicyInterleave, mask.data(), mask.size() * word_bits + 1) == 0;
+}
+
+
+NumaReplicas::NumaReplicas(const HNSW &index, NumaPlacement placement, int max_nodes) :
+    nodes(NumaTopology()),
+    placement(placement) {
+    if (max_nodes > 0 && nodes.size() > static_cast<size_t>(max_nodes)) {
+        nodes.resize(static_cast<size_t>(max_nodes));
+    }
+    for (size_t n = 0; n < nodes.size(); ++n) {
+        for (int cpu : nodes[n].cpus) {
+            if (cpu_node.size() <= static_cast<size_t>(cpu)) {
+                cpu_node.resize(static_cast<size_t>(cpu) + 1, 0);
+            }
+            cpu_node[cpu] = n;
+        }
+    }
+
+    if (placement == NumaPlacement::None) {
+        replicas.push_back(std::make_shared<const HNSW>(index));
+        return;
+    }
+
+    // one copy per node, made on that node; interleaving makes one copy with the policy set
+    size_t copies = placement == NumaPlacement::Replicate ? nodes.size() : 1;
+    replicas.resize(copies);
+    std::vector<std::thread> copiers;
+    std::vector<std::exception_ptr> errors(copies);
+    for (size_t n = 0; n < copies; ++n) {
+        copiers.emplace_back([&, n]() {
+            try {
+                if (placement == NumaPlacement::Replicate) {
+                    PinThreadToNode(nodes[n]);
+                } else if (nodes.size() > 1) {
+                    InterleaveThreadMemory(nodes);
+                }
+                replicas[n] = std::make_shared<const HNSW>(index);
+                if (placement == NumaPlacement::Interleave && nodes.size() > 1) {
+                    syscall(SYS_set_mempolicy, kMemPolicyDefault, nullptr, 0);
+                }
+            } catch (...) {
+                errors[n] = std::current_exception();
+            }
+        });
+    }
+    for (std::thread &copier : copiers) {
+        copier.join();
+    }
+    for (const std::exception_ptr &error : errors) {
+        if (error) std::rethrow_exception(error);
+    }
+}
+
+NumaPlacement NumaReplicas::GetPlacement() const {
+    return placement;
+}
+
+const std::vector<NumaNode>& NumaReplicas::Nodes() const {
+    return nodes;
+}
+
+size_t NumaReplicas::ReplicasNum() const {
+    return replicas.size();
+}
+
+const HNSW& NumaReplicas::Replica(size_t node) const {
+    return *replicas[replicas.size() == 1 ? 0 : node % replicas.size()];
+}
+
+size_t NumaReplicas::CurrentNode() const {
+    int cpu = sched_getcpu();
+    if (cpu < 0 || static_cast<size_t>(cpu) >= cpu_node.size()) return 0;
+    return cpu_node[cpu];
+}
+
+const HNSW& NumaReplicas::Local() const {
+    return Replica(CurrentNode());
+}
@@ -0,0 +1,68 @@
+#ifndef HNSW_NUMA_REPLICAS
+#define HNSW_NUMA_REPLICAS
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "hnsw.h"
+
+
+struct NumaNode {
+    int id;
+    std::vector<int> cpus;   // cpus of the node this process may run on
+};
+
+
+// Nodes with cpus from sysfs, restricted to the process affinity. Machines without NUMA
+// information, or where it cannot be read, look like one node with every allowed cpu.
+std::vector<NumaNode> NumaTopology();
+
+
+// Pins the calling thread to the node's cpus, false when the OS refuses
+bool PinThreadToNode(const NumaNode &node);
+
+
+// Replicate copies the index to every node, Interleave spreads one copy over all nodes page by
+// page, None keeps the index where it was built
+enum class NumaPlacement { None, Replicate, Interleave };
+
+
+std::string NumaPlacementToString(NumaPlacement placement);
+
+
+NumaPlacement NumaPlacementFromString(const std::string &name);
+
+
+// Read-only copies of an index placed on NUMA nodes. A replica is copied by a thread pinned to its
+// node, so the kernel's first-touch policy puts vectors and graph into that node's memory and
+// searches from threads on the node never cross the interconnect. Interleaving needs the
+// set_mempolicy syscall and falls back to first-touch when it is not allowed. On a one-node
+// machine every placement ends up as a single copy.
+class NumaReplicas {
+    std::vector<NumaNode> nodes;
+    std::vector<size_t> cpu_node;                    // node index by cpu id
+    std::vector<std::shared_ptr<const HNSW>> replicas;  // one per node, or one shared by all
+    NumaPlacement placement;
+
+public:
+    // max_nodes > 0 uses only the first max_nodes nodes
+    NumaReplicas(const HNSW &index, NumaPlacement placement=NumaPlacement::Replicate, int max_nodes=0);
+
+    NumaPlacement GetPlacement() const;
+
+    const std::vector<NumaNode>& Nodes() const;
+
+    // number of distinct copies
+    size_t ReplicasNum() const;
+
+    const HNSW& Replica(size_t node) const;
+
+    // node of the cpu the calling thread runs on, 0 when unknown
+    size_t CurrentNode() const;
+
+    // replica of the calling thread's node, searches should come from threads pinned to it
+    const HNSW& Local() const;
+};
+
+#endif // HNSW_NUMA_REPLICAS
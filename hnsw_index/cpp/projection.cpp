@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+#include "kernels.h"
+#include "projection.h"
+
+
+Projection::Projection() = default;
+
+Projection::Projection(Coords mean, std::vector<float> components, size_t output_dim, float explained_variance) :
+    input_dim(mean.size()),
+    output_dim(output_dim),
+    mean(std::move(mean)),
+    components(std::move(components)),
+    offset(output_dim),
+    explained_variance(explained_variance) {
+    if (this->components.size() != input_dim * output_dim) {
+        throw std::invalid_argument("projection matrix does not match its dimensions");
+    }
+    MatVecFloat(this->components.data(), this->mean.data(), output_dim, input_dim, offset.data());
+}
+
+
+// Cyclic Jacobi rotations for a symmetric n x n matrix: on return the diagonal of a holds
+// the eigenvalues and the columns of vectors the matching eigenvectors
+static void JacobiEigen(std::vector<double> &a, size_t n, std::vector<double> &vectors) {
+    vectors.assign(n * n, 0);
+    for (size_t i = 0; i < n; ++i) {
+        vectors[i * n + i] = 1;
+    }
+
+    for (int sweep = 0; sweep < 100; ++sweep) {
+        double off = 0, total = 0;
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t j = 0; j < n; ++j) {
+                (i == j ? total : off) += a[i * n + j] * a[i * n + j];
+            }
+        }
+        if (off <= 1e-22 * (total + off)) break;
+
+        for (size_t p = 0; p + 1 < n; ++p) {
+            for (size_t q = p + 1; q < n; ++q) {
+                double apq = a[p * n + q];
+                if (apq == 0) continue;
+
+                double theta = (a[q * n + q] - a[p * n + p]) / (2 * apq);
+                double t = (theta >= 0 ? 1 : -1) / (std::fabs(theta) + std::sqrt(theta * theta + 1));
+                double c = 1 / std::sqrt(t * t + 1);
+                double s = t * c;
+
+                for (size_t k = 0; k < n; ++k) {
+                    double akp = a[k * n + p], akq = a[k * n + q];
+                    a[k * n + p] = c * akp - s * akq;
+                    a[k * n + q] = s * akp + c * akq;
+                }
+                for (size_t k = 0; k < n; ++k) {
+                    double apk = a[p * n + k], aqk = a[q * n + k];
+                    a[p * n + k] = c * apk - s * aqk;
+                    a[q * n + k] = s * apk + c * aqk;
+                }
+                for (size_t k = 0; k < n; ++k) {
+                    double vkp = vectors[k * n + p], vkq = vectors[k * n + q];
+                    vectors[k * n + p] = c * vkp - s * vkq;
+                    vectors[k * n + q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+}
+
+
+Projection Projection::TrainPCA(const Storage &data, float variance_share, size_t max_samples) {
+    if (data.empty() || variance_share <= 0 || variance_share > 1) {
+        throw std::invalid_argument("PCA needs data and a variance share in (0, 1]");
+    }
+    size_t n = data[0].size();
+    size_t step = std::max<size_t>(1, data.size() / std::max<size_t>(1, max_samples));
+
+    std::vector<double> mean(n, 0);
+    size_t samples = 0;
+    for (size_t i = 0; i < data.size(); i += step, ++samples) {
+        for (size_t j = 0; j < n; ++j) {
+            mean[j] += data[i][j];
+        }
+    }
+    for (double &m : mean) {
+        m /= static_cast<double>(samples);
+    }
+
+    std::vector<double> covariance(n * n, 0);
+    std::vector<double> centered(n);
+    for (size_t i = 0; i < data.size(); i += step) {
+        for (size_t j = 0; j < n; ++j) {
+            centered[j] = data[i][j] - mean[j];
+        }
+        for (size_t j = 0; j < n; ++j) {
+            for (size_t k = j; k < n; ++k) {
+                covariance[j * n + k] += centered[j] * centered[k];
+            }
+        }
+    }
+    for (size_t j = 0; j < n; ++j) {
+        for (size_t k = j; k < n; ++k) {
+            covariance[j * n + k] /= static_cast<double>(samples);
+            covariance[k * n + j] = covariance[j * n + k];
+        }
+    }
+
+    std::vector<double> vectors;
+    JacobiEigen(covariance, n, vectors);
+
+    std::vector<size_t> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t x, size_t y) {
+        return covariance[x * n + x] > covariance[y * n + y];
+    });
+
+    double total = 0;
+    for (size_t j = 0; j < n; ++j) {
+        total += std::max(0.0, covariance[j * n + j]);
+    }
+
+    size_t output_dim = 0;
+    double kept = 0;
+    while (output_dim < n && (output_dim == 0 || kept < variance_share * total)) {
+        kept += std::max(0.0, covariance[order[output_dim] * n + order[output_dim]]);
+        ++output_dim;
+    }
+
+    std::vector<float> components(output_dim * n);
+    for (size_t r = 0; r < output_dim; ++r) {
+        for (size_t j = 0; j < n; ++j) {
+            components[r * n + j] = static_cast<float>(vectors[j * n + order[r]]);
+        }
+    }
+    return Projection(Coords(mean.begin(), mean.end()), std::move(components), output_dim,
+                      total > 0 ? static_cast<float>(kept / total) : 1.0f);
+}
+
+bool Projection::Empty() const {
+    return output_dim == 0;
+}
+
+size_t Projection::GetInputDim() const {
+    return input_dim;
+}
+
+size_t Projection::GetOutputDim() const {
+    return output_dim;
+}
+
+float Projection::GetExplainedVariance() const {
+    return explained_variance;
+}
+
+const Coords& Projection::GetMean() const {
+    return mean;
+}
+
+const std::vector<float>& Projection::GetComponents() const {
+    return components;
+}
+
+void Projection::Apply(const float *x, float *out) const {
+    MatVecFloat(components.data(), x, output_dim, input_dim, out);
+    for (size_t r = 0; r < output_dim; ++r) {
+        out[r] -= offset[r];
+    }
+}
+
+Coords Projection::Apply(const Coords &x) const {
+    Coords out(output_dim);
+    Apply(x.data(), out.data());
+    return out;
+}
+
+Coords Projection::Unproject(const float *y) const {
+    Coords x = mean;
+    for (size_t r = 0; r < output_dim; ++r) {
+        const float *row = components.data() + r * input_dim;
+        for (size_t j = 0; j < input_dim; ++j) {
+            x[j] += y[r] * row[j];
+        }
+    }
+    return x;
+}
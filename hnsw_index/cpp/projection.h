@@ -0,0 +1,50 @@
+#ifndef HNSW_PROJECTION
+#define HNSW_PROJECTION
+
+#include <cstddef>
+#include <vector>
+
+#include "types.h"
+
+
+// Linear dimensionality reduction y = components * (x - mean) with orthonormal component
+// rows, so distances in the reduced space never exceed the original ones.
+class Projection {
+    size_t input_dim = 0;
+    size_t output_dim = 0;
+    Coords mean;
+    std::vector<float> components;  // output_dim rows of input_dim floats
+    Coords offset;                  // components * mean, subtracted after the product
+    float explained_variance = 0;
+
+public:
+    Projection();
+
+    Projection(Coords mean, std::vector<float> components, size_t output_dim, float explained_variance=0);
+
+    // Principal components keeping at least variance_share of the total variance,
+    // trained on at most max_samples evenly spaced points of data
+    static Projection TrainPCA(const Storage &data, float variance_share, size_t max_samples=100000);
+
+    bool Empty() const;
+
+    size_t GetInputDim() const;
+
+    size_t GetOutputDim() const;
+
+    float GetExplainedVariance() const;
+
+    const Coords& GetMean() const;
+
+    const std::vector<float>& GetComponents() const;
+
+    // out must hold GetOutputDim() floats
+    void Apply(const float *x, float *out) const;
+
+    Coords Apply(const Coords &x) const;
+
+    // closest point of the original space, exact for points of the reduced subspace
+    Coords Unproject(const float *y) const;
+};
+
+#endif // HNSW_PROJECTION
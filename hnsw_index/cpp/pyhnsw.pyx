@@ -1,22 +1,730 @@
+cimport cython
+from cython.operator cimport dereference as deref
+from libc.stdint cimport uint64_t
+from libcpp cimport bool
+from libcpp.memory cimport make_shared, shared_ptr
 from libcpp.string cimport string
 from libcpp.vector cimport vector
 
+import threading
+import time
+
+import numpy as np
+
+
+cdef extern from "types.h":
+    cdef enum class ElementType:
+        Float32
+        Float16
+        BFloat16
+
+
+cdef extern from "query_cache.h":
+    cdef cppclass QueryCache:
+        size_t GetBudget()
+        float GetQuantizationStep()
+        long GetHits()
+        long GetMisses()
+        size_t Entries()
+        size_t Bytes()
+
+
+cdef extern from "projection.h":
+    cdef cppclass Projection:
+        @staticmethod
+        Projection TrainPCA(const vector[vector[float]]&, float, size_t) except + nogil
+        size_t GetOutputDim()
+        float GetExplainedVariance()
+
+
+cdef extern from "routing.h":
+    cdef cppclass RoutingTable:
+        size_t CentroidsNum()
+        int GetProbes()
+
 
 cdef extern from "hnsw.h":
+    cdef struct SearchLimits:
+        int patience
+        float distance_ratio
+        long max_distance_evals
+        long deadline_us
+
+    cdef struct SearchResult:
+        vector[int] points
+        bool cut_short
+        bool early_stopped
+        long distance_evals
+        int hops
+
+    cdef cppclass MemoryReport:
+        size_t storage
+        size_t graph_level_0
+        size_t graph_upper
+        size_t metadata
+        size_t arena_reserved
+        size_t arena_used
+        size_t Total()
+
     cdef cppclass HNSW:
         HNSW() except +
-        vector[int] KNNSearch(vector[float]&, int, int)
+        HNSW(int, int, int, float) except +
+        HNSW(const HNSW&) except +
+        void InsertBatch(vector[vector[float]]) except + nogil
+        void SetSeed(uint64_t)
+        uint64_t GetSeed()
+        vector[int] KNNSearch(const float*, int, int) nogil
+        SearchResult AdaptiveKNNSearch(const float*, int, int, SearchLimits&) nogil
+        vector[int] GroupedKNNSearch(const float*, int, int) except + nogil
+        void SetGroups(vector[int]) except +
+        const vector[int]& GetGroups()
+        void SetElementType(ElementType) except + nogil
+        void CompressGraph() except + nogil
+        void DecompressGraph() except + nogil
+        bool IsGraphCompressed()
+        void TrainRouting(size_t, int, int, size_t, int) except + nogil
+        const RoutingTable& GetRoutingTable()
+        size_t Size()
+        size_t GetDim()
+        size_t GetInputDim()
+        void SetProjection(const Projection&, bool) except + nogil
+        const Projection& GetProjection()
+        bool GetRerank()
+        ElementType GetElementType()
+        MemoryReport MemoryUsage()
+        void SetQueryCache(size_t, float) except +
+        const QueryCache& GetQueryCache()
+
+    MemoryReport HNSW_EstimateMemoryUsage "HNSW::EstimateMemoryUsage"(
+        size_t, size_t, int, int, float, ElementType) except +
+
+
+cdef extern from "disk_index.h":
+    cdef struct DiskSearchResult:
+        vector[int] points
+        long blocks_read
+        long read_calls
+        long cache_hits
+
+    cdef cppclass DiskIndex:
+        DiskIndex(string, string, ElementType, size_t) except +
+        DiskSearchResult KNNSearch(vector[float]&, int, int, int) except + nogil
+        long GetQueries()
+        long GetBlocksRead()
+        long GetReadCalls()
+        long GetCacheHits()
+
+
+cdef extern from "index_holder.h":
+    cdef cppclass IndexHolder:
+        IndexHolder() except +
+        shared_ptr[HNSW] Get() nogil
+        shared_ptr[HNSW] Swap(shared_ptr[HNSW]) nogil
+        void Reload(string, string) except + nogil
+        long Version()
+
+
+cdef extern from "numa_replicas.h":
+    cdef enum class NumaPlacement:
+        pass
+
+    NumaPlacement NumaPlacementFromString(string) except +
+
+
+cdef extern from "query_scheduler.h":
+    cdef struct SchedulerOptions:
+        long window_us
+        size_t max_batch
+        int threads_num
+        NumaPlacement numa_placement
+
+    cdef cppclass QueryScheduler:
+        QueryScheduler(IndexHolder&, const SchedulerOptions&) except +
+        vector[vector[int]] Search(const float*, size_t, size_t, int, int) except + nogil
+        long GetQueries() const
+        long GetBatches() const
+
+
+cdef extern from "index_registry.h":
+    cdef struct RegistryOptions:
+        size_t memory_budget
+        size_t query_cache_bytes
+        SchedulerOptions scheduler
+
+    cdef cppclass IndexRegistry:
+        IndexRegistry(const RegistryOptions&) except +
+        void Register(string, string, string) except +
+        shared_ptr[HNSW] Get(string) except + nogil
+        void Reload(string) except + nogil
+        void Unload(string) except +
+        vector[vector[int]] Search(string, const float*, size_t, size_t, int, int) except + nogil
+        vector[string] Names()
+        bool IsLoaded(string) except +
+        size_t LoadedBytes()
+        long GetLoads()
+        long GetEvictions()
+        const QueryScheduler& GetScheduler()
+
+
+cdef extern from "merge.h":
+    HNSW MergeHNSW(const vector[HNSW]&, int) except + nogil
+
+
+cdef extern from "arena.h":
+    void SetArenaHugePages(bool)
 
 
 cdef extern from "dumps.h":
-    HNSW ReadHNSWFromFile(string storage, string params)
+    HNSW ReadHNSWFromFile(string storage, string params) except + nogil
+    void DumpHNSWToFile(string storage, string params, HNSW &hnsw, bool dump_storage) except + nogil
+    HNSW ReadHNSWSnapshot(string snapshot) except + nogil
+    void DumpHNSWSnapshot(string snapshot, HNSW &hnsw) except + nogil
+    ElementType ElementTypeFromString(string) except +
+    string ElementTypeToString(ElementType)
+
+
+cdef dict memory_report_to_dict(MemoryReport report):
+    return {
+        'storage': report.storage,
+        'graph_level_0': report.graph_level_0,
+        'graph_upper': report.graph_upper,
+        'metadata': report.metadata,
+        'total': report.Total(),
+        'arena_reserved': report.arena_reserved,
+        'arena_used': report.arena_used,
+    }
+
+
+def estimate_memory_usage(size_t N, size_t dim, int max_neighbors, int max_neighbors_0, float level_multiplier,
+                          string element_type=b'fp32'):
+    return memory_report_to_dict(HNSW_EstimateMemoryUsage(N, dim, max_neighbors, max_neighbors_0, level_multiplier,
+                                                          ElementTypeFromString(element_type)))
+
+
+def set_arena_huge_pages(bool enabled):
+    """Backs the graph arenas of indexes created or loaded afterwards with huge pages, for the whole process."""
+    SetArenaHugePages(enabled)
+
+
+def as_batch(vectors, size_t dim):
+    """Returns a C-contiguous float32 (n, dim) view, without a copy when the input already is one."""
+    batch = np.ascontiguousarray(vectors, dtype=np.float32)
+    if batch.ndim == 1:
+        batch = batch.reshape(1, -1)
+    if batch.ndim != 2 or (batch.shape[0] > 0 and <size_t>batch.shape[1] != dim):
+        raise ValueError('expected vectors of dimension {}, got shape {}'.format(dim, np.shape(vectors)))
+    return batch
+
+
+@cython.boundscheck(False)
+@cython.wraparound(False)
+cdef dict grouped_knn_search(shared_ptr[HNSW] index, queries, int K, int ef):
+    cdef float[:, ::1] batch = as_batch(queries, index.get().GetInputDim())
+    result = {
+        'neighbors': np.full((batch.shape[0], K), -1, dtype=np.int32),
+        'groups': np.full((batch.shape[0], K), -1, dtype=np.int32),
+    }
+    cdef int[:, ::1] neighbors = result['neighbors']
+    cdef int[:, ::1] groups = result['groups']
+    cdef const vector[int] *point_groups = &index.get().GetGroups()
+    cdef vector[int] found
+    cdef Py_ssize_t i, j
+
+    with nogil:
+        for i in range(batch.shape[0]):
+            found = index.get().GroupedKNNSearch(&batch[i, 0], K, ef)
+            for j in range(<Py_ssize_t>found.size()):
+                neighbors[i, j] = found[j]
+                groups[i, j] = deref(point_groups)[found[j]]
+
+    if np.ndim(queries) == 1:
+        return {key: value[0] for key, value in result.items()}
+    return result
+
+
+@cython.boundscheck(False)
+@cython.wraparound(False)
+cdef dict adaptive_knn_search(shared_ptr[HNSW] index, queries, int K, int ef, int patience, float distance_ratio,
+                              long max_distance_evals, long deadline_us):
+    cdef SearchLimits limits
+    limits.patience = patience
+    limits.distance_ratio = distance_ratio
+    limits.max_distance_evals = max_distance_evals
+    limits.deadline_us = deadline_us
+
+    cdef float[:, ::1] batch = as_batch(queries, index.get().GetInputDim())
+    n = batch.shape[0]
+    result = {
+        'neighbors': np.full((n, K), -1, dtype=np.int32),
+        'cut_short': np.zeros(n, dtype=np.uint8),
+        'early_stopped': np.zeros(n, dtype=np.uint8),
+        'distance_evals': np.zeros(n, dtype=np.int64),
+        'hops': np.zeros(n, dtype=np.int64),
+    }
+    cdef int[:, ::1] neighbors = result['neighbors']
+    cdef unsigned char[::1] cut_short = result['cut_short']
+    cdef unsigned char[::1] early_stopped = result['early_stopped']
+    cdef long long[::1] distance_evals = result['distance_evals']
+    cdef long long[::1] hops = result['hops']
+    cdef SearchResult found
+    cdef Py_ssize_t i, j
+
+    with nogil:
+        for i in range(batch.shape[0]):
+            found = index.get().AdaptiveKNNSearch(&batch[i, 0], K, ef, limits)
+            for j in range(<Py_ssize_t>found.points.size()):
+                neighbors[i, j] = found.points[j]
+            cut_short[i] = found.cut_short
+            early_stopped[i] = found.early_stopped
+            distance_evals[i] = found.distance_evals
+            hops[i] = found.hops
+
+    result['cut_short'] = result['cut_short'].astype(np.bool_)
+    result['early_stopped'] = result['early_stopped'].astype(np.bool_)
+    if np.ndim(queries) == 1:
+        return {key: value[0] for key, value in result.items()}
+    return result
 
 
 cdef class PyHNSW:
-    cdef HNSW _hnsw      # hold a C++ instance which we're wrapping
+    """
+    HNSW index, loaded from storage & params dumps, from a binary snapshot (storage only),
+    or empty with build parameters.
+
+    Searches release the GIL and may run from several threads at once, also while reload()
+    swaps in a new index: running searches finish on the index they started with. Methods
+    changing the index do so on a copy and swap it in the same way, one at a time.
+    """
+    cdef IndexHolder _holder      # hold the C++ index which we're wrapping
+    cdef shared_ptr[QueryScheduler] _scheduler  # batches knn_search calls when set, see enable_batching
+    cdef object _write_lock       # serializes reloads and changes, searches never take it
+
+    def __cinit__(self, string storage=b'', string params=b'', int max_neighbors=0, int max_neighbors_0=0,
+                  int ef_construction=0, float level_multiplier=0):
+        self._write_lock = threading.Lock()
+        if not storage.empty():
+            self.reload(storage, params)
+        elif max_neighbors and max_neighbors_0 and ef_construction and level_multiplier:
+            self._holder.Swap(make_shared[HNSW](max_neighbors, max_neighbors_0, ef_construction, level_multiplier))
+        else:
+            raise ValueError('either storage (and params for text dumps) or all build parameters must be set')
+
+    def __dealloc__(self):
+        # the scheduler answers what is queued and stops before the holder goes away
+        self._scheduler.reset()
+
+    def reload(self, string storage, string params=b''):
+        """Loads a snapshot (or text dumps when params is set) aside and swaps it in atomically."""
+        with self._write_lock:
+            with nogil:
+                self._holder.Reload(storage, params)
+
+    @property
+    def version(self):
+        return self._holder.Version()
+
+    def __len__(self):
+        return self._holder.Get().get().Size()
+
+    @property
+    def dim(self):
+        return self._holder.Get().get().GetInputDim()
+
+    @property
+    def element_type(self):
+        return ElementTypeToString(self._holder.Get().get().GetElementType())
+
+    @property
+    def seed(self):
+        return self._holder.Get().get().GetSeed()
+
+    def set_seed(self, uint64_t seed):
+        """Seeds the level assignment, equal seeds and data build equal indexes. Set before inserting."""
+        cdef shared_ptr[HNSW] index
+        with self._write_lock:
+            with nogil:
+                index = make_shared[HNSW](deref(self._holder.Get()))
+            index.get().SetSeed(seed)
+            self._holder.Swap(index)
+
+    def set_element_type(self, string element_type):
+        cdef ElementType type = ElementTypeFromString(element_type)
+        cdef shared_ptr[HNSW] index
+        with self._write_lock:
+            with nogil:
+                index = make_shared[HNSW](deref(self._holder.Get()))
+                index.get().SetElementType(type)
+                self._holder.Swap(index)
+
+    @cython.boundscheck(False)
+    def insert(self, vectors, groups=None):
+        """
+        groups: group id of every inserted vector, needed when the index already has groups.
+        The points and their groups are swapped in together.
+        """
+        cdef shared_ptr[HNSW] index
+        cdef float[:, ::1] batch
+        cdef vector[vector[float]] storage
+        cdef vector[int] all_groups
+        cdef Py_ssize_t i
+
+        with self._write_lock:
+            index = self._holder.Get()
+            batch = as_batch(vectors, index.get().GetInputDim() or np.shape(vectors)[-1])
+            if groups is not None and len(groups) != batch.shape[0]:
+                raise ValueError('expected {} groups, got {}'.format(batch.shape[0], len(groups)))
+            if groups is None and not index.get().GetGroups().empty():
+                raise ValueError('index has groups, groups of the inserted vectors must be given')
+            if groups is not None:
+                all_groups = np.concatenate([self.groups, np.asarray(groups, dtype=np.int32)]).tolist()
+
+            with nogil:
+                storage.resize(batch.shape[0])
+                for i in range(batch.shape[0]):
+                    storage[i].assign(&batch[i, 0], &batch[i, 0] + batch.shape[1])
+                index = make_shared[HNSW](deref(index))
+                index.get().InsertBatch(storage)
+            if groups is not None:
+                index.get().SetGroups(all_groups)
+            self._holder.Swap(index)
+
+    @property
+    def groups(self):
+        """int32 group id of every point, empty when no groups are set."""
+        return np.asarray(self._holder.Get().get().GetGroups(), dtype=np.int32)
+
+    @property
+    def has_groups(self):
+        return not self._holder.Get().get().GetGroups().empty()
+
+    def set_groups(self, groups):
+        """One group id per indexed point, e.g. the identity of every face."""
+        cdef vector[int] point_groups = np.asarray(groups, dtype=np.int32).tolist()
+        cdef shared_ptr[HNSW] index
+        with self._write_lock:
+            with nogil:
+                index = make_shared[HNSW](deref(self._holder.Get()))
+            index.get().SetGroups(point_groups)
+            self._holder.Swap(index)
+
+    @cython.boundscheck(False)
+    def train_pca(self, sample, float variance_share=0.95, bool rerank=False, size_t max_samples=100000):
+        """
+        Trains a PCA projection on sample vectors and makes the empty index run in the reduced space,
+        rerank keeps inserted vectors to re-rank results exactly. Returns the reduced dimension.
+        """
+        cdef shared_ptr[HNSW] index
+        cdef float[:, ::1] batch = as_batch(sample, np.shape(sample)[-1])
+        cdef vector[vector[float]] storage
+        cdef Py_ssize_t i
+
+        with self._write_lock:
+            with nogil:
+                storage.resize(batch.shape[0])
+                for i in range(batch.shape[0]):
+                    storage[i].assign(&batch[i, 0], &batch[i, 0] + batch.shape[1])
+                index = make_shared[HNSW](deref(self._holder.Get()))
+                index.get().SetProjection(Projection.TrainPCA(storage, variance_share, max_samples), rerank)
+                self._holder.Swap(index)
+        return index.get().GetProjection().GetOutputDim()
+
+    def train_routing(self, size_t centroids, int probes=4, int iterations=10, size_t max_samples=100000,
+                      int threads=0):
+        """
+        Learns k-means centroids of the indexed vectors; searches then start from the points nearest
+        to the probes closest centroids instead of descending the upper levels. Zero centroids
+        removes the table.
+        """
+        cdef shared_ptr[HNSW] index
+        with self._write_lock:
+            with nogil:
+                index = make_shared[HNSW](deref(self._holder.Get()))
+                index.get().TrainRouting(centroids, probes, iterations, max_samples, threads)
+                self._holder.Swap(index)
+
+    @property
+    def routing(self):
+        cdef shared_ptr[HNSW] index = self._holder.Get()
+        cdef const RoutingTable *routing = &index.get().GetRoutingTable()
+        return {'centroids': routing.CentroidsNum(), 'probes': routing.GetProbes()}
+
+    @property
+    def projection(self):
+        cdef shared_ptr[HNSW] index = self._holder.Get()
+        cdef const Projection *projection = &index.get().GetProjection()
+        return {
+            'output_dim': projection.GetOutputDim(),
+            'explained_variance': projection.GetExplainedVariance(),
+            'rerank': index.get().GetRerank(),
+        }
+
+    def merge(self, snapshots, int threads=0):
+        """
+        Merges indexes from binary snapshots into this one and swaps the result in, their points
+        follow the current ones in order. A new batch indexed on its own joins without a rebuild.
+        """
+        cdef vector[string] paths = snapshots
+        cdef vector[HNSW] parts
+        cdef size_t i
+
+        with self._write_lock:
+            with nogil:
+                parts.push_back(deref(self._holder.Get()))
+                for i in range(paths.size()):
+                    parts.push_back(ReadHNSWSnapshot(paths[i]))
+                self._holder.Swap(make_shared[HNSW](MergeHNSW(parts, threads)))
+
+    def dump(self, string storage, string params, bool dump_storage=True):
+        cdef shared_ptr[HNSW] index = self._holder.Get()
+        with nogil:
+            DumpHNSWToFile(storage, params, deref(index), dump_storage)
+
+    def dump_snapshot(self, string snapshot):
+        cdef shared_ptr[HNSW] index = self._holder.Get()
+        with nogil:
+            DumpHNSWSnapshot(snapshot, deref(index))
+
+    @cython.boundscheck(False)
+    @cython.wraparound(False)
+    def knn_search(self, queries, int K, int ef):
+        """
+        queries: float32 array of shape (dim,) or (n, dim), other inputs are converted.
+        Returns int32 neighbors of shape (K,) or (n, K), padded with -1 when fewer are found.
+        """
+        cdef shared_ptr[HNSW] index = self._holder.Get()
+        # copied with the GIL held, which enable_batching also holds to replace it, so the
+        # scheduler lives until this search is done
+        cdef shared_ptr[QueryScheduler] scheduler = self._scheduler
+        cdef float[:, ::1] batch = as_batch(queries, index.get().GetInputDim())
+        neighbors = np.full((batch.shape[0], K), -1, dtype=np.int32)
+        cdef int[:, ::1] out = neighbors
+        cdef vector[int] found
+        cdef vector[vector[int]] scheduled
+        cdef Py_ssize_t i, j
+
+        if scheduler and batch.shape[0] > 0:
+            with nogil:
+                scheduled = scheduler.get().Search(&batch[0, 0], batch.shape[0], batch.shape[1], K, ef)
+                for i in range(batch.shape[0]):
+                    for j in range(<Py_ssize_t>scheduled[i].size()):
+                        out[i, j] = scheduled[i][j]
+            return neighbors[0] if np.ndim(queries) == 1 else neighbors
+
+        with nogil:
+            for i in range(batch.shape[0]):
+                found = index.get().KNNSearch(&batch[i, 0], K, ef)
+                for j in range(<Py_ssize_t>found.size()):
+                    out[i, j] = found[j]
+
+        return neighbors[0] if np.ndim(queries) == 1 else neighbors
+
+    def knn_search_groups(self, queries, int K, int ef):
+        """
+        Best hit of each of the K nearest groups, ef counts groups. Returns int32 'neighbors' and
+        their 'groups', of shape (K,) or (n, K) like knn_search and padded with -1.
+        """
+        return grouped_knn_search(self._holder.Get(), queries, K, ef)
+
+    def adaptive_knn_search(self, queries, int K, int ef, int patience=0, float distance_ratio=0,
+                            long max_distance_evals=0, long deadline_us=0):
+        return adaptive_knn_search(self._holder.Get(), queries, K, ef, patience, distance_ratio,
+                                   max_distance_evals, deadline_us)
+
+    def enable_batching(self, long window_us=200, size_t max_batch=64, int threads=0, string numa=b'none'):
+        """
+        Routes knn_search through a micro-batching scheduler: queries from concurrent callers wait
+        up to window_us for others and run as one batch of at most max_batch on a pool of threads
+        (0 for every core). window_us <= 0 turns batching off. Searches running meanwhile finish
+        on the previous scheduler, which stops once they are done and before the new one starts.
+        numa 'replicate' copies the index to every NUMA node and pins the threads to nodes,
+        'interleave' spreads one copy over the nodes' memory.
+        """
+        cdef SchedulerOptions options
+        options.numa_placement = NumaPlacementFromString(numa)
+        cdef shared_ptr[QueryScheduler] previous
+        with self._write_lock:
+            previous = self._scheduler
+            self._scheduler.reset()
+            # searches holding the previous scheduler drop it when they finish, it then resets the
+            # holder's NUMA placement, which must happen before the new scheduler sets its own
+            while previous.use_count() > 1:
+                time.sleep(0.001)
+            previous.reset()
+            if window_us <= 0:
+                return
+            options.window_us = window_us
+            options.max_batch = max_batch
+            options.threads_num = threads
+            self._scheduler = shared_ptr[QueryScheduler](new QueryScheduler(self._holder, options))
+
+    def batching_stats(self):
+        cdef shared_ptr[QueryScheduler] scheduler = self._scheduler
+        if not scheduler:
+            return None
+        return {'queries': scheduler.get().GetQueries(), 'batches': scheduler.get().GetBatches()}
+
+    def compress_graph(self):
+        """
+        Compresses the level-0 neighbor lists for serving, snapshots keep them compressed.
+        insert raises until decompress_graph.
+        """
+        cdef shared_ptr[HNSW] index
+        with self._write_lock:
+            with nogil:
+                index = make_shared[HNSW](deref(self._holder.Get()))
+                index.get().CompressGraph()
+                self._holder.Swap(index)
+
+    def decompress_graph(self):
+        cdef shared_ptr[HNSW] index
+        with self._write_lock:
+            with nogil:
+                index = make_shared[HNSW](deref(self._holder.Get()))
+                index.get().DecompressGraph()
+                self._holder.Swap(index)
+
+    @property
+    def graph_compressed(self):
+        return self._holder.Get().get().IsGraphCompressed()
+
+    def memory_usage(self):
+        return memory_report_to_dict(self._holder.Get().get().MemoryUsage())
+
+    def set_query_cache(self, size_t budget_bytes, float quantization_step=1e-3):
+        """Caches knn_search results within budget_bytes, 0 disables."""
+        cdef shared_ptr[HNSW] index
+        with self._write_lock:
+            with nogil:
+                index = make_shared[HNSW](deref(self._holder.Get()))
+            index.get().SetQueryCache(budget_bytes, quantization_step)
+            self._holder.Swap(index)
+
+    def cache_stats(self):
+        cdef shared_ptr[HNSW] index = self._holder.Get()
+        cdef const QueryCache *cache = &index.get().GetQueryCache()
+        return {
+            'budget_bytes': cache.GetBudget(),
+            'quantization_step': cache.GetQuantizationStep(),
+            'hits': cache.GetHits(),
+            'misses': cache.GetMisses(),
+            'entries': cache.Entries(),
+            'bytes': cache.Bytes(),
+        }
+
+
+cdef class PyIndexRegistry:
+    """
+    Named indexes in one process, loaded on first use and searched on one shared pool of
+    threads. Least recently used indexes are unloaded when the loaded ones exceed
+    memory_budget bytes (0 for unlimited). Unknown names raise IndexError. numa places the
+    indexes like in PyHNSW.enable_batching. Without a placement window_us <= 0 turns batching
+    off, searches then run on the calling thread.
+    """
+    cdef IndexRegistry *_registry
+
+    def __cinit__(self, size_t memory_budget=0, size_t query_cache_bytes=0, long window_us=200,
+                  size_t max_batch=64, int threads=0, string numa=b'none'):
+        cdef RegistryOptions options
+        options.memory_budget = memory_budget
+        options.query_cache_bytes = query_cache_bytes
+        options.scheduler.window_us = window_us
+        options.scheduler.max_batch = max_batch
+        options.scheduler.threads_num = threads
+        options.scheduler.numa_placement = NumaPlacementFromString(numa)
+        self._registry = new IndexRegistry(options)
+
+    def __dealloc__(self):
+        del self._registry
+
+    def register(self, string name, string storage, string params=b''):
+        """Where name loads from: a snapshot, or text dumps when params is set. Unloads a previous index of name."""
+        self._registry.Register(name, storage, params)
+
+    def reload(self, string name):
+        """Loads the registered files of name aside and swaps them in atomically."""
+        with nogil:
+            self._registry.Reload(name)
+
+    def unload(self, string name):
+        self._registry.Unload(name)
+
+    @property
+    def names(self):
+        return list(self._registry.Names())
+
+    def is_loaded(self, string name):
+        return self._registry.IsLoaded(name)
+
+    cdef shared_ptr[HNSW] _get(self, string name) except *:
+        cdef shared_ptr[HNSW] index
+        with nogil:
+            index = self._registry.Get(name)
+        return index
+
+    def has_groups(self, string name):
+        return not self._get(name).get().GetGroups().empty()
+
+    def size(self, string name):
+        return self._get(name).get().Size()
+
+    @cython.boundscheck(False)
+    @cython.wraparound(False)
+    def knn_search(self, string name, queries, int K, int ef):
+        """Like PyHNSW.knn_search on the index of name, loading it if needed."""
+        cdef shared_ptr[HNSW] index = self._get(name)
+        cdef float[:, ::1] batch = as_batch(queries, index.get().GetInputDim())
+        neighbors = np.full((batch.shape[0], K), -1, dtype=np.int32)
+        cdef int[:, ::1] out = neighbors
+        cdef vector[vector[int]] found
+        cdef Py_ssize_t i, j
+
+        if batch.shape[0] > 0:
+            with nogil:
+                found = self._registry.Search(name, &batch[0, 0], batch.shape[0], batch.shape[1], K, ef)
+                for i in range(batch.shape[0]):
+                    for j in range(<Py_ssize_t>found[i].size()):
+                        out[i, j] = found[i][j]
+        return neighbors[0] if np.ndim(queries) == 1 else neighbors
+
+    def knn_search_groups(self, string name, queries, int K, int ef):
+        """Like PyHNSW.knn_search_groups on the index of name, searched on the calling thread."""
+        return grouped_knn_search(self._get(name), queries, K, ef)
+
+    def adaptive_knn_search(self, string name, queries, int K, int ef, int patience=0, float distance_ratio=0,
+                            long max_distance_evals=0, long deadline_us=0):
+        """Like PyHNSW.adaptive_knn_search on the index of name, searched on the calling thread."""
+        return adaptive_knn_search(self._get(name), queries, K, ef, patience, distance_ratio, max_distance_evals,
+                                   deadline_us)
+
+    def stats(self):
+        return {
+            'loaded_bytes': self._registry.LoadedBytes(),
+            'loads': self._registry.GetLoads(),
+            'evictions': self._registry.GetEvictions(),
+            'queries': self._registry.GetScheduler().GetQueries(),
+            'batches': self._registry.GetScheduler().GetBatches(),
+        }
+
+
+cdef class PyDiskHNSW:
+    cdef DiskIndex *_index
+
+    def __cinit__(self, string disk, string params, string navigation_type=b'fp16', size_t cache_blocks=1024):
+        self._index = new DiskIndex(disk, params, ElementTypeFromString(navigation_type), cache_blocks)
+
+    def __dealloc__(self):
+        del self._index
 
-    def __cinit__(self, string storage, string params):
-        self._hnsw = ReadHNSWFromFile(storage, params)
+    def knn_search(self, vector[float] coords, int K, int ef, int rerank=0):
+        cdef DiskSearchResult result
+        with nogil:
+            result = self._index.KNNSearch(coords, K, ef, rerank)
+        return np.asarray(result.points, dtype=np.int32)
 
-    def knn_search(self, vector[float] coords, int K, int ef):
-        return self._hnsw.KNNSearch(coords, K, ef)
+    def io_stats(self):
+        return {
+            'queries': self._index.GetQueries(),
+            'blocks_read': self._index.GetBlocksRead(),
+            'read_calls': self._index.GetReadCalls(),
+            'cache_hits': self._index.GetCacheHits(),
+        }
@@ -0,0 +1,172 @@
+#include <cmath>
+#include "query_cache.h"
+
+
+bool QueryKey::operator==(const QueryKey &other) const {
+    return hash == other.hash && K == other.K && ef == other.ef && coords == other.coords;
+}
+
+QueryCache::QueryCache(size_t budget_bytes, float quantization_step) :
+    budget_bytes(budget_bytes),
+    quantization_step(quantization_step) {
+    if (budget_bytes == 0) return;
+    for (int i = 0; i < kShards; ++i) {
+        shards.emplace_back(new Shard());
+    }
+}
+
+QueryCache::QueryCache(const QueryCache &other) : QueryCache(other.budget_bytes, other.quantization_step) {}
+
+QueryCache::QueryCache(QueryCache &&other) noexcept :
+    budget_bytes(other.budget_bytes),
+    quantization_step(other.quantization_step),
+    shards(std::move(other.shards)) {
+    // nothing searches a cache while it is moved from
+    for (auto &shard : shards) {
+        shard->lru.clear();
+        shard->entries.clear();
+        shard->bytes = 0;
+    }
+}
+
+QueryCache& QueryCache::operator=(const QueryCache &other) {
+    if (this != &other) {
+        QueryCache fresh(other.budget_bytes, other.quantization_step);
+        budget_bytes = fresh.budget_bytes;
+        quantization_step = fresh.quantization_step;
+        shards = std::move(fresh.shards);
+        hits = 0;
+        misses = 0;
+    }
+    return *this;
+}
+
+bool QueryCache::Enabled() const {
+    return budget_bytes > 0;
+}
+
+QueryKey QueryCache::Key(const float *query, size_t dim, int K, int ef) const {
+    QueryKey key;
+    key.K = K;
+    key.ef = ef;
+    key.coords.resize(dim);
+
+    // FNV-1a over quantized coordinates, finished with a murmur mix so shard bits are spread
+    uint64_t hash = 14695981039346656037ULL;
+    auto mix = [&hash](uint64_t value) {
+        hash ^= value;
+        hash *= 1099511628211ULL;
+    };
+
+    float scale = 1.0f / quantization_step;
+    for (size_t i = 0; i < dim; ++i) {
+        key.coords[i] = std::llrint(query[i] * scale);
+        mix(static_cast<uint64_t>(key.coords[i]));
+    }
+    mix(static_cast<uint32_t>(K));
+    mix(static_cast<uint32_t>(ef));
+    mix(dim);
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    key.hash = hash;
+    return key;
+}
+
+bool QueryCache::Lookup(const QueryKey &key, Points &points) {
+    Shard &shard = ShardOf(key.hash);
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto found = shard.entries.find(key.hash);
+        if (found != shard.entries.end() && found->second->key == key) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+            points = found->second->points;
+            ++hits;
+            return true;
+        }
+    }
+    ++misses;
+    return false;
+}
+
+void QueryCache::Store(const QueryKey &key, const Points &points) {
+    Shard &shard = ShardOf(key.hash);
+    size_t shard_budget = budget_bytes / kShards;
+    Entry entry{key, points};
+    size_t bytes = EntryBytes(entry);
+    if (bytes > shard_budget) return;
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.entries.find(key.hash);
+    if (found != shard.entries.end()) {
+        if (found->second->key == key) return;
+        shard.bytes -= EntryBytes(*found->second);
+        shard.lru.erase(found->second);
+        shard.entries.erase(found);
+    }
+
+    while (shard.bytes + bytes > shard_budget) {
+        const Entry &oldest = shard.lru.back();
+        shard.bytes -= EntryBytes(oldest);
+        shard.entries.erase(oldest.key.hash);
+        shard.lru.pop_back();
+    }
+    shard.lru.push_front(std::move(entry));
+    shard.entries.emplace(key.hash, shard.lru.begin());
+    shard.bytes += bytes;
+}
+
+void QueryCache::Clear() {
+    for (auto &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->lru.clear();
+        shard->entries.clear();
+        shard->bytes = 0;
+    }
+}
+
+size_t QueryCache::GetBudget() const {
+    return budget_bytes;
+}
+
+float QueryCache::GetQuantizationStep() const {
+    return quantization_step;
+}
+
+long QueryCache::GetHits() const {
+    return hits;
+}
+
+long QueryCache::GetMisses() const {
+    return misses;
+}
+
+size_t QueryCache::Entries() const {
+    size_t entries = 0;
+    for (const auto &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        entries += shard->entries.size();
+    }
+    return entries;
+}
+
+size_t QueryCache::Bytes() const {
+    size_t bytes = 0;
+    for (const auto &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        bytes += shard->bytes;
+    }
+    return bytes;
+}
+
+QueryCache::Shard &QueryCache::ShardOf(uint64_t key) const {
+    // low bits pick the bucket inside the shard map, take the shard from the high ones
+    return *shards[(key >> 56) % kShards];
+}
+
+size_t QueryCache::EntryBytes(const Entry &entry) {
+    // list node with the entry, hash map node with its bucket, the key and the result
+    return sizeof(Entry) + 2 * sizeof(void*) + sizeof(uint64_t) + 3 * sizeof(void*) +
+           entry.key.coords.size() * sizeof(int64_t) + entry.points.size() * sizeof(Point);
+}
@@ -0,0 +1,96 @@
+#ifndef HNSW_QUERY_CACHE
+#define HNSW_QUERY_CACHE
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "types.h"
+
+
+// Search parameters a cached result belongs to, the query rounded to multiples of the
+// quantization step. Lookups compare the whole key, the hash only picks the slot.
+struct QueryKey {
+    uint64_t hash = 0;
+    std::vector<int64_t> coords;
+    int K = 0;
+    int ef = 0;
+
+    bool operator==(const QueryKey &other) const;
+};
+
+
+// Sharded LRU of search results keyed by the quantized query plus K and ef.
+// Queries whose coordinates round to the same multiples of the quantization step share an
+// entry, so re-uploads of the same embedding hit even with tiny float noise. Safe for
+// concurrent lookups, the owner clears it whenever the index changes.
+//
+// Copies and moves produce an empty cache with the same settings: cached results belong to
+// the index they were computed on.
+class QueryCache {
+    struct Entry {
+        QueryKey key;
+        Points points;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::list<Entry> lru;
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> entries;  // by key hash, one entry per hash
+        size_t bytes = 0;
+    };
+
+    size_t budget_bytes = 0;
+    float quantization_step = 0;
+    std::vector<std::unique_ptr<Shard>> shards;
+
+    std::atomic<long> hits{0};
+    std::atomic<long> misses{0};
+
+public:
+    static constexpr int kShards = 16;
+
+    // zero budget disables the cache
+    explicit QueryCache(size_t budget_bytes=0, float quantization_step=1e-3f);
+
+    QueryCache(const QueryCache &other);
+
+    // takes over the shards emptied, without allocating
+    QueryCache(QueryCache &&other) noexcept;
+
+    QueryCache& operator=(const QueryCache &other);
+
+    bool Enabled() const;
+
+    QueryKey Key(const float *query, size_t dim, int K, int ef) const;
+
+    bool Lookup(const QueryKey &key, Points &points);
+
+    // replaces an entry of another key with the same hash
+    void Store(const QueryKey &key, const Points &points);
+
+    void Clear();
+
+    size_t GetBudget() const;
+
+    float GetQuantizationStep() const;
+
+    long GetHits() const;
+
+    long GetMisses() const;
+
+    size_t Entries() const;
+
+    size_t Bytes() const;
+
+private:
+    Shard &ShardOf(uint64_t key) const;
+
+    static size_t EntryBytes(const Entry &entry);
+};
+
+#endif // HNSW_QUERY_CACHE
@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <iterator>
+
+#include "query_scheduler.h"
+
+
+QueryScheduler::QueryScheduler(IndexHolder &holder, const SchedulerOptions &options) :
+    QueryScheduler(&holder, options) {}
+
+QueryScheduler::QueryScheduler(const SchedulerOptions &options) : QueryScheduler(nullptr, options) {}
+
+QueryScheduler::QueryScheduler(IndexHolder *holder, const SchedulerOptions &options) :
+    holder(holder),
+    options(options) {
+    this->options.max_batch = std::max<size_t>(1, options.max_batch);
+    size_t threads_num = options.threads_num > 0 ? static_cast<size_t>(options.threads_num)
+                                                 : std::max(1u, std::thread::hardware_concurrency());
+    if (holder) {
+        holder->SetNumaPlacement(options.numa_placement);
+    }
+    if (options.numa_placement != NumaPlacement::None) {
+        nodes = NumaTopology();
+    }
+    for (size_t i = 0; i < threads_num; ++i) {
+        workers.emplace_back(&QueryScheduler::Work, this, nodes.empty() ? 0 : i % nodes.size());
+    }
+}
+
+QueryScheduler::~QueryScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    arrived.notify_all();
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    if (holder && options.numa_placement != NumaPlacement::None) {
+        holder->SetNumaPlacement(NumaPlacement::None);
+    }
+}
+
+std::future<Points> QueryScheduler::Submit(Coords query, int K, int ef) {
+    if (!holder) {
+        throw std::invalid_argument("scheduler without a holder needs the index of every query");
+    }
+    return Submit(nullptr, std::move(query), K, ef);
+}
+
+std::future<Points> QueryScheduler::Submit(std::shared_ptr<HNSW> index, Coords query, int K, int ef,
+                                           std::shared_ptr<const NumaReplicas> replicas) {
+    if (!index && !holder) {
+        throw std::invalid_argument("scheduler without a holder needs the index of every query");
+    }
+    Pending pending{std::move(query), K, ef, std::chrono::steady_clock::now(), std::promise<Points>(),
+                    std::move(index), std::move(replicas)};
+    std::future<Points> result = pending.result.get_future();
+    ++queries_num;
+
+    size_t queued;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(std::move(pending));
+        queued = queue.size();
+    }
+    // an idle worker opens the window for the first query, the waiting one closes it early when full
+    if (queued == 1) {
+        arrived.notify_one();
+    } else if (queued >= options.max_batch) {
+        arrived.notify_all();
+    }
+    return result;
+}
+
+std::vector<Points> QueryScheduler::Search(const float *queries, size_t count, size_t dim, int K, int ef) {
+    if (!holder) {
+        throw std::invalid_argument("scheduler without a holder needs the index of every query");
+    }
+    return Search(nullptr, queries, count, dim, K, ef);
+}
+
+std::vector<Points> QueryScheduler::Search(std::shared_ptr<HNSW> index, const float *queries, size_t count,
+                                           size_t dim, int K, int ef,
+                                           std::shared_ptr<const NumaReplicas> replicas) {
+    std::vector<std::future<Points>> futures;
+    futures.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        futures.push_back(Submit(index, Coords(queries + i * dim, queries + (i + 1) * dim), K, ef, replicas));
+    }
+
+    std::vector<Points> results;
+    results.reserve(count);
+    for (std::future<Points> &future : futures) {
+        results.push_back(future.get());
+    }
+    return results;
+}
+
+const SchedulerOptions& QueryScheduler::GetOptions() const {
+    return options;
+}
+
+long QueryScheduler::GetQueries() const {
+    return queries_num;
+}
+
+long QueryScheduler::GetBatches() const {
+    return batches_num;
+}
+
+void QueryScheduler::Work(size_t node) {
+    if (!nodes.empty()) {
+        PinThreadToNode(nodes[node]);
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    ++idle_workers;
+    while (true) {
+        arrived.wait(lock, [this]() { return stopping || !queue.empty(); });
+        if (queue.empty()) return;
+
+        // another worker may take the batch meanwhile, then this one just goes back to waiting
+        auto deadline = queue.front().arrival + std::chrono::microseconds(options.window_us);
+        arrived.wait_until(lock, deadline, [this]() {
+            return stopping || flushing || queue.size() >= options.max_batch;
+        });
+        if (queue.empty()) continue;
+
+        // an equal share for every idle worker, the ones woken below take the rest
+        size_t take = std::min((queue.size() + idle_workers - 1) / idle_workers, options.max_batch);
+        std::vector<Pending> batch(std::make_move_iterator(queue.begin()),
+                                   std::make_move_iterator(queue.begin() + static_cast<long>(take)));
+        queue.erase(queue.begin(), queue.begin() + static_cast<long>(take));
+        flushing = !queue.empty();
+        bool wake = flushing;
+        --idle_workers;
+
+        lock.unlock();
+        if (wake) {
+            arrived.notify_all();
+        }
+        Run(batch, node);
+        lock.lock();
+        ++idle_workers;
+    }
+}
+
+void QueryScheduler::Run(std::vector<Pending> &batch, size_t node) {
+    ++batches_num;
+    std::vector<bool> taken(batch.size(), false);
+    for (size_t first = 0; first < batch.size(); ++first) {
+        if (taken[first]) continue;
+        std::vector<Pending*> group;
+        for (size_t i = first; i < batch.size(); ++i) {
+            if (!taken[i] && batch[i].index == batch[first].index) {
+                group.push_back(&batch[i]);
+                taken[i] = true;
+            }
+        }
+        RunGroup(group, node);
+    }
+}
+
+void QueryScheduler::RunGroup(const std::vector<Pending*> &group, size_t node) {
+    try {
+        // both keep the searched index alive until the batch is done
+        std::shared_ptr<HNSW> current = group[0]->index;
+        std::shared_ptr<const NumaReplicas> node_replicas = nodes.empty() ? nullptr : group[0]->replicas;
+        if (!current) {
+            node_replicas = nodes.empty() ? nullptr : holder->GetReplicas();
+            if (!node_replicas) {
+                current = holder->Get();
+            }
+        }
+        const HNSW &index = node_replicas ? node_replicas->Replica(node) : *current;
+
+        std::vector<BatchQuery> queries;
+        queries.reserve(group.size());
+        for (const Pending *pending : group) {
+            if (pending->query.size() != index.GetInputDim()) {
+                throw std::invalid_argument("query dimension does not match the index");
+            }
+            queries.push_back({pending->query.data(), pending->K, pending->ef});
+        }
+
+        std::vector<Points> results = index.BatchKNNSearch(queries);
+        for (size_t i = 0; i < group.size(); ++i) {
+            group[i]->result.set_value(std::move(results[i]));
+        }
+    } catch (...) {
+        for (Pending *pending : group) {
+            pending->result.set_exception(std::current_exception());
+        }
+    }
+}
@@ -0,0 +1,106 @@
+#ifndef HNSW_QUERY_SCHEDULER
+#define HNSW_QUERY_SCHEDULER
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "hnsw.h"
+#include "index_holder.h"
+#include "numa_replicas.h"
+
+
+struct SchedulerOptions {
+    long window_us = 200;      // longest wait of a batch's first query for others to join, zero dispatches at once
+    size_t max_batch = 64;     // a full batch starts without waiting for the window
+    int threads_num = 0;       // pool threads running batches, zero uses every core
+    // with a placement threads are pinned to NUMA nodes round robin and search their node's copy
+    // of the index; the scheduler sets the placement of its holder, queries naming their index
+    // bring its copies along
+    NumaPlacement numa_placement = NumaPlacement::None;
+};
+
+
+// Micro-batching in front of an index: queries from concurrent callers are collected for up
+// to the window or until a batch is full, then run as HNSW::BatchKNNSearch on the pool threads,
+// which complete every caller's future. What is queued when a window closes is split among
+// the idle threads, and a thread finishing a batch takes queries whose window already passed
+// at once, so a burst runs on the whole pool rather than one thread. Each batch searches the index current when
+// it starts, so reloads of the holder are picked up. The holder must outlive the scheduler.
+// Queries may also name their own index, then one pool serves several indexes: a batch
+// runs one BatchKNNSearch per index it holds queries for.
+class QueryScheduler {
+    struct Pending {
+        Coords query;
+        int K;
+        int ef;
+        std::chrono::steady_clock::time_point arrival;
+        std::promise<Points> result;
+        std::shared_ptr<HNSW> index;  // nullptr searches the holder's index
+        std::shared_ptr<const NumaReplicas> replicas;  // node copies of index, searched instead when set
+    };
+
+    IndexHolder *holder;
+    SchedulerOptions options;
+    std::vector<NumaNode> nodes;  // of the worker threads with a placement
+
+    std::mutex mutex;
+    std::condition_variable arrived;
+    std::deque<Pending> queue;
+    size_t idle_workers = 0;
+    bool flushing = false;  // a window closed with queries left, they go without waiting for their own
+    bool stopping = false;
+    std::vector<std::thread> workers;
+
+    std::atomic<long> queries_num{0};
+    std::atomic<long> batches_num{0};
+
+public:
+    QueryScheduler(IndexHolder &holder, const SchedulerOptions &options=SchedulerOptions());
+
+    // without a holder every query names its index
+    explicit QueryScheduler(const SchedulerOptions &options);
+
+    // queued queries are still answered, the holder drops its NUMA copies
+    ~QueryScheduler();
+
+    QueryScheduler(const QueryScheduler&) = delete;
+
+    QueryScheduler& operator=(const QueryScheduler&) = delete;
+
+    std::future<Points> Submit(Coords query, int K, int ef);
+
+    // searches index, which the batch keeps alive, instead of the holder's; with a placement the
+    // index's NumaReplicas of the same placement are searched when given
+    std::future<Points> Submit(std::shared_ptr<HNSW> index, Coords query, int K, int ef,
+                               std::shared_ptr<const NumaReplicas> replicas=nullptr);
+
+    // Submits count row-major queries of dim floats and waits for all of them, so they can share batches
+    std::vector<Points> Search(const float *queries, size_t count, size_t dim, int K, int ef);
+
+    std::vector<Points> Search(std::shared_ptr<HNSW> index, const float *queries, size_t count, size_t dim,
+                               int K, int ef, std::shared_ptr<const NumaReplicas> replicas=nullptr);
+
+    const SchedulerOptions& GetOptions() const;
+
+    long GetQueries() const;
+
+    long GetBatches() const;
+
+private:
+    QueryScheduler(IndexHolder *holder, const SchedulerOptions &options);
+
+    void Work(size_t node);
+
+    void Run(std::vector<Pending> &batch, size_t node);
+
+    // queries of one batch for the same index
+    void RunGroup(const std::vector<Pending*> &group, size_t node);
+};
+
+#endif // HNSW_QUERY_SCHEDULER
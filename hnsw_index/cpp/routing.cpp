@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+
+#include "utils.h"
+#include "routing.h"
+
+
+RoutingTable::RoutingTable() = default;
+
+RoutingTable::RoutingTable(size_t dim, std::vector<float> centroids, Points entries, int probes) :
+    dim(dim),
+    centroids(std::move(centroids)),
+    entries(std::move(entries)),
+    probes(probes),
+    kernels(SelectDistanceKernels(dim)) {
+    if (dim == 0 || this->centroids.size() != this->entries.size() * dim || probes <= 0) {
+        throw std::invalid_argument("routing table needs one entry per centroid and a positive number of probes");
+    }
+}
+
+
+static size_t NearestCentroid(const float *x, const std::vector<float> &centroids, size_t dim,
+                              const DistanceKernels &kernels) {
+    size_t best = 0;
+    float best_dist = std::numeric_limits<float>::max();
+    for (size_t c = 0; c * dim < centroids.size(); ++c) {
+        float dist = kernels.float32(x, centroids.data() + c * dim, dim);
+        if (dist < best_dist) {
+            best_dist = dist;
+            best = c;
+        }
+    }
+    return best;
+}
+
+
+std::vector<float> RoutingTable::TrainCentroids(const Storage &samples, size_t centroids_num, int iterations,
+                                                int threads_num, uint64_t seed) {
+    if (samples.empty() || samples[0].empty() || centroids_num == 0) {
+        throw std::invalid_argument("k-means needs samples and at least one centroid");
+    }
+    size_t n = samples.size();
+    size_t dim = samples[0].size();
+    centroids_num = std::min(centroids_num, n);
+    DistanceKernels kernels = SelectDistanceKernels(dim);
+
+    // k-means++: every next centroid is a sample drawn with probability proportional to its
+    // squared distance to the closest centroid chosen so far; a fixed seed keeps tables reproducible
+    std::vector<float> centroids;
+    centroids.reserve(centroids_num * dim);
+    std::vector<float> nearest(n, std::numeric_limits<float>::max());
+    std::mt19937_64 rng(seed);
+    size_t chosen = std::uniform_int_distribution<size_t>(0, n - 1)(rng);
+    for (size_t c = 0; c < centroids_num; ++c) {
+        centroids.insert(centroids.end(), samples[chosen].begin(), samples[chosen].end());
+        const float *centroid = centroids.data() + c * dim;
+        ParallelFor(n, threads_num, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                nearest[i] = std::min(nearest[i], kernels.float32(samples[i].data(), centroid, dim));
+            }
+        });
+
+        double total = std::accumulate(nearest.begin(), nearest.end(), 0.0);
+        if (total <= 0) break;  // every sample is a centroid already
+        double target = std::uniform_real_distribution<double>(0, total)(rng);
+        chosen = 0;
+        for (double sum = nearest[0]; sum < target && chosen + 1 < n; sum += nearest[++chosen]) {}
+    }
+    centroids_num = centroids.size() / dim;
+
+    std::vector<size_t> assignment(n);
+    for (int iteration = 0; iteration < iterations; ++iteration) {
+        ParallelFor(n, threads_num, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                assignment[i] = NearestCentroid(samples[i].data(), centroids, dim, kernels);
+            }
+        });
+
+        std::vector<double> sums(centroids_num * dim, 0);
+        std::vector<size_t> counts(centroids_num, 0);
+        for (size_t i = 0; i < n; ++i) {
+            ++counts[assignment[i]];
+            double *sum = sums.data() + assignment[i] * dim;
+            for (size_t j = 0; j < dim; ++j) {
+                sum[j] += samples[i][j];
+            }
+        }
+        // an emptied cluster keeps its centroid
+        for (size_t c = 0; c < centroids_num; ++c) {
+            if (counts[c] == 0) continue;
+            for (size_t j = 0; j < dim; ++j) {
+                centroids[c * dim + j] = static_cast<float>(sums[c * dim + j] / counts[c]);
+            }
+        }
+    }
+    return centroids;
+}
+
+
+bool RoutingTable::Empty() const {
+    return entries.empty();
+}
+
+size_t RoutingTable::GetDim() const {
+    return dim;
+}
+
+size_t RoutingTable::CentroidsNum() const {
+    return entries.size();
+}
+
+int RoutingTable::GetProbes() const {
+    return probes;
+}
+
+const std::vector<float>& RoutingTable::GetCentroids() const {
+    return centroids;
+}
+
+const Points& RoutingTable::GetEntries() const {
+    return entries;
+}
+
+
+Points RoutingTable::Route(const float *query) const {
+    std::vector<std::pair<float, Point>> scored(entries.size());
+    for (size_t c = 0; c < entries.size(); ++c) {
+        scored[c] = {kernels.float32(query, centroids.data() + c * dim, dim), entries[c]};
+    }
+
+    size_t top = std::min(scored.size(), static_cast<size_t>(probes));
+    std::partial_sort(scored.begin(), scored.begin() + top, scored.end());
+    Points points(top);
+    for (size_t i = 0; i < top; ++i) {
+        points[i] = scored[i].second;
+    }
+    return points;
+}
@@ -0,0 +1,51 @@
+#ifndef HNSW_ROUTING
+#define HNSW_ROUTING
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "kernels.h"
+#include "types.h"
+
+
+// Layer-0 entry points for searches: k-means centroids of the indexed vectors, each mapped
+// to its nearest indexed point. A query starts from the points of its probes closest
+// centroids, found with one pass over the contiguous centroid rows, instead of descending
+// the upper levels from the single global entry point.
+class RoutingTable {
+    size_t dim = 0;
+    std::vector<float> centroids;  // one row of dim floats per centroid
+    Points entries;                // nearest indexed point of every centroid
+    int probes = 0;
+    DistanceKernels kernels;
+
+public:
+    RoutingTable();
+
+    RoutingTable(size_t dim, std::vector<float> centroids, Points entries, int probes);
+
+    // Rows of at most centroids_num centroids after iterations of Lloyd's algorithm from a
+    // k-means++ seeding drawn from seed, assignments run on threads_num threads (<= 0 for every core)
+    static std::vector<float> TrainCentroids(const Storage &samples, size_t centroids_num, int iterations=10,
+                                             int threads_num=0,
+                                             uint64_t seed=std::mt19937_64::default_seed);
+
+    bool Empty() const;
+
+    size_t GetDim() const;
+
+    size_t CentroidsNum() const;
+
+    int GetProbes() const;
+
+    const std::vector<float>& GetCentroids() const;
+
+    const Points& GetEntries() const;
+
+    // entries of the probes centroids closest to the query, nearest first
+    Points Route(const float *query) const;
+};
+
+#endif // HNSW_ROUTING
@@ -0,0 +1,7 @@
+#include "tests.h"
+
+
+// Unit tests for ctest, exit code 1 when any of them failed
+int main() {
+    return RunTests() ? 0 : 1;
+}
@@ -4,8 +4,12 @@ from Cython.Build import cythonize
 
 ext = Extension(
     "pyhnsw",
-    sources=["pyhnsw.pyx", "hnsw.cpp", "dumps.cpp", "utils.cpp"],
+    sources=["pyhnsw.pyx", "hnsw.cpp", "dumps.cpp", "utils.cpp", "kernels.cpp", "arena.cpp", "compressed_graph.cpp",
+             "disk_index.cpp", "index_holder.cpp", "index_registry.cpp", "query_cache.cpp",
+             "projection.cpp", "query_scheduler.cpp", "numa_replicas.cpp", "merge.cpp",
+             "routing.cpp"],
     language="c++",
+    extra_compile_args=["-std=c++17"],
 )
 
 setup(
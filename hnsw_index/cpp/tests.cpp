@@ -1,14 +1,30 @@
 #include <iostream>
 #include <algorithm>
+#include <random>
+#include <thread>
 
 #include "utils.h"
 #include "hnsw.h"
 #include "dumps.h"
+#include "disk_index.h"
+#include "index_holder.h"
+#include "index_registry.h"
+#include "kernels.h"
+#include "numa_replicas.h"
+#include "query_scheduler.h"
+#include "merge.h"
 #include "tests.h"
 
 
+// test data generator, seeded so every run sees the same vectors
+static std::mt19937 test_rng;
+
+void SeedTestData(unsigned seed) {
+    test_rng.seed(seed);
+}
+
 float GenerateRandomFloat(int low, int high, bool random_sign) {
-    auto r = std::rand() / static_cast<float>(RAND_MAX);
+    auto r = std::uniform_real_distribution<float>(0, 1)(test_rng);
     if (random_sign && r < 0.5) {
         r *= -1;
     }
@@ -31,6 +47,41 @@ std::vector<std::vector<float>> GenerateNRandomVectors(int N, int dim, int low,
     return random_vectors;
 }
 
+Storage GenerateLowRankVectors(int N, int dim, int rank, float noise) {
+    Storage basis = GenerateNRandomVectors(rank, dim, 0, 1, true);
+    Storage vectors;
+    for (int i = 0; i < N; ++i) {
+        Coords latent = GenerateRandomVector(rank, 0, 1, true);
+        Coords coords = GenerateRandomVector(dim, 0, 1, true);
+        for (float &v : coords) {
+            v *= noise;
+        }
+        for (int r = 0; r < rank; ++r) {
+            for (int j = 0; j < dim; ++j) {
+                coords[j] += latent[r] * basis[r][j];
+            }
+        }
+        vectors.push_back(coords);
+    }
+    return vectors;
+}
+
+Storage GenerateGroupedVectors(int groups_num, int per_group, int dim, float spread, std::vector<int> &groups) {
+    Storage centers = GenerateNRandomVectors(groups_num, dim, 0, 1, true);
+    Storage vectors;
+    groups.clear();
+    for (int i = 0; i < groups_num * per_group; ++i) {
+        int group = i % groups_num;
+        Coords coords = GenerateRandomVector(dim, 0, 1, true);
+        for (int j = 0; j < dim; ++j) {
+            coords[j] = centers[group][j] + coords[j] * spread;
+        }
+        vectors.push_back(coords);
+        groups.push_back(group);
+    }
+    return vectors;
+}
+
 
 HNSW CreateHNSW(int N, int dim, int M, int M0, int ef_construction, float level_multiplier) {
     std::printf("Creating HNSW object, M=%d, M0=%d, ef_construction=%d, m_mult=%f\n",
@@ -152,11 +203,11 @@ bool TestLevelsDump(std::ofstream &ostrm, std::ifstream &istrm, const HNSW &hnsw
 }
 
 
-template<class T>
-std::vector<T> CreateVectorFromSet(const std::unordered_set<T> &set) {
-    std::vector<T> new_vec;
+template<class Set>
+std::vector<typename Set::value_type> CreateVectorFromSet(const Set &set) {
+    std::vector<typename Set::value_type> new_vec;
 
-    for (const T entry: set) {
+    for (const auto entry: set) {
         new_vec.push_back(entry);
     }
 
@@ -225,22 +276,1388 @@ bool TestHNSWDump(HNSW &old_hnsw, int K, int ef) {
 }
 
 
-void RunTests() {
+bool TestAdaptiveSearch(HNSW &hnsw, int K, int ef) {
+    std::printf("Testing adaptive search...");
+    const Storage &queries = hnsw.GetStorage();
+
+    bool good = true;
+    for (size_t q = 0; q < queries.size() && good; ++q) {
+        // without limits adaptive search must match the plain one
+        SearchResult unlimited = hnsw.AdaptiveKNNSearch(queries[q], K, ef, SearchLimits());
+        auto expected = hnsw.KNNSearch(queries[q], K, ef);
+        if (!VectorsEqual(unlimited.points, expected) || unlimited.cut_short || unlimited.early_stopped) {
+            std::printf("\n\tUnlimited search differs for Point %d\n", static_cast<int>(q));
+            PrintVector("\tPlain:", expected);
+            PrintVector("\tAdaptive:", unlimited.points);
+            good = false;
+        }
+
+        // entry points of every level are always evaluated, so the budget may be overrun by them only
+        SearchLimits budget;
+        budget.max_distance_evals = 5;
+        SearchResult limited = hnsw.AdaptiveKNNSearch(queries[q], K, ef, budget);
+        if (limited.points.empty() || limited.distance_evals > budget.max_distance_evals + hnsw.GetMaxLevel() + 1) {
+            std::printf("\n\tBudget violated for Point %d: %ld evals\n", static_cast<int>(q), limited.distance_evals);
+            good = false;
+        }
+        if (limited.distance_evals < unlimited.distance_evals && !limited.cut_short) {
+            std::printf("\n\tMissing cut_short flag for Point %d\n", static_cast<int>(q));
+            good = false;
+        }
+    }
+
+    return good;
+}
+
+
+Points BruteForceKNN(const Storage &storage, const Coords &query, int K) {
+    std::vector<Distance> distances;
+    for (size_t i = 0; i < storage.size(); ++i) {
+        distances.emplace_back(static_cast<Point>(i), query, storage[i]);
+    }
+
+    size_t top = std::min(distances.size(), static_cast<size_t>(K));
+    std::partial_sort(distances.begin(), distances.begin() + top, distances.end());
+
+    Points points;
+    for (size_t i = 0; i < top; ++i) {
+        points.push_back(distances[i].id);
+    }
+    return points;
+}
+
+
+bool TestElementTypes(const HNSW &hnsw, int K, int ef) {
+    std::printf("Testing element types...");
+    const Storage &queries = hnsw.GetStorage();
+
+    bool good = true;
+    for (ElementType type : {ElementType::Float16, ElementType::BFloat16}) {
+        HNSW converted = hnsw;
+        converted.SetElementType(type);
+        // fp16 keeps 11 significant bits, bf16 keeps 8
+        float tolerance = type == ElementType::Float16 ? 1e-3f : 8e-3f;
+
+        for (size_t i = 0; i < queries.size() && good; ++i) {
+            Coords decoded = converted.DecodeCoords(static_cast<Point>(i));
+            for (size_t j = 0; j < decoded.size(); ++j) {
+                if (std::abs(decoded[j] - queries[i][j]) > tolerance * std::max(1.f, std::abs(queries[i][j]))) {
+                    std::printf("\n\t%s decode error for Point %d: %f vs %f\n", ElementTypeToString(type).c_str(),
+                                static_cast<int>(i), decoded[j], queries[i][j]);
+                    good = false;
+                    break;
+                }
+            }
+        }
+
+        const char *storage_file = "test-storage.dump.tmp";
+        const char *index_file = "test-index.dump.tmp";
+        DumpHNSWToFile(storage_file, index_file, converted, true);
+        HNSW loaded = ReadHNSWFromFile(storage_file, index_file);
+        std::remove(storage_file);
+        std::remove(index_file);
+
+        if (loaded.GetElementType() != type) {
+            std::printf("\n\tElement type %s lost in dump\n", ElementTypeToString(type).c_str());
+            good = false;
+        }
+
+        for (size_t q = 0; q < queries.size() && good; ++q) {
+            auto converted_neighbors = converted.KNNSearch(queries[q], K, ef);
+            auto loaded_neighbors = loaded.KNNSearch(queries[q], K, ef);
+            if (!VectorsEqual(converted_neighbors, loaded_neighbors) || converted_neighbors[0] != static_cast<Point>(q)) {
+                std::printf("\n\tIncorrect %s neighbors for Point %d\n", ElementTypeToString(type).c_str(),
+                            static_cast<int>(q));
+                PrintVector("\tBefore dump:", converted_neighbors);
+                PrintVector("\tAfter dump:", loaded_neighbors);
+                good = false;
+            }
+        }
+    }
+
+    return good;
+}
+
+
+bool TestConcurrentSearch(const HNSW &hnsw, int threads_num, int K, int ef) {
+    std::printf("Testing concurrent search...");
+    const Storage &queries = hnsw.GetStorage();
+
+    std::vector<Points> expected;
+    for (const Coords &query : queries) {
+        expected.push_back(hnsw.KNNSearch(query, K, ef));
+    }
+
+    std::vector<int> failed(threads_num, 0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threads_num; ++t) {
+        threads.emplace_back([&, t]() {
+            for (int round = 0; round < 10; ++round) {
+                for (size_t q = t; q < queries.size(); q += threads_num) {
+                    if (hnsw.KNNSearch(queries[q].data(), K, ef) != expected[q]) {
+                        ++failed[t];
+                    }
+                }
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    int failed_total = 0;
+    for (int f : failed) {
+        failed_total += f;
+    }
+    if (failed_total > 0) {
+        std::printf("\n\t%d concurrent searches differ from sequential ones\n", failed_total);
+    }
+    return failed_total == 0;
+}
+
+
+bool TestMemoryUsage(const HNSW &hnsw) {
+    std::printf("Testing memory usage...");
+    MemoryReport report = hnsw.MemoryUsage();
+
+    bool good = report.storage > 0 && report.graph_level_0 > 0 && report.arena_used > 0 &&
+                report.arena_reserved >= report.arena_used;
+
+    // copies build their graph in an arena of their own
+    HNSW copy = hnsw;
+    MemoryReport copy_report = copy.MemoryUsage();
+    if (copy_report.arena_used == 0 || hnsw.MemoryUsage().arena_used != report.arena_used) {
+        std::printf("\n\tCopy does not own its arena\n");
+        good = false;
+    }
+
+    HNSW moved = std::move(copy);
+    if (moved.MemoryUsage().arena_used != copy_report.arena_used) {
+        std::printf("\n\tMove lost the arena\n");
+        good = false;
+    }
+
+    // move assignment takes the arena over too instead of copying the graph into its own, which
+    // would keep the blocks this larger graph reserved
+    HNSW assigned(8, 16, 50, 0.5);
+    assigned.InsertBatch(GenerateNRandomVectors(3000, 4, 0, 1, true));
+    assigned = std::move(moved);
+    if (assigned.MemoryUsage().arena_used != copy_report.arena_used ||
+        assigned.MemoryUsage().arena_reserved != copy_report.arena_reserved ||
+        assigned.KNNSearch(hnsw.GetStorage()[0], 5, 10) != hnsw.KNNSearch(hnsw.GetStorage()[0], 5, 10)) {
+        std::printf("\n\tMove assignment did not take the arena over\n");
+        good = false;
+    }
+
+    if (!good) {
+        PrintMemoryReport("\n\tActual", report);
+    }
+    return good;
+}
+
+
+bool TestSnapshot(const HNSW &hnsw, int K, int ef) {
+    std::printf("Testing snapshot...");
+    const char *snapshot_file = "test-snapshot.tmp";
+
+    bool good = true;
+    for (ElementType type : {ElementType::Float32, ElementType::Float16}) {
+        HNSW converted = hnsw;
+        converted.SetElementType(type);
+        DumpHNSWSnapshot(snapshot_file, converted);
+        HNSW loaded = ReadHNSWSnapshot(snapshot_file);
+
+        if (!IsHNSWSnapshot(snapshot_file) || loaded.GetElementType() != type || loaded.Size() != hnsw.Size() ||
+            loaded.GetEntryPoint() != hnsw.GetEntryPoint() || loaded.GetMaxLevel() != hnsw.GetMaxLevel()) {
+            std::printf("\n\tSnapshot params differ for %s\n", ElementTypeToString(type).c_str());
+            good = false;
+            break;
+        }
+
+        const Storage &queries = hnsw.GetStorage();
+        for (size_t q = 0; q < queries.size(); ++q) {
+            auto expected = converted.KNNSearch(queries[q], K, ef);
+            auto actual = loaded.KNNSearch(queries[q], K, ef);
+            if (!VectorsEqual(expected, actual)) {
+                std::printf("\n\tIncorrect snapshot neighbors for Point %d\n", static_cast<int>(q));
+                PrintVector("\tExpected:", expected);
+                PrintVector("\tLoaded:", actual);
+                good = false;
+                break;
+            }
+        }
+    }
+
+    std::remove(snapshot_file);
+    return good;
+}
+
+
+bool TestHotSwap(const HNSW &hnsw, int threads_num, int K, int ef) {
+    std::printf("Testing hot swap...");
+    const char *snapshot_file = "test-snapshot.tmp";
+    DumpHNSWSnapshot(snapshot_file, hnsw);
+
+    const Storage &queries = hnsw.GetStorage();
+    std::vector<Points> expected;
+    for (const Coords &query : queries) {
+        expected.push_back(hnsw.KNNSearch(query, K, ef));
+    }
+
+    IndexHolder holder(hnsw);
+    std::weak_ptr<HNSW> first = holder.Get();
+    std::atomic<bool> stop{false};
+    std::vector<int> failed(threads_num, 0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threads_num; ++t) {
+        threads.emplace_back([&, t]() {
+            while (!stop) {
+                for (size_t q = t; q < queries.size(); q += threads_num) {
+                    std::shared_ptr<HNSW> index = holder.Get();
+                    if (index->KNNSearch(queries[q].data(), K, ef) != expected[q]) {
+                        ++failed[t];
+                    }
+                }
+            }
+        });
+    }
+
+    const int reloads = 5;
+    for (int i = 0; i < reloads; ++i) {
+        holder.Reload(snapshot_file);
+    }
+    stop = true;
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    int failed_total = 0;
+    for (int f : failed) {
+        failed_total += f;
+    }
+
+    bool good = true;
+    if (failed_total > 0) {
+        std::printf("\n\t%d searches failed during reloads\n", failed_total);
+        good = false;
+    }
+    if (holder.Version() != reloads || !first.expired()) {
+        std::printf("\n\tVersion %ld after %d reloads, first index %s\n", holder.Version(), reloads,
+                    first.expired() ? "freed" : "still alive");
+        good = false;
+    }
+
+    std::remove(snapshot_file);
+    return good;
+}
+
+
+bool TestQueryCache(const HNSW &hnsw, int K, int ef) {
+    std::printf("Testing query cache...");
+    HNSW cached = hnsw;
+    cached.SetQueryCache(1 << 20);
+    const Storage &queries = hnsw.GetStorage();
+
+    bool good = true;
+    for (int round = 0; round < 2 && good; ++round) {
+        for (size_t q = 0; q < queries.size(); ++q) {
+            // the second round moves queries within their quantization cell
+            Coords query = queries[q];
+            if (round > 0) {
+                float step = cached.GetQueryCache().GetQuantizationStep();
+                query[0] = std::round(query[0] / step) * step;
+            }
+            if (cached.KNNSearch(query, K, ef) != hnsw.KNNSearch(queries[q], K, ef)) {
+                std::printf("\n\tCached neighbors differ for Point %d\n", static_cast<int>(q));
+                good = false;
+                break;
+            }
+        }
+    }
+
+    const QueryCache &cache = cached.GetQueryCache();
+    long queries_num = static_cast<long>(queries.size());
+    if (good && (cache.GetHits() != queries_num || cache.GetMisses() != queries_num)) {
+        std::printf("\n\t%ld hits, %ld misses for %ld repeated queries\n", cache.GetHits(), cache.GetMisses(),
+                    queries_num);
+        good = false;
+    }
+
+    // coordinates a multiple of 2^32 steps apart are different queries
+    HNSW coarse = hnsw;
+    coarse.SetQueryCache(1 << 20, 1.0f);
+    Coords near = queries[0];
+    Coords far = queries[0];
+    near[0] = 0.0f;
+    far[0] = 4294967296.0f;
+    coarse.KNNSearch(near, K, ef);
+    if (coarse.KNNSearch(far, K, ef) != hnsw.KNNSearch(far, K, ef) || coarse.GetQueryCache().GetHits() != 0) {
+        std::printf("\n\tFar query was answered from the cache of a near one\n");
+        good = false;
+    }
+
+    // inserts invalidate the cache
+    cached.InsertBatch({queries[0]});
+    if (cache.Entries() != 0) {
+        std::printf("\n\t%zu entries left after insert\n", cache.Entries());
+        good = false;
+    }
+
+    // budget is respected, least recently used entries go first
+    size_t budget = 4096;
+    cached.SetQueryCache(budget);
+    for (const Coords &query : queries) {
+        cached.KNNSearch(query, K, ef);
+    }
+    if (cached.GetQueryCache().Bytes() > budget || cached.GetQueryCache().Entries() == 0) {
+        std::printf("\n\t%zu bytes cached with a budget of %zu\n", cached.GetQueryCache().Bytes(), budget);
+        good = false;
+    }
+    return good;
+}
+
+
+bool TestProjection(int K, int ef) {
+    std::printf("Testing projection...");
+    const int dim = 32, rank = 4;
+    Storage data = GenerateLowRankVectors(300, dim, rank, 0.01f);
+    Projection projection = Projection::TrainPCA(data, 0.95f);
+
+    bool good = true;
+    if (projection.GetOutputDim() == 0 || projection.GetOutputDim() > static_cast<size_t>(rank) ||
+        projection.GetExplainedVariance() < 0.95f) {
+        std::printf("\n\tPCA kept %zu dimensions, %f of variance\n", projection.GetOutputDim(),
+                    projection.GetExplainedVariance());
+        good = false;
+    }
+
+    // component rows are orthonormal
+    const std::vector<float> &components = projection.GetComponents();
+    for (size_t r = 0; r < projection.GetOutputDim() && good; ++r) {
+        for (size_t q = 0; q < projection.GetOutputDim(); ++q) {
+            float dot = 0;
+            for (int j = 0; j < dim; ++j) {
+                dot += components[r * dim + j] * components[q * dim + j];
+            }
+            if (std::fabs(dot - (r == q ? 1.0f : 0.0f)) > 1e-4f) {
+                std::printf("\n\tComponents %zu and %zu have dot product %f\n", r, q, dot);
+                good = false;
+                break;
+            }
+        }
+    }
+
+    const char *storage_file = "test-storage.dump.tmp";
+    const char *index_file = "test-index.dump.tmp";
+    const char *snapshot_file = "test-snapshot.tmp";
+    for (bool rerank : {false, true}) {
+        HNSW hnsw(16, 32, 100, 0.5);
+        hnsw.SetProjection(projection, rerank);
+        hnsw.InsertBatch(data);
+
+        if (hnsw.GetDim() != projection.GetOutputDim() || hnsw.GetInputDim() != static_cast<size_t>(dim)) {
+            std::printf("\n\tIndex dimensions %zu/%zu\n", hnsw.GetDim(), hnsw.GetInputDim());
+            good = false;
+        }
+
+        DumpHNSWToFile(storage_file, index_file, hnsw, true);
+        HNSW loaded = ReadHNSWFromFile(storage_file, index_file);
+        DumpHNSWSnapshot(snapshot_file, hnsw);
+        HNSW snapshot = ReadHNSWSnapshot(snapshot_file);
+
+        size_t found = 0;
+        for (size_t q = 0; q < data.size() && good; ++q) {
+            Points neighbors = hnsw.KNNSearch(data[q], K, ef);
+            found += std::count(neighbors.begin(), neighbors.end(), static_cast<Point>(q));
+
+            if (snapshot.KNNSearch(data[q], K, ef) != neighbors ||
+                (rerank && loaded.KNNSearch(data[q], K, ef) != neighbors)) {
+                std::printf("\n\tReloaded index differs for Point %d, rerank %d\n", static_cast<int>(q), rerank);
+                good = false;
+            }
+        }
+        // with re-ranking every point finds itself first
+        if (good && found < data.size() * (rerank ? 1.0 : 0.9)) {
+            std::printf("\n\tOnly %zu of %zu points found themselves, rerank %d\n", found, data.size(), rerank);
+            good = false;
+        }
+    }
+
+    std::remove(storage_file);
+    std::remove(index_file);
+    std::remove(snapshot_file);
+    return good;
+}
+
+
+Points BruteForceGroupedKNN(const Storage &storage, const std::vector<int> &groups, const Coords &query, int K) {
+    Points all = BruteForceKNN(storage, query, static_cast<int>(storage.size()));
+    Points best;
+    std::unordered_set<int> seen;
+    for (Point p : all) {
+        if (best.size() == static_cast<size_t>(K)) break;
+        if (seen.insert(groups[p]).second) {
+            best.push_back(p);
+        }
+    }
+    return best;
+}
+
+
+bool TestGroupedSearch(int K, int ef) {
+    std::printf("Testing grouped search...");
+    std::vector<int> groups;
+    Storage vectors = GenerateGroupedVectors(50, 20, 16, 0.3, groups);
+    HNSW hnsw(16, 32, 100, 0.5);
+    hnsw.InsertBatch(vectors);
+
+    bool good = true;
+    try {
+        hnsw.GroupedKNNSearch(vectors[0], K, ef);
+        std::printf("\n\tGrouped search without groups did not throw\n");
+        good = false;
+    } catch (const std::logic_error &) {}
+    hnsw.SetGroups(groups);
+
+    const Storage queries = GenerateNRandomVectors(100, 16, 0, 1, true);
+    int matched = 0;
+    for (const Coords &query : queries) {
+        Points found = hnsw.GroupedKNNSearch(query, K, ef);
+        std::unordered_set<int> found_groups;
+        for (Point p : found) {
+            found_groups.insert(groups[p]);
+        }
+        if (found.size() != static_cast<size_t>(K) || found_groups.size() != found.size()) {
+            std::printf("\n\tExpected %d distinct groups\n", K);
+            PrintVector("\tFound:", found);
+            good = false;
+            break;
+        }
+        for (Point p : BruteForceGroupedKNN(vectors, groups, query, K)) {
+            matched += static_cast<int>(found_groups.count(groups[p]));
+        }
+    }
+
+    double recall = static_cast<double>(matched) / (queries.size() * K);
+    if (recall < 0.9) {
+        std::printf("\n\tGroup recall %f is too low\n", recall);
+        good = false;
+    }
+
+    // groups travel with both text dumps and snapshots
+    const char *storage_file = "test-groups-storage.tmp";
+    const char *params_file = "test-groups-params.tmp";
+    const char *snapshot_file = "test-groups-snapshot.tmp";
+    DumpHNSWToFile(storage_file, params_file, hnsw, true);
+    DumpHNSWSnapshot(snapshot_file, hnsw);
+    for (const HNSW &loaded : {ReadHNSWFromFile(storage_file, params_file), ReadHNSWSnapshot(snapshot_file)}) {
+        bool same_hits = true;
+        for (const Coords &query : queries) {
+            same_hits &= VectorsEqual(loaded.GroupedKNNSearch(query, K, ef), hnsw.GroupedKNNSearch(query, K, ef));
+        }
+        if (!VectorsEqual(loaded.GetGroups(), groups) || !same_hits) {
+            std::printf("\n\tGroups were not restored from a dump\n");
+            good = false;
+        }
+    }
+
+    std::remove(storage_file);
+    std::remove(params_file);
+    std::remove(snapshot_file);
+    return good;
+}
+
+
+bool TestGraphStats(const HNSW &hnsw, int K, int ef) {
+    std::printf("Testing graph stats...");
+    bool good = true;
+
+    std::vector<LevelStats> report = AnalyzeGraph(hnsw, 4);
+    if (report.size() != static_cast<size_t>(hnsw.GetMaxLevel() + 1) || report[0].nodes != hnsw.Size()) {
+        std::printf("\n\tExpected %d levels and %zu nodes on level 0\n", hnsw.GetMaxLevel() + 1, hnsw.Size());
+        return false;
+    }
+    for (const LevelStats &stats : report) {
+        size_t histogram_nodes = 0;
+        for (size_t count : stats.degree_histogram) {
+            histogram_nodes += count;
+        }
+        if (histogram_nodes != stats.nodes || stats.reachable + stats.unreachable.size() != stats.nodes) {
+            std::printf("\n\tInconsistent counts on level %d\n", stats.level);
+            good = false;
+        }
+    }
+
+    // cut every edge into a level-0 point, it stays searchable only through the repair
+    Point cut = -1;
+    for (const auto &entry : hnsw.GetLevels()) {
+        if (entry.second == 0 && entry.first != hnsw.GetEntryPoint()) {
+            cut = entry.first;
+            break;
+        }
+    }
+    HNSWGraph graph = hnsw.GetGraph();
+    Levels levels = hnsw.GetLevels();
+    Storage storage = hnsw.DecodeStorage();
+    size_t cut_degree = graph[0][cut].size();
+    for (auto &point_edges : graph[0]) {
+        point_edges.second.erase(cut);
+    }
+    HNSW broken(hnsw.GetMaxNeighbors(), hnsw.GetMaxNeighbors0(), hnsw.GetEfConstruction(), hnsw.GetLevelMultiplier(),
+                hnsw.GetMaxLevel(), hnsw.GetEntryPoint(), storage, graph, levels);
+
+    LevelStats level_0 = AnalyzeGraph(broken, 4)[0];
+    if (!VectorsEqual(level_0.unreachable, Points{cut}) || level_0.asymmetric_edges < cut_degree) {
+        std::printf("\n\tCut point %d was not reported\n", cut);
+        PrintVector("\tUnreachable:", level_0.unreachable);
+        good = false;
+    }
+
+    size_t repaired = RepairGraph(broken, 3, 4);
+    level_0 = AnalyzeGraph(broken, 4)[0];
+    if (repaired == 0 || !level_0.unreachable.empty() || broken.KNNSearch(storage[cut], K, ef)[0] != cut) {
+        std::printf("\n\tCut point %d was not repaired\n", cut);
+        good = false;
+    }
+    for (const auto &point_edges : broken.GetGraph().at(0)) {
+        if (point_edges.second.size() > static_cast<size_t>(broken.GetMaxNeighbors0())) {
+            std::printf("\n\tPoint %d has %zu neighbors after the repair\n", point_edges.first,
+                        point_edges.second.size());
+            good = false;
+        }
+    }
+    return good;
+}
+
+
+bool TestDistanceKernels() {
+    std::printf("Testing distance kernels...");
+    bool good = true;
+    for (int dim : {100, 128, 256, 512}) {
+        DistanceKernels kernels = SelectDistanceKernels(dim);
+        Coords x = GenerateRandomVector(dim, 0, 1, true);
+        Coords y = GenerateRandomVector(dim, 0, 1, true);
+        std::vector<uint16_t> half, bfloat;
+        for (float v : y) {
+            half.push_back(FloatToHalf(v));
+            bfloat.push_back(FloatToBFloat16(v));
+        }
+
+        float expected[3] = {L2SqrFloat(x.data(), y.data(), dim), L2SqrHalf(x.data(), half.data(), dim),
+                             L2SqrBFloat16(x.data(), bfloat.data(), dim)};
+        float actual[3] = {kernels.float32(x.data(), y.data(), dim), kernels.float16(x.data(), half.data(), dim),
+                           kernels.bfloat16(x.data(), bfloat.data(), dim)};
+        for (int k = 0; k < 3; ++k) {
+            if (std::fabs(actual[k] - expected[k]) > 1e-4f * expected[k]) {
+                std::printf("\n\tKernel %d for dim %d gives %f instead of %f\n", k, dim, actual[k], expected[k]);
+                good = false;
+            }
+        }
+    }
+    return good;
+}
+
+
+bool TestDiskIndex(const HNSW &hnsw, int K, int ef) {
+    std::printf("Testing disk index...");
+    const char *disk_file = "test-disk.dump.tmp";
+    const char *index_file = "test-index.dump.tmp";
+    DumpDiskLayout(disk_file, hnsw);
+    DumpHNSWToFile("", index_file, hnsw, false);
+
+    bool good = true;
+    {
+        // tiny cache so that evictions happen too
+        DiskIndex disk(disk_file, index_file, ElementType::Float16, 4);
+        const Storage &queries = hnsw.GetStorage();
+
+        for (size_t q = 0; q < queries.size() && good; ++q) {
+            DiskSearchResult result = disk.KNNSearch(queries[q], K, ef);
+            if (result.points.empty() || result.points[0] != static_cast<Point>(q)) {
+                std::printf("\n\tIncorrect disk neighbors for Point %d\n", static_cast<int>(q));
+                PrintVector("\tDisk:", result.points);
+                good = false;
+            }
+        }
+
+        if (disk.GetBlocksRead() == 0 || disk.GetNavigationIndex().Size() != queries.size()) {
+            std::printf("\n\tDisk index read %ld blocks for %zu points\n", disk.GetBlocksRead(),
+                        disk.GetNavigationIndex().Size());
+            good = false;
+        }
+
+        try {
+            disk.KNNSearch(Coords(hnsw.GetDim() + 1, 0.0f), K, ef);
+            std::printf("\n\tQuery of a wrong dimension was answered\n");
+            good = false;
+        } catch (const std::invalid_argument&) {
+        }
+    }
+
+    std::remove(disk_file);
+    std::remove(index_file);
+    return good;
+}
+
+
+bool TestBatchSearch(const HNSW &hnsw, int K, int ef) {
+    std::printf("Testing batch search...");
+    const Storage &queries = hnsw.GetStorage();
+
+    // every query twice with alternating parameters, duplicates must get the same answer
+    std::vector<BatchQuery> batch;
+    for (int copy = 0; copy < 2; ++copy) {
+        for (size_t q = 0; q < queries.size(); ++q) {
+            batch.push_back({queries[q].data(), K + static_cast<int>(q % 2), ef});
+        }
+    }
+    std::vector<Points> results = hnsw.BatchKNNSearch(batch);
+
+    bool good = results.size() == batch.size();
+    for (size_t i = 0; good && i < batch.size(); ++i) {
+        if (results[i] != hnsw.KNNSearch(batch[i].query, batch[i].K, batch[i].ef)) {
+            std::printf("\n\tBatch neighbors differ for query %zu\n", i);
+            good = false;
+        }
+    }
+
+    HNSW cached = hnsw;
+    cached.SetQueryCache(1 << 20);
+    for (int round = 0; good && round < 2; ++round) {
+        if (cached.BatchKNNSearch(batch) != results) {
+            std::printf("\n\tCached batch neighbors differ in round %d\n", round);
+            good = false;
+        }
+    }
+    if (good && cached.GetQueryCache().GetMisses() != static_cast<long>(queries.size())) {
+        std::printf("\n\t%ld cache misses for %zu distinct queries\n", cached.GetQueryCache().GetMisses(),
+                    queries.size());
+        good = false;
+    }
+    return good;
+}
+
+
+bool TestQueryScheduler(const HNSW &hnsw, int threads_num, int K, int ef) {
+    std::printf("Testing query scheduler...");
+    const Storage &queries = hnsw.GetStorage();
+    size_t dim = hnsw.GetInputDim();
+    std::vector<Points> expected;
+    std::vector<float> flat;
+    for (const Coords &query : queries) {
+        expected.push_back(hnsw.KNNSearch(query, K, ef));
+        flat.insert(flat.end(), query.begin(), query.end());
+    }
+
+    IndexHolder holder(hnsw);
+    SchedulerOptions options;
+    options.window_us = 2000;
+    options.max_batch = 16;
+    options.threads_num = 2;
+    QueryScheduler scheduler(holder, options);
+
+    std::vector<int> failed(threads_num, 0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threads_num; ++t) {
+        threads.emplace_back([&, t]() {
+            std::vector<Points> results = scheduler.Search(flat.data(), queries.size(), dim, K, ef);
+            for (size_t q = 0; q < queries.size(); ++q) {
+                failed[t] += results[q] != expected[q];
+            }
+            // single submissions within the window share batches too
+            std::future<Points> single = scheduler.Submit(queries[t], K, ef);
+            failed[t] += single.get() != expected[t];
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    int failed_total = 0;
+    for (int f : failed) {
+        failed_total += f;
+    }
+
+    bool good = true;
+    long submitted = static_cast<long>(threads_num * (queries.size() + 1));
+    if (failed_total > 0) {
+        std::printf("\n\t%d scheduled searches differ from direct ones\n", failed_total);
+        good = false;
+    }
+    if (scheduler.GetQueries() != submitted || scheduler.GetBatches() >= submitted) {
+        std::printf("\n\t%ld queries in %ld batches, %ld submitted\n", scheduler.GetQueries(),
+                    scheduler.GetBatches(), submitted);
+        good = false;
+    }
+
+    // a bad query fails its own future, not the scheduler
+    std::future<Points> bad = scheduler.Submit(Coords(dim + 1, 0.0f), K, ef);
+    try {
+        bad.get();
+        std::printf("\n\tQuery of a wrong dimension was answered\n");
+        good = false;
+    } catch (const std::invalid_argument&) {
+    }
+    return good;
+}
+
+
+bool TestIndexRegistry(const HNSW &hnsw, int threads_num, int K, int ef) {
+    std::printf("Testing index registry...");
+    HNSW other(8, 16, 50, 0.5);
+    other.InsertBatch(GenerateNRandomVectors(300, 12, 0, 1, true));
+    const char *files[] = {"test-registry-a.tmp", "test-registry-b.tmp"};
+    const HNSW *indexes[] = {&hnsw, &other};
+    std::vector<std::vector<float>> flat(2);
+    std::vector<std::vector<Points>> expected(2);
+    for (int i = 0; i < 2; ++i) {
+        DumpHNSWSnapshot(files[i], *indexes[i]);
+        for (const Coords &query : indexes[i]->GetStorage()) {
+            expected[i].push_back(indexes[i]->KNNSearch(query, K, ef));
+            flat[i].insert(flat[i].end(), query.begin(), query.end());
+        }
+    }
+    const std::string names[] = {"a", "b"};
+    size_t dims[] = {hnsw.GetInputDim(), other.GetInputDim()};
+
+    bool good = true;
+    {
+        // a budget of one byte keeps a single index loaded, the other is loaded again when asked for
+        RegistryOptions options;
+        options.memory_budget = 1;
+        options.scheduler.window_us = 1000;
+        options.scheduler.threads_num = 2;
+        IndexRegistry registry(options);
+        for (int i = 0; i < 2; ++i) {
+            registry.Register(names[i], files[i]);
+        }
+        if (registry.IsLoaded("a") || registry.IsLoaded("b") || registry.GetLoads() != 0) {
+            std::printf("\n\tIndexes were loaded before their first use\n");
+            good = false;
+        }
+
+        std::vector<int> failed(threads_num, 0);
+        std::atomic<long> submitted{0};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < threads_num; ++t) {
+            threads.emplace_back([&, t]() {
+                for (int round = 0; round < 3; ++round) {
+                    int i = (t + round) % 2;
+                    submitted += static_cast<long>(expected[i].size());
+                    std::vector<Points> results = registry.Search(names[i], flat[i].data(), expected[i].size(),
+                                                                  dims[i], K, ef);
+                    failed[t] += results != expected[i];
+                }
+            });
+        }
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+        int failed_total = 0;
+        for (int f : failed) {
+            failed_total += f;
+        }
+        if (failed_total > 0) {
+            std::printf("\n\t%d registry searches differ from direct ones\n", failed_total);
+            good = false;
+        }
+        if (registry.IsLoaded("a") == registry.IsLoaded("b") || registry.GetEvictions() == 0 ||
+            registry.GetLoads() != registry.GetEvictions() + 1) {
+            std::printf("\n\t%ld loads and %ld evictions under a one byte budget\n", registry.GetLoads(),
+                        registry.GetEvictions());
+            good = false;
+        }
+        if (registry.GetScheduler().GetQueries() != submitted) {
+            std::printf("\n\t%ld queries scheduled, %ld submitted\n", registry.GetScheduler().GetQueries(),
+                        submitted.load());
+            good = false;
+        }
+
+        try {
+            registry.Get("missing");
+            std::printf("\n\tUnknown index name was found\n");
+            good = false;
+        } catch (const std::out_of_range&) {
+        }
+    }
+
+    {
+        // without a window searches run on the calling thread, the pool stays unused
+        RegistryOptions options;
+        options.scheduler.window_us = 0;
+        IndexRegistry registry(options);
+        registry.Register("a", files[0]);
+        registry.Register("b", files[1]);
+        if (registry.Search("a", flat[0].data(), expected[0].size(), dims[0], K, ef) != expected[0] ||
+            registry.GetScheduler().GetQueries() != 0) {
+            std::printf("\n\tSearch without batching differs or went through the scheduler\n");
+            good = false;
+        }
+        size_t bytes = registry.Get("a")->MemoryUsage().Total() + registry.Get("b")->MemoryUsage().Total();
+        if (!registry.IsLoaded("a") || !registry.IsLoaded("b") || registry.LoadedBytes() != bytes) {
+            std::printf("\n\t%zu bytes loaded without a budget, %zu expected\n", registry.LoadedBytes(), bytes);
+            good = false;
+        }
+
+        // pointing a name at other files unloads it, searches already holding the old index go on
+        std::shared_ptr<HNSW> old = registry.Get("a");
+        registry.Register("a", files[1]);
+        if (registry.IsLoaded("a") || registry.Get("a")->Size() != other.Size() ||
+            old->KNNSearch(hnsw.GetStorage()[0], K, ef) != expected[0][0]) {
+            std::printf("\n\tRegistering new files did not replace the index\n");
+            good = false;
+        }
+        registry.Unload("b");
+        if (registry.IsLoaded("b") || registry.Names() != std::vector<std::string>{"a", "b"}) {
+            std::printf("\n\tUnloaded index is still loaded\n");
+            good = false;
+        }
+    }
+
+    {
+        // with a placement searches run on the NUMA copies, which count against the budget
+        RegistryOptions options;
+        options.scheduler.window_us = 0;
+        options.scheduler.threads_num = 2;
+        options.scheduler.numa_placement = NumaPlacement::Replicate;
+        IndexRegistry registry(options);
+        registry.Register("a", files[0]);
+        if (registry.Search("a", flat[0].data(), expected[0].size(), dims[0], K, ef) != expected[0] ||
+            registry.LoadedBytes() != registry.Get("a")->MemoryUsage().Total() * (1 + NumaTopology().size())) {
+            std::printf("\n\tSearch on NUMA copies differs or %zu bytes are charged\n", registry.LoadedBytes());
+            good = false;
+        }
+    }
+
+    for (const char *file : files) {
+        std::remove(file);
+    }
+    return good;
+}
+
+
+bool TestNumaReplicas(const HNSW &hnsw, int K, int ef) {
+    std::printf("Testing NUMA replicas...");
+    const Storage &queries = hnsw.GetStorage();
+    std::vector<Points> expected;
+    for (const Coords &query : queries) {
+        expected.push_back(hnsw.KNNSearch(query, K, ef));
+    }
+
+    bool good = true;
+    std::vector<NumaNode> nodes = NumaTopology();
+    if (nodes.empty() || nodes[0].cpus.empty()) {
+        std::printf("\n\tNo node with cpus found\n");
+        return false;
+    }
+
+    for (NumaPlacement placement : {NumaPlacement::None, NumaPlacement::Replicate, NumaPlacement::Interleave}) {
+        NumaReplicas replicas(hnsw, placement);
+        size_t copies = placement == NumaPlacement::Replicate ? nodes.size() : 1;
+        if (NumaPlacementFromString(NumaPlacementToString(placement)) != placement ||
+            replicas.ReplicasNum() != copies || replicas.Nodes().size() != nodes.size()) {
+            std::printf("\n\t%zu copies on %zu nodes with placement %s\n", replicas.ReplicasNum(),
+                        replicas.Nodes().size(), NumaPlacementToString(placement).c_str());
+            good = false;
+        }
+        for (size_t node = 0; node < nodes.size(); ++node) {
+            for (size_t q = 0; q < queries.size(); ++q) {
+                if (replicas.Replica(node).KNNSearch(queries[q], K, ef) != expected[q]) {
+                    std::printf("\n\tReplica on node %d differs for Point %zu\n", nodes[node].id, q);
+                    good = false;
+                    break;
+                }
+            }
+        }
+    }
+
+    // scheduled searches use the copies and follow swaps of the served index
+    IndexHolder holder(hnsw);
+    SchedulerOptions options;
+    options.window_us = 0;
+    options.threads_num = 2;
+    options.numa_placement = NumaPlacement::Replicate;
+    QueryScheduler scheduler(holder, options);
+    for (int round = 0; round < 2 && good; ++round) {
+        std::shared_ptr<HNSW> index = holder.Get();
+        for (size_t q = 0; q < queries.size(); ++q) {
+            if (scheduler.Submit(queries[q], K, ef).get() != index->KNNSearch(queries[q], K, ef)) {
+                std::printf("\n\tScheduled search on replicas differs for Point %zu in round %d\n", q, round);
+                good = false;
+                break;
+            }
+        }
+
+        // the swap builds the copies before it returns
+        HNSW grown = hnsw;
+        grown.InsertBatch(GenerateNRandomVectors(50, static_cast<int>(hnsw.GetInputDim()), 0, 1, true));
+        holder.Swap(std::make_shared<HNSW>(std::move(grown)));
+        if (holder.GetReplicas()->Replica(0).Size() != holder.Get()->Size()) {
+            std::printf("\n\tReplicas hold %zu points after a swap to %zu\n",
+                        holder.GetReplicas()->Replica(0).Size(), holder.Get()->Size());
+            good = false;
+        }
+    }
+    return good;
+}
+
+
+bool TestCompressedGraph(const HNSW &hnsw, int K, int ef) {
+    std::printf("Testing compressed graph...");
+    const Storage &queries = hnsw.GetStorage();
+    std::vector<Points> expected;
+    for (const Coords &query : queries) {
+        expected.push_back(hnsw.KNNSearch(query, K, ef));
+    }
+    auto same_results = [&](const HNSW &index, const char *name) {
+        for (size_t q = 0; q < queries.size(); ++q) {
+            if (index.KNNSearch(queries[q], K, ef) != expected[q]) {
+                std::printf("\n\t%s neighbors differ for Point %zu\n", name, q);
+                return false;
+            }
+        }
+        return true;
+    };
+
+    HNSW compressed = hnsw;
+    compressed.CompressGraph();
+    bool good = compressed.IsGraphCompressed() && compressed.GetGraph().count(0) == 0;
+    good = good && same_results(compressed, "Compressed");
+
+    // every list decodes to the original one, ascending
+    const auto &level_0 = hnsw.GetGraph().at(0);
+    Points decoded;
+    for (size_t p = 0; good && p < hnsw.Size(); ++p) {
+        compressed.GetCompressedGraph().Decode(static_cast<Point>(p), decoded);
+        auto edges = level_0.find(static_cast<Point>(p));
+        std::vector<Point> original;
+        if (edges != level_0.end()) {
+            original = CreateVectorFromSet(edges->second);
+        }
+        if (decoded != original) {
+            std::printf("\n\tDecoded list differs for Point %zu\n", p);
+            good = false;
+        }
+    }
+
+    size_t hash_bytes = hnsw.MemoryUsage().graph_level_0;
+    size_t compressed_bytes = compressed.MemoryUsage().graph_level_0;
+    if (compressed_bytes >= hash_bytes) {
+        std::printf("\n\tCompressed level 0 takes %zu bytes, hash maps %zu\n", compressed_bytes, hash_bytes);
+        good = false;
+    }
+
+    try {
+        compressed.InsertBatch({queries[0]});
+        std::printf("\n\tInsert into a compressed graph did not throw\n");
+        good = false;
+    } catch (const std::logic_error&) {
+    }
+
+    const char *snapshot_file = "test-compressed.tmp";
+    DumpHNSWSnapshot(snapshot_file, compressed);
+    HNSW loaded = ReadHNSWSnapshot(snapshot_file);
+    std::remove(snapshot_file);
+    good = good && loaded.IsGraphCompressed() && same_results(loaded, "Loaded compressed");
+
+    // decompressed indexes are writable again
+    loaded.DecompressGraph();
+    good = good && !loaded.IsGraphCompressed() && same_results(loaded, "Decompressed");
+    loaded.InsertBatch({queries[0]});
+    return good && loaded.Size() == hnsw.Size() + 1;
+}
+
+
+static HNSW ReadHNSWFromStreams(const std::string &storage_file, const std::string &index_file) {
+    std::ifstream storage_istrm(storage_file, std::ios::binary);
+    Storage storage = ReadStorageFromDump(storage_istrm);
+    std::ifstream index_istrm(index_file, std::ios::binary);
+    return ReadHNSWParamsFromDump(index_istrm, storage);
+}
+
+
+static bool SameGraph(const HNSWGraph &first, const HNSWGraph &second) {
+    if (first.size() != second.size()) return false;
+    for (const auto &level : first) {
+        auto other = second.find(level.first);
+        if (other == second.end() || other->second.size() != level.second.size()) return false;
+        for (const auto &point_edges : level.second) {
+            auto edges = other->second.find(point_edges.first);
+            if (edges == other->second.end() || edges->second != point_edges.second) return false;
+        }
+    }
+    return true;
+}
+
+
+bool TestTextLoader(const HNSW &hnsw, int K, int ef) {
+    std::printf("Testing parallel text loader...");
+    const char *storage_file = "test-storage.dump.tmp";
+    const char *index_file = "test-index.dump.tmp";
+
+    HNSW grouped = hnsw;
+    std::vector<int> groups(hnsw.Size());
+    for (size_t p = 0; p < groups.size(); ++p) {
+        groups[p] = static_cast<int>(p % 7);
+    }
+    grouped.SetGroups(groups);
+    HNSW half = grouped;
+    half.SetElementType(ElementType::Float16);
+
+    bool good = true;
+    std::vector<const HNSW*> indexes{&hnsw, &grouped, &half};
+    for (const HNSW *index : indexes) {
+        DumpHNSWToFile(storage_file, index_file, *index, true);
+        HNSW expected = ReadHNSWFromStreams(storage_file, index_file);
+        for (int threads_num : {1, 3}) {
+            HNSW loaded = ReadHNSWFromFile(storage_file, index_file, threads_num);
+            bool same = SameGraph(loaded.GetGraph(), expected.GetGraph()) &&
+                        loaded.GetLevels() == expected.GetLevels() &&
+                        loaded.DecodeStorage() == expected.DecodeStorage() &&
+                        loaded.GetElementType() == expected.GetElementType() &&
+                        loaded.GetGroups() == expected.GetGroups() &&
+                        loaded.GetEntryPoint() == expected.GetEntryPoint() &&
+                        loaded.GetMaxLevel() == expected.GetMaxLevel();
+            for (size_t q = 0; same && q < hnsw.Size(); ++q) {
+                same = loaded.KNNSearch(hnsw.GetStorage()[q], K, ef) == expected.KNNSearch(hnsw.GetStorage()[q], K, ef);
+            }
+            if (!same) {
+                std::printf("\n\tLoaded %s index with %d threads differs from the stream reader\n",
+                            ElementTypeToString(index->GetElementType()).c_str(), threads_num);
+                good = false;
+            }
+        }
+    }
+
+    // a cut off dump fails instead of loading part of the graph
+    std::string params;
+    {
+        std::ifstream istrm(index_file, std::ios::binary);
+        params.assign(std::istreambuf_iterator<char>(istrm), std::istreambuf_iterator<char>());
+    }
+    {
+        std::ofstream ostrm(index_file, std::ios::binary);
+        ostrm << params.substr(0, params.size() / 2);
+    }
+    try {
+        ReadHNSWFromFile(storage_file, index_file);
+        std::printf("\n\tTruncated dump was loaded\n");
+        good = false;
+    } catch (const std::runtime_error&) {
+    }
+
+    std::remove(storage_file);
+    std::remove(index_file);
+    return good;
+}
+
+
+static double Recall(const HNSW &hnsw, const Storage &queries, const std::vector<Points> &ground_truth, int K, int ef) {
+    size_t found = 0;
+    for (size_t q = 0; q < queries.size(); ++q) {
+        for (Point p : hnsw.KNNSearch(queries[q], K, ef)) {
+            found += std::count(ground_truth[q].begin(), ground_truth[q].end(), p);
+        }
+    }
+    return static_cast<double>(found) / (queries.size() * K);
+}
+
+
+bool TestMergeHNSW(int K, int ef) {
+    std::printf("Testing divide-and-merge build...");
+    const int N = 900, dim = 16;
+    const Storage data = GenerateNRandomVectors(N, dim, 0, 1, true);
+    const Storage queries = GenerateNRandomVectors(100, dim, 0, 1, true);
+    std::vector<Points> ground_truth;
+    for (const Coords &query : queries) {
+        ground_truth.push_back(BruteForceKNN(data, query, K));
+    }
+
+    HNSW single(16, 32, 100, 0.5);
+    single.InsertBatch(data);
+    double single_recall = Recall(single, queries, ground_truth, K, ef);
+
+    bool good = true;
+    auto check = [&](const HNSW &merged, const char *name) {
+        double recall = Recall(merged, queries, ground_truth, K, ef);
+        std::vector<LevelStats> stats = AnalyzeGraph(merged, 2);
+        if (merged.Size() != data.size() || merged.DecodeStorage() != data) {
+            std::printf("\n\t%s index does not keep the points in order\n", name);
+            good = false;
+        } else if (recall < single_recall - 0.05) {
+            std::printf("\n\t%s index recall %.3f, single build %.3f\n", name, recall, single_recall);
+            good = false;
+        } else if (stats[0].edges == 0 || stats[0].dangling_edges != 0 ||
+                   stats[0].degree_histogram.back() != 0 || stats[0].reachable < N * 0.99) {
+            std::printf("\n\t%s level 0: %zu reachable, %zu dangling, %zu over full\n", name,
+                        stats[0].reachable, stats[0].dangling_edges, stats[0].degree_histogram.back());
+            good = false;
+        }
+    };
+
+    check(BuildPartitioned(data, 3, 16, 32, 100, 0.5, 3), "Partitioned");
+
+    // a new batch is merged into an existing index, groups follow their points
+    HNSW base(16, 32, 100, 0.5), batch(16, 32, 100, 0.5);
+    base.InsertBatch(Storage(data.begin(), data.begin() + 2 * N / 3));
+    batch.InsertBatch(Storage(data.begin() + 2 * N / 3, data.end()));
+    std::vector<int> groups(N);
+    for (int p = 0; p < N; ++p) {
+        groups[p] = p % 5;
+    }
+    base.SetGroups(std::vector<int>(groups.begin(), groups.begin() + 2 * N / 3));
+    batch.SetGroups(std::vector<int>(groups.begin() + 2 * N / 3, groups.end()));
+    HNSW merged = MergeHNSW({base, batch});
+    check(merged, "Incremental");
+    if (merged.GetGroups() != groups) {
+        std::printf("\n\tMerged groups differ\n");
+        good = false;
+    }
+
+    try {
+        MergeHNSW({base, HNSW(8, 16, 100, 0.5)});
+        std::printf("\n\tIndexes with different parameters were merged\n");
+        good = false;
+    } catch (const std::invalid_argument&) {
+    }
+    return good;
+}
+
+
+bool TestSeededBuild() {
+    std::printf("Testing seeded builds...");
+    const int N = 600, dim = 16;
+    const Storage data = GenerateNRandomVectors(N, dim, 0, 1, true);
+    const Storage more = GenerateNRandomVectors(200, dim, 0, 1, true);
+    auto build = [&](uint64_t seed) {
+        HNSW hnsw(16, 32, 100, 0.5);
+        hnsw.SetSeed(seed);
+        hnsw.InsertBatch(data);
+        return hnsw;
+    };
+    auto same = [](const HNSW &a, const HNSW &b) {
+        return a.GetGraph() == b.GetGraph() && a.GetLevels() == b.GetLevels() &&
+               a.GetEntryPoint() == b.GetEntryPoint() && a.GetMaxLevel() == b.GetMaxLevel();
+    };
+
+    bool good = true;
+    HNSW first = build(7);
+    HNSW second = build(7);
+    if (!same(first, second)) {
+        std::printf("\n\tTwo builds with one seed differ\n");
+        good = false;
+    }
+    if (build(8).GetLevels() == first.GetLevels()) {
+        std::printf("\n\tOther seed gave the same levels\n");
+        good = false;
+    }
+
+    // levels are known before insertion and follow P(level >= 1) = exp(-1 / level_multiplier)
+    std::vector<int> levels = first.GenerateLevels(0, N);
+    long upper = 0;
+    for (Point p = 0; p < N; ++p) {
+        upper += levels[p] > 0;
+        if (first.GetLevels().at(p) != levels[p]) {
+            std::printf("\n\tPoint %d got level %d, %d was generated\n", p, first.GetLevels().at(p), levels[p]);
+            good = false;
+            break;
+        }
+    }
+    double expected_upper = N * std::exp(-1 / 0.5);
+    if (std::abs(upper - expected_upper) > 4 * std::sqrt(expected_upper)) {
+        std::printf("\n\t%ld points above level 0, about %.0f expected\n", upper, expected_upper);
+        good = false;
+    }
+
+    // the seed survives dumps, so inserting after a reload grows the same index
+    const char *storage_file = "test-seed-storage.tmp";
+    const char *params_file = "test-seed-params.tmp";
+    const char *snapshot_file = "test-seed-snapshot.tmp";
+    DumpHNSWToFile(storage_file, params_file, first, true);
+    DumpHNSWSnapshot(snapshot_file, first);
+    first.InsertBatch(more);
+    for (HNSW loaded : {ReadHNSWFromFile(storage_file, params_file), ReadHNSWSnapshot(snapshot_file)}) {
+        loaded.InsertBatch(more);
+        if (loaded.GetSeed() != 7 || !same(loaded, first)) {
+            std::printf("\n\tIndex grown after a reload differs, seed %lu\n", static_cast<unsigned long>(loaded.GetSeed()));
+            good = false;
+        }
+    }
+    std::remove(storage_file);
+    std::remove(params_file);
+    std::remove(snapshot_file);
+
+    // parts have seeds of their own, so thread count does not change them
+    std::vector<HNSW> serial = BuildPartitions(data, 3, 16, 32, 100, 0.5, 1, 7);
+    std::vector<HNSW> parallel = BuildPartitions(data, 3, 16, 32, 100, 0.5, 3, 7);
+    for (size_t i = 0; i < serial.size(); ++i) {
+        if (!same(serial[i], parallel[i])) {
+            std::printf("\n\tPart %zu differs between serial and parallel builds\n", i);
+            good = false;
+        }
+    }
+    return good;
+}
+
+
+bool TestRouting(int K, int ef) {
+    std::printf("Testing routing table...");
+    std::vector<int> groups;
+    const Storage all = GenerateGroupedVectors(40, 22, 16, 0.3, groups);
+    const Storage vectors(all.begin(), all.begin() + 40 * 20);
+    const Storage queries(all.begin() + 40 * 20, all.end());
+    HNSW hnsw(16, 32, 100, 0.5);
+    hnsw.InsertBatch(vectors);
+
+    std::vector<Points> ground_truth;
+    for (const Coords &query : queries) {
+        ground_truth.push_back(BruteForceKNN(vectors, query, K));
+    }
+    auto recall = [&](const HNSW &index) {
+        size_t found = 0;
+        for (size_t q = 0; q < queries.size(); ++q) {
+            for (Point p : index.KNNSearch(queries[q], K, ef)) {
+                found += std::count(ground_truth[q].begin(), ground_truth[q].end(), p);
+            }
+        }
+        return static_cast<double>(found) / (queries.size() * K);
+    };
+    double descent_recall = recall(hnsw);
+
+    HNSW routed = hnsw;
+    routed.TrainRouting(40, 3);
+    const RoutingTable &routing = routed.GetRoutingTable();
+    bool good = routing.CentroidsNum() == 40 && routing.GetProbes() == 3 && routing.GetDim() == 16;
+    if (!good) {
+        std::printf("\n\tRouting table has %zu centroids\n", routing.CentroidsNum());
+    }
+
+    // every centroid is mapped to the closest point of its cluster
+    for (size_t c = 0; good && c < routing.CentroidsNum(); ++c) {
+        Coords centroid(routing.GetCentroids().begin() + c * 16, routing.GetCentroids().begin() + (c + 1) * 16);
+        if (routing.GetEntries()[c] != BruteForceKNN(vectors, centroid, 1)[0]) {
+            std::printf("\n\tCentroid %zu is not mapped to its nearest point\n", c);
+            good = false;
+        }
+    }
+
+    double routed_recall = recall(routed);
+    if (routed_recall < descent_recall - 0.05) {
+        std::printf("\n\tRouted recall %.3f, descent %.3f\n", routed_recall, descent_recall);
+        good = false;
+    }
+    std::vector<BatchQuery> batch;
+    for (const Coords &query : queries) {
+        batch.push_back({query.data(), K, ef});
+    }
+    std::vector<Points> batch_results = routed.BatchKNNSearch(batch);
+    for (size_t q = 0; good && q < queries.size(); ++q) {
+        if (batch_results[q] != routed.KNNSearch(queries[q], K, ef)) {
+            std::printf("\n\tRouted batch search differs for query %zu\n", q);
+            good = false;
+        }
+    }
+
+    // the table travels with text dumps and snapshots
+    const char *storage_file = "test-routing-storage.tmp";
+    const char *params_file = "test-routing-params.tmp";
+    const char *snapshot_file = "test-routing-snapshot.tmp";
+    DumpHNSWToFile(storage_file, params_file, routed, true);
+    DumpHNSWSnapshot(snapshot_file, routed);
+    for (const HNSW &loaded : {ReadHNSWFromFile(storage_file, params_file), ReadHNSWFromStreams(storage_file, params_file),
+                               ReadHNSWSnapshot(snapshot_file)}) {
+        const RoutingTable &restored = loaded.GetRoutingTable();
+        bool same = restored.GetCentroids() == routing.GetCentroids() && restored.GetEntries() == routing.GetEntries() &&
+                    restored.GetProbes() == routing.GetProbes();
+        for (size_t q = 0; same && q < queries.size(); ++q) {
+            same = loaded.KNNSearch(queries[q], K, ef) == routed.KNNSearch(queries[q], K, ef);
+        }
+        if (!same) {
+            std::printf("\n\tRouting table was not restored from a dump\n");
+            good = false;
+        }
+    }
+    std::remove(storage_file);
+    std::remove(params_file);
+    std::remove(snapshot_file);
+
+    try {
+        routed.SetRoutingTable(RoutingTable(8, std::vector<float>(8), Points{0}, 1));
+        std::printf("\n\tRouting table of another dimension was accepted\n");
+        good = false;
+    } catch (const std::invalid_argument&) {
+    }
+    routed.TrainRouting(0);
+    return good && routed.GetRoutingTable().Empty() && recall(routed) == descent_recall;
+}
+
+
+static bool ReportTestResult(bool test_result) {
+    std::printf(test_result ? " ok\n" : " fail\n");
+    return test_result;
+}
+
+
+bool RunTests() {
     const char *filename = "test-dump.tmp";
     std::ofstream ostrm(filename, std::ios::binary);
     std::ifstream istrm(filename, std::ios::binary);
 
     HNSW hnsw = CreateHNSW(100, 3);
     bool test_result;
+    bool passed = true;
 
     test_result = TestStorageDump(ostrm, istrm, hnsw);
-    std::printf(test_result ? " ok\n" : " fail\n");
+    passed &= ReportTestResult(test_result);
     test_result = TestLevelsDump(ostrm, istrm, hnsw);
-    std::printf(test_result ? " ok\n" : " fail\n");
+    passed &= ReportTestResult(test_result);
     test_result = TestHNSWGraphDump(ostrm, istrm, hnsw);
-    std::printf(test_result ? " ok\n" : " fail\n");
+    passed &= ReportTestResult(test_result);
     test_result = TestHNSWDump(hnsw);
-    std::printf(test_result ? " ok\n" : " fail\n");
+    passed &= ReportTestResult(test_result);
+    test_result = TestAdaptiveSearch(hnsw);
+    passed &= ReportTestResult(test_result);
+    test_result = TestElementTypes(hnsw);
+    passed &= ReportTestResult(test_result);
+    test_result = TestConcurrentSearch(hnsw);
+    passed &= ReportTestResult(test_result);
+    test_result = TestMemoryUsage(hnsw);
+    passed &= ReportTestResult(test_result);
+    test_result = TestSnapshot(hnsw);
+    passed &= ReportTestResult(test_result);
+    test_result = TestHotSwap(hnsw);
+    passed &= ReportTestResult(test_result);
+    test_result = TestQueryCache(hnsw);
+    passed &= ReportTestResult(test_result);
+    test_result = TestProjection();
+    passed &= ReportTestResult(test_result);
+    test_result = TestGroupedSearch();
+    passed &= ReportTestResult(test_result);
+    test_result = TestGraphStats(hnsw);
+    passed &= ReportTestResult(test_result);
+    test_result = TestDistanceKernels();
+    passed &= ReportTestResult(test_result);
+    test_result = TestDiskIndex(hnsw);
+    passed &= ReportTestResult(test_result);
+    test_result = TestBatchSearch(hnsw);
+    passed &= ReportTestResult(test_result);
+    test_result = TestQueryScheduler(hnsw);
+    passed &= ReportTestResult(test_result);
+    test_result = TestIndexRegistry(hnsw);
+    passed &= ReportTestResult(test_result);
+    test_result = TestNumaReplicas(hnsw);
+    passed &= ReportTestResult(test_result);
+    test_result = TestCompressedGraph(hnsw);
+    passed &= ReportTestResult(test_result);
+    test_result = TestTextLoader(hnsw);
+    passed &= ReportTestResult(test_result);
+    test_result = TestMergeHNSW();
+    passed &= ReportTestResult(test_result);
+    test_result = TestRouting();
+    passed &= ReportTestResult(test_result);
+    test_result = TestSeededBuild();
+    passed &= ReportTestResult(test_result);
 
     std::remove(filename);
+    return passed;
 }
@@ -3,18 +3,31 @@
 
 #include <iostream>
 #include <algorithm>
+#include <thread>
 
 #include "utils.h"
 #include "hnsw.h"
 #include "dumps.h"
+#include "disk_index.h"
+#include "index_holder.h"
+#include "graph_stats.h"
 
 
+// restarts the generator behind the functions below
+void SeedTestData(unsigned seed);
+
 float GenerateRandomFloat(int low, int high, bool random_sign);
 
 std::vector<float> GenerateRandomVector(int dim, int low, int high, bool random_sign);
 
 std::vector<Coords> GenerateNRandomVectors(int N, int dim, int low, int high, bool random_sign);
 
+// N points near a random rank-dimensional subspace, a stand-in for redundant embeddings
+Storage GenerateLowRankVectors(int N, int dim, int rank, float noise);
+
+// per_group points around each of groups_num random centers, groups receives the group of every point
+Storage GenerateGroupedVectors(int groups_num, int per_group, int dim, float spread, std::vector<int> &groups);
+
 
 HNSW CreateHNSW(int N, int dim=128, int M=100, int M0=300, int ef_construction=300, float level_multiplier=0.9);
 
@@ -35,8 +48,8 @@ bool TestStorageDump(std::ofstream &ostrm, std::ifstream &istrm, const HNSW &hns
 bool TestLevelsDump(std::ofstream &ostrm, std::ifstream &istrm, const HNSW &hnsw);
 
 
-template<class T>
-std::vector<T> CreateVectorFromSet(const std::unordered_set<T> &set);
+template<class Set>
+std::vector<typename Set::value_type> CreateVectorFromSet(const Set &set);
 
 
 bool TestHNSWGraphDump(std::ofstream &ostrm, std::ifstream &istrm, const HNSW &hnsw);
@@ -45,6 +58,76 @@ bool TestHNSWGraphDump(std::ofstream &ostrm, std::ifstream &istrm, const HNSW &h
 bool TestHNSWDump(HNSW &old_hnsw, int K=5, int ef=10);
 
 
-void RunTests();
+bool TestAdaptiveSearch(HNSW &hnsw, int K=5, int ef=10);
+
+
+Points BruteForceKNN(const Storage &storage, const Coords &query, int K);
+
+
+bool TestElementTypes(const HNSW &hnsw, int K=5, int ef=10);
+
+
+bool TestConcurrentSearch(const HNSW &hnsw, int threads_num=4, int K=5, int ef=10);
+
+
+bool TestMemoryUsage(const HNSW &hnsw);
+
+
+bool TestSnapshot(const HNSW &hnsw, int K=5, int ef=10);
+
+
+bool TestHotSwap(const HNSW &hnsw, int threads_num=4, int K=5, int ef=10);
+
+
+bool TestQueryCache(const HNSW &hnsw, int K=5, int ef=10);
+
+
+bool TestBatchSearch(const HNSW &hnsw, int K=5, int ef=10);
+
+
+bool TestQueryScheduler(const HNSW &hnsw, int threads_num=4, int K=5, int ef=10);
+
+
+bool TestIndexRegistry(const HNSW &hnsw, int threads_num=4, int K=5, int ef=10);
+
+
+bool TestNumaReplicas(const HNSW &hnsw, int K=5, int ef=10);
+
+
+bool TestCompressedGraph(const HNSW &hnsw, int K=5, int ef=10);
+
+
+bool TestTextLoader(const HNSW &hnsw, int K=5, int ef=10);
+
+
+bool TestMergeHNSW(int K=5, int ef=20);
+
+
+bool TestRouting(int K=5, int ef=20);
+
+
+bool TestProjection(int K=5, int ef=20);
+
+
+Points BruteForceGroupedKNN(const Storage &storage, const std::vector<int> &groups, const Coords &query, int K);
+
+
+bool TestGroupedSearch(int K=5, int ef=10);
+
+
+bool TestGraphStats(const HNSW &hnsw, int K=5, int ef=10);
+
+
+bool TestDistanceKernels();
+
+
+bool TestDiskIndex(const HNSW &hnsw, int K=5, int ef=10);
+
+
+bool TestSeededBuild();
+
+
+// false when any test failed
+bool RunTests();
 
 #endif // HNSW_TESTS
\ No newline at end of file
@@ -2,16 +2,20 @@
 #define HNSW_TYPES_H
 
 #include <vector>
+#include <memory_resource>
 #include <unordered_set>
 #include <unordered_map>
 
 typedef int Point;
-typedef std::unordered_set<Point> PointsSet;
+typedef std::pmr::unordered_set<Point> PointsSet;
 typedef std::vector<Point> Points;
 
 typedef std::vector<float> Coords;
 typedef std::vector<Coords> Storage;
-typedef std::unordered_map<int, std::unordered_map<Point, PointsSet>> HNSWGraph;
-typedef std::unordered_map<Point, int> Levels;
+// graph and levels are allocated from the index arena, see arena.h
+typedef std::pmr::unordered_map<int, std::pmr::unordered_map<Point, PointsSet>> HNSWGraph;
+typedef std::pmr::unordered_map<Point, int> Levels;
+
+enum class ElementType { Float32, Float16, BFloat16 };
 
 #endif //HNSW_TYPES_H
@@ -3,17 +3,17 @@
 #include <cmath>
 #include <unordered_set>
 #include "utils.h"
+#include "kernels.h"
 
 
 Distance::Distance(int id, const Coords &target, const Coords &element) : id(id), dist(0) {
     dist = ComputeDistance(target, element);
 };
 
+Distance::Distance(int id, double dist) : id(id), dist(dist) {}
+
 double Distance::ComputeDistance(const Coords &first, const Coords &second) {
-    double dist = 0;
-    for (size_t i = 0; i < first.size(); ++i) {
-        dist += std::pow(first[i] - second[i], 2);
-    }
+    double dist = L2SqrFloat(first.data(), second.data(), first.size());
     return std::sqrt(dist / first.size());
 }
 
@@ -82,3 +82,10 @@ bool MoreDistanceQueue::empty() {
 size_t MoreDistanceQueue::size() {
     return queue.size();
 }
+
+uint64_t MixBits(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
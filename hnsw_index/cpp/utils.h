@@ -1,9 +1,13 @@
 #ifndef HNSW_UTILS
 #define HNSW_UTILS
 
+#include <algorithm>
+#include <cstdint>
 #include <functional>
 #include <queue>
 #include <cmath>
+#include <thread>
+#include <vector>
 #include "types.h"
 
 
@@ -13,6 +17,8 @@ struct Distance {
 
     Distance(int id, const Coords &target, const Coords &element);
 
+    Distance(int id, double dist);
+
     double ComputeDistance(const Coords &first, const Coords &second);
 
     bool operator<(const Distance &other) const;
@@ -60,4 +66,28 @@ public:
     size_t size();
 };
 
+
+// SplitMix64 finalizer: a bijection that spreads nearby inputs over the whole range, for
+// random streams keyed by a seed and a counter
+uint64_t MixBits(uint64_t x);
+
+
+// Calls body(begin, end) on contiguous chunks of [0, n), one chunk per thread; threads_num <= 0
+// uses every core. Returns after all chunks are done.
+template<class Body>
+void ParallelFor(size_t n, int threads_num, const Body &body) {
+    size_t threads = threads_num > 0 ? static_cast<size_t>(threads_num) : std::thread::hardware_concurrency();
+    threads = std::max<size_t>(1, std::min(threads, n));
+    size_t chunk = (n + threads - 1) / threads;
+
+    std::vector<std::thread> workers;
+    for (size_t begin = chunk; begin < n; begin += chunk) {
+        workers.emplace_back(body, begin, std::min(n, begin + chunk));
+    }
+    body(0, std::min(n, chunk));
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
 #endif // HNSW_UTILS
\ No newline at end of file